@@ -12,29 +12,366 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <interface/vcsm/user-vcsm.h>
 
+    /*
+     * One request of a batch allocation.  Backends skip the requests that are
+     * already done, and set is_done on all of them only if all succeed.
+     * handle, busaddr and usraddr must be zero-initialized.
+     */
+    struct mem_req {
+        size_t size, align;
+        uint32_t flags;
+        uint32_t handle, busaddr;
+        void *usraddr;
+        bool is_done, is_pooled;
+    };
+
     /* vcsm.c */
     int alloc_mem_vcsm(const size_t size, size_t align,
             const VCSM_CACHE_TYPE_T cache_type, uint32_t *handlep,
             uint32_t *busaddrp, void **usraddrp);
     int free_mem_vcsm(const uint32_t handle, void *usraddr);
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+    int import_mem_vcsm(const int dmabuf_fd, uint32_t *handlep,
+            uint32_t *busaddrp, void **usraddrp);
+    int export_mem_vcsm(const uint32_t handle, int *dmabuf_fdp);
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
 
     /* mailbox.c */
-    int get_processor_by_fd(const int fd_mb);
-    int alloc_mem_mailbox(const int fd_mb, const int fd_mem, const size_t size,
+    /* Requests per message of alloc_mem_mailbox_batch(). */
+#define MAILBOX_BATCH_MAX 32
+
+    int get_caps_by_fd(const int fd_mb, struct rpimemmgr_caps *capsp);
+    int alloc_mem_mailbox(const int fd_mb, const int fd_mem,
+            const struct rpimemmgr_caps *caps, const size_t size,
             const size_t align, const uint32_t flags, uint32_t *handlep,
             uint32_t *busaddrp, void **usraddrp);
     int free_mem_mailbox(const int fd_mb, const size_t size,
             const uint32_t handle, const uint32_t busaddr, void *usraddr);
+    int alloc_mem_mailbox_batch(const int fd_mb, const int fd_mem,
+            const struct rpimemmgr_caps *caps, const size_t n,
+            struct mem_req *reqs, const bool do_mapping);
+
+    /* cache.c */
+    /*
+     * vcsm_clean_invalid2() takes at most 255 entries (op_count is an
+     * unsigned char).
+     */
+#define CACHE_OP_BUF_ENTRIES 255
+#define CACHE_OP_BUF_PENDING 256
+
+    struct cache_range {
+        const void *owner;
+        uintptr_t start, end;
+    };
+
+    struct cache_op_buf {
+        size_t max_gap;
+        enum rpimemmgr_cache_op pending_op;
+        unsigned n_pending;
+        struct cache_range pending[CACHE_OP_BUF_PENDING];
+        /* Last, since the entries run past s.s[0]. */
+        union {
+            struct vcsm_user_clean_invalid2_s s;
+            uint8_t bytes[sizeof(struct vcsm_user_clean_invalid2_s)
+                    + sizeof(struct vcsm_user_clean_invalid2_block_s)
+                            * CACHE_OP_BUF_ENTRIES];
+        } u;
+    };
+
+    /*
+     * Clean ranges of the same non-NULL owner (the buffer they belong to)
+     * that are at most max_gap bytes apart are merged; others only if they
+     * overlap or touch.
+     */
+    void cache_op_buf_init(struct cache_op_buf *bp, const size_t max_gap);
+    /* Queues an op, issuing the ioctl first if the buffer is full. */
+    int cache_op_buf_add(struct cache_op_buf *bp,
+            const struct rpimemmgr_cache_op_desc *dp,
+            const void * const owner);
+    int cache_op_buf_flush(struct cache_op_buf *bp);
 
     /* drm.c */
-    int alloc_mem_drm(const int fd_drm, const size_t size, uint32_t *handlep,
-            uint32_t *busaddrp, void **usraddrp);
-    int free_mem_drm(const int fd_drm, const size_t size, const uint32_t handle,
+    /* The V3D device, or the one given to rpimemmgr_set_drm_device(). */
+    struct drm_dev {
+        int fd;
+        rpimemmgr_drm_ioctl_fn ioctl;
+    };
+    int alloc_mem_drm(const struct drm_dev *dev, const size_t size,
+            uint32_t *handlep, uint32_t *busaddrp, void **usraddrp);
+    int free_mem_drm(const struct drm_dev *dev, const size_t size,
+            const uint32_t handle, void *usraddr);
+    int map_mem_drm(const struct drm_dev *dev, const size_t size,
+            const uint32_t handle, void **usraddrp);
+    int unmap_mem_drm(const size_t size, void *usraddr);
+    int wait_mem_drm(const struct drm_dev *dev, const uint32_t handle,
+            const uint64_t timeout_ns, bool *is_idlep);
+    int export_mem_drm(const struct drm_dev *dev, const uint32_t handle,
+            int *dmabuf_fdp);
+    int import_mem_drm(const struct drm_dev *dev, const int dmabuf_fd,
+            uint32_t *handlep, uint32_t *busaddrp);
+    int sync_mem_dmabuf(const int dmabuf_fd, const enum rpimemmgr_cache_op op);
+
+    /* dmabuf.c */
+    int get_dmabuf_size(const int dmabuf_fd, size_t *sizep);
+    int open_dma_heap(const char *name);
+    int alloc_mem_dma_heap(const int fd_heap, const size_t size,
+            uint32_t *handlep, void **usraddrp);
+    int import_mem_dmabuf(const int dmabuf_fd, const size_t size,
+            uint32_t *handlep, void **usraddrp);
+    int export_mem_dmabuf(const uint32_t handle, int *dmabuf_fdp);
+    int free_mem_dmabuf(const size_t size, const uint32_t handle,
             void *usraddr);
 
+    /* stats.c */
+    void stats_add(uint64_t *p, const uint64_t v, const bool is_atomic);
+    void stats_live_add(struct rpimemmgr_backend_stats *bp, const size_t n,
+            const size_t size, const bool is_atomic);
+    void stats_live_sub(struct rpimemmgr_backend_stats *bp,
+            const size_t size, const bool is_atomic);
+    uint64_t stats_now(void);
+    void stats_latency(uint64_t *hist, const uint64_t start_ns,
+            const bool is_atomic);
+    void stats_snapshot(struct rpimemmgr_stats *dst,
+            const struct rpimemmgr_stats *src);
+    void stats_print(FILE *fp, const struct rpimemmgr_stats *statsp,
+            const char * const names[]);
+
+    /* shmstats.c */
+    struct shm_stats;
+    /* Takes a snapshot; called on the publisher thread. */
+    typedef void (*shm_stats_fill_fn)(struct rpimemmgr_shm_snapshot *dst,
+            void *arg);
+
+    struct shm_stats* shm_stats_create(const char *label,
+            const unsigned interval_ms, const shm_stats_fill_fn fill,
+            void * const arg);
+    /* Stops the thread and removes the object. */
+    void shm_stats_destroy(struct shm_stats * const shp);
+
+    /* sim.c */
+    /* Bus address space of the simulated backend. */
+    struct sim_space;
+
+    struct sim_space* sim_space_create(void);
+    void sim_space_destroy(struct sim_space * const ssp);
+    int alloc_mem_sim(struct sim_space * const ssp, const size_t size,
+            size_t align, uint32_t *handlep, uint32_t *busaddrp,
+            void **usraddrp);
+    int free_mem_sim(struct sim_space * const ssp, const size_t size,
+            const uint32_t busaddr, void *usraddr);
+    void sim_delay(const unsigned us);
+
+    /* stream.c */
+    void stream_copy_scalar(void *dst, const void *src, size_t size);
+    void stream_set_scalar(void *dst, const int c, size_t size);
+    void stream_copy(void *dst, const void *src, const size_t size);
+    void stream_set(void *dst, const int c, const size_t size);
+    const char* stream_kernel_name(void);
+
+    /* stream_neon.c */
+    void stream_copy_neon(void *dst, const void *src, size_t size);
+    void stream_set_neon(void *dst, const int c, size_t size);
+
+    /* stream_sse2.c */
+    void stream_copy_sse2(void *dst, const void *src, size_t size);
+    void stream_set_sse2(void *dst, const int c, size_t size);
+
+    /* xfer.c */
+    struct rpimemmgr_xfer {
+        struct rpimemmgr_xfer *next;
+        void *dst;
+        const void *src;
+        size_t size;
+        bool is_upload, use_stream;
+        /* Freed by the worker when done; nobody waits for it. */
+        bool is_detached;
+        /* Guarded by the queue's done_lock. */
+        bool is_done;
+        int err;
+    };
+
+    struct xfer_queue;
+    typedef int (*xfer_run_fn)(struct rpimemmgr_xfer *jp, void *arg);
+
+    struct xfer_queue* xfer_create(const unsigned n_workers,
+            const xfer_run_fn run, void * const arg);
+    void xfer_destroy(struct xfer_queue * const qp);
+    void xfer_submit(struct xfer_queue * const qp, const uintptr_t key,
+            struct rpimemmgr_xfer * const jp);
+    int xfer_wait(struct xfer_queue * const qp,
+            struct rpimemmgr_xfer * const jp);
+    bool xfer_is_done(struct xfer_queue * const qp,
+            const struct rpimemmgr_xfer * const jp);
+    int xfer_eventfd(const struct xfer_queue * const qp);
+
+    /* release.c */
+    struct release_job {
+        struct release_job *next;
+    };
+
+    struct release_queue;
+    typedef int (*release_run_fn)(struct release_job *jp, void *arg);
+    /* Returns whether to be called again soon although nothing is queued. */
+    typedef bool (*release_idle_fn)(void *arg);
+
+    struct release_queue* release_create(const release_run_fn run,
+            const release_idle_fn idle, void * const arg);
+    /* Runs what is queued, stops the thread and returns release_flush(). */
+    int release_destroy(struct release_queue * const qp);
+    void release_submit(struct release_queue * const qp,
+            struct release_job * const jp);
+    /* Has the idle callback called even if nothing is queued. */
+    void release_wake(struct release_queue * const qp);
+    /* Waits for the jobs submitted so far; returns their first error. */
+    int release_flush(struct release_queue * const qp);
+    int release_eventfd(const struct release_queue * const qp);
+
+    /* pool.c */
+#define POOL_MIN_BLOCK_SIZE 64
+#define POOL_CHUNK_ALIGN 4096
+
+    struct pool_chunk {
+        struct pool_class *class;
+        struct pool_chunk *prev, *next;
+        uint32_t handle, busaddr;
+        void *usraddr;
+        unsigned n_blocks, n_used, n_bumped, n_free;
+        uint32_t free_stack[];
+    };
+
+    struct pool_class {
+        struct pool *pool;
+        size_t block_size;
+        unsigned n_chunks;
+        struct pool_chunk *avail, *full;
+    };
+
+    struct pool {
+        unsigned type;
+        uint32_t flags;
+        size_t chunk_size;
+        struct pool *next;
+        unsigned n_classes;
+        struct pool_class classes[];
+    };
+
+    struct pool* pool_create(const unsigned type, const uint32_t flags,
+            const size_t chunk_size, const size_t max_size);
+    void pool_destroy(struct pool *pool);
+    int pool_class_of(const struct pool *pool, const size_t size,
+            size_t align);
+    int pool_get(struct pool *pool, const int cls, struct pool_chunk **chunkp,
+            size_t *offsetp);
+    struct pool_chunk* pool_add_chunk(struct pool *pool, const int cls,
+            const uint32_t handle, const uint32_t busaddr, void * const usraddr);
+    bool pool_put(struct pool_chunk *chunk, const size_t offset);
+    void pool_remove_chunk(struct pool_chunk *chunk);
+    struct pool_chunk* pool_any_chunk(const struct pool *pool);
+    /* Adds the bytes of the chunks and of the blocks in use to the sums. */
+    void pool_usage(const struct pool *pool, uint64_t *bytesp,
+            uint64_t *used_bytesp);
+
+    /* recycle.c */
+#define RECYCLE_HASH_SIZE 64
+#define RECYCLE_PAGE_SIZE 4096
+
+    struct recycle_entry {
+        unsigned type;
+        uint32_t flags;
+        size_t size;
+        uint32_t handle, busaddr;
+        void *usraddr;
+        uint64_t time_ns;
+        struct recycle_entry *hprev, *hnext; /* Hash chain. */
+        struct recycle_entry *lprev, *lnext; /* Release order. */
+    };
+
+    struct recycle {
+        size_t max_bytes;
+        uint64_t max_age_ns;
+        size_t n_bytes;
+        struct recycle_entry *oldest, *newest;
+        struct recycle_entry *table[RECYCLE_HASH_SIZE];
+    };
+
+    void recycle_init(struct recycle *rc);
+    size_t recycle_round_size(const size_t size);
+    int recycle_put(struct recycle *rc, const unsigned type,
+            const uint32_t flags, const size_t size, const uint32_t handle,
+            const uint32_t busaddr, void * const usraddr);
+    bool recycle_get(struct recycle *rc, const unsigned type,
+            const uint32_t flags, const bool mapped, const size_t size,
+            const size_t align, uint32_t *handlep, uint32_t *busaddrp,
+            void **usraddrp);
+    struct recycle_entry* recycle_pop_victim(struct recycle *rc,
+            const size_t max_bytes);
+
+    /* index.c */
+#define INDEX_LEAF_MAX 128
+
+    struct index_entry {
+        uintptr_t key;
+        size_t size;
+        void *value;
+    };
+
+    struct index_leaf {
+        unsigned n;
+        struct index_entry e[INDEX_LEAF_MAX];
+    };
+
+    struct index {
+        unsigned n_leaves, cap_leaves;
+        uintptr_t *first_keys;
+        struct index_leaf **leaves;
+    };
+
+    void index_init(struct index *idx);
+    void index_destroy(struct index *idx);
+    int index_insert(struct index *idx, const uintptr_t key, const size_t size,
+            void * const value);
+    void* index_remove(struct index *idx, const uintptr_t key);
+    void* index_find(const struct index *idx, const uintptr_t key);
+    const struct index_entry* index_find_range(const struct index *idx,
+            const uintptr_t addr);
+    void* index_any(const struct index *idx);
+
+    /* tcache.c */
+#define TCACHE_N_MAGS 8
+#define TCACHE_DEPTH 32
+
+    struct tcache_mag {
+        const struct pool_class *class;
+        unsigned n;
+        void *blocks[TCACHE_DEPTH];
+    };
+
+    /*
+     * Counters that every lookup or sync bumps, kept per thread so that
+     * threads do not share their cache line.  Only the owner writes them.
+     */
+    struct tcache_stats {
+        uint64_t n_lookups, n_syncs, bytes_cleaned, bytes_invalidated;
+    };
+
+    struct tcache {
+        void *owner;
+        struct tcache *prev, *next;
+        struct tcache_stats stats;
+        struct tcache_mag mags[TCACHE_N_MAGS];
+    };
+
+    struct tcache* tcache_create(void * const owner);
+    void tcache_destroy(struct tcache *tc);
+    void* tcache_pop(struct tcache *tc, const struct pool_class * const class);
+    bool tcache_push(struct tcache *tc, const struct pool_class * const class,
+            void * const block);
+    void* tcache_drain(struct tcache *tc);
+
 #define print_error(fmt, ...) \
         do { \
             fprintf(stderr, "%s:%d:%s: error: " fmt, \
@@ -11,69 +11,279 @@
 #include "local.h"
 #include <interface/vcsm/user-vcsm.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/param.h>
 
-#define MAX_CACHE_OP_ENTRIES 8
+/*
+ * vcsm_clean_invalid2() takes at most 255 entries (op_count is an unsigned
+ * char), each of at most 65535 blocks of at most UINT_MAX bytes.  Longer
+ * lists and larger entries are split here, and entries are packed as densely
+ * as possible so that the number of ioctls is minimal.
+ *
+ * Before that, contiguous ranges of the same op are collected, sorted and
+ * merged when they overlap, touch, or (cleans within the same buffer only)
+ * are at most max_gap bytes apart: cleaning a few extra lines costs less than
+ * an extra entry.  Strided cleans whose blocks are that close are folded into
+ * one range first.  Invalidates are never bridged, since that would throw
+ * away dirty lines in the gaps that the caller did not ask to sync.  Ops are
+ * never reordered across a change of op, so a clean followed by an
+ * invalidate of the same range stays in order.
+ */
 
-/* op0, user0, size0, op1, user1, size1, ... */
-int rpimemmgr_cache_op_multiple(unsigned op_count, ...)
+#define MAX_BLOCK_COUNT USHRT_MAX
+#define MAX_BLOCK_SIZE (UINT_MAX & ~(size_t) 4095)
+
+void cache_op_buf_init(struct cache_op_buf *bp, const size_t max_gap)
 {
-    unsigned i;
-    va_list ap;
+    bp->u.s.op_count = 0;
+    memset(bp->u.s.zero, 0, sizeof(bp->u.s.zero));
+    bp->max_gap = max_gap;
+    bp->n_pending = 0;
+    bp->pending_op = RPIMEMMGR_CACHE_OP_INVALIDATE;
+}
 
-    va_start(ap, op_count);
-    for (; ; op_count -= MAX_CACHE_OP_ENTRIES) {
-        int err;
-
-        uint8_t *buf[sizeof(struct vcsm_user_clean_invalid2_s) +
-                sizeof(struct vcsm_user_clean_invalid2_block_s) *
-                        MAX_CACHE_OP_ENTRIES];
-        struct vcsm_user_clean_invalid2_s *s =
-                (struct vcsm_user_clean_invalid2_s*) buf;
-
-        const unsigned count = MIN(op_count, MAX_CACHE_OP_ENTRIES);
-        s->op_count = count;
-
-        for (i = 0; i < count; i ++) {
-            const enum rpimemmgr_cache_op op =
-                    va_arg(ap, enum rpimemmgr_cache_op);
-            unsigned mode;
-
-            switch (op) {
-                case RPIMEMMGR_CACHE_OP_INVALIDATE:
-                    mode = 1;
-                    break;
-                case RPIMEMMGR_CACHE_OP_CLEAN:
-                    mode = 2;
-                    break;
-                default:
-                    print_error("Invalid op: %d\n", op);
-                    return 1;
-            }
-
-            s->s[i].invalidate_mode = mode;
-            s->s[i].block_count = 1;
-            s->s[i].start_address = va_arg(ap, void*);
-            s->s[i].block_size = va_arg(ap, size_t);
-            s->s[i].inter_block_stride = 0;
+/* Gaps are bridged only by cleans, and only within one buffer. */
+static size_t max_gap_of(const struct cache_op_buf *bp,
+        const enum rpimemmgr_cache_op op, const void * const owner)
+{
+    if (owner == NULL || op != RPIMEMMGR_CACHE_OP_CLEAN)
+        return 0;
+    return bp->max_gap;
+}
+
+static unsigned mode_of(const enum rpimemmgr_cache_op op)
+{
+    switch (op) {
+        case RPIMEMMGR_CACHE_OP_INVALIDATE:
+            return 1;
+        case RPIMEMMGR_CACHE_OP_CLEAN:
+            return 2;
+        default:
+            print_error("Invalid op: %d\n", op);
+            return 0;
+    }
+}
+
+static int issue(struct cache_op_buf *bp)
+{
+    int err;
+
+    if (bp->u.s.op_count == 0)
+        return 0;
+
+    err = vcsm_clean_invalid2(&bp->u.s);
+    if (err) {
+        print_error("Failed to sync cache: %d\n", err);
+        return err;
+    }
+    bp->u.s.op_count = 0;
+    return 0;
+}
+
+static int add_entry(struct cache_op_buf *bp, const unsigned mode,
+        void * const p, const size_t block_count, const size_t block_size,
+        const size_t stride)
+{
+    struct vcsm_user_clean_invalid2_block_s *ep;
+
+    if (bp->u.s.op_count == CACHE_OP_BUF_ENTRIES) {
+        int err = issue(bp);
+        if (err)
+            return err;
+    }
+
+    ep = &bp->u.s.s[bp->u.s.op_count ++];
+    ep->invalidate_mode = mode;
+    ep->block_count = block_count;
+    ep->start_address = p;
+    ep->block_size = block_size;
+    ep->inter_block_stride = stride;
+    return 0;
+}
+
+static int add_range(struct cache_op_buf *bp, const unsigned mode,
+        uint8_t * const p, const size_t size)
+{
+    size_t off;
+
+    for (off = 0; off < size; off += MAX_BLOCK_SIZE) {
+        int err = add_entry(bp, mode, p + off, 1,
+                MIN(size - off, MAX_BLOCK_SIZE), 0);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+static int add_strided(struct cache_op_buf *bp, const unsigned mode,
+        const struct rpimemmgr_cache_op_desc *dp)
+{
+    size_t i;
+    int err;
+
+    if (dp->block_size <= MAX_BLOCK_SIZE && dp->stride <= UINT_MAX) {
+        for (i = 0; i < dp->block_count; i += MAX_BLOCK_COUNT) {
+            err = add_entry(bp, mode, (uint8_t*) dp->usraddr + i * dp->stride,
+                    MIN(dp->block_count - i, MAX_BLOCK_COUNT),
+                    dp->block_size, dp->stride);
+            if (err)
+                return err;
         }
+        return 0;
+    }
 
-        err = vcsm_clean_invalid2(s);
-        if (err) {
-            print_error("Failed to sync cache: %d\n", err);
+    /* Huge blocks or strides: one entry per piece of each block. */
+    for (i = 0; i < dp->block_count; i ++) {
+        err = add_range(bp, mode, (uint8_t*) dp->usraddr + i * dp->stride,
+                dp->block_size);
+        if (err)
             return err;
+    }
+    return 0;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const struct cache_range * const ra = a, * const rb = b;
+
+    if (ra->owner != rb->owner)
+        return (uintptr_t) ra->owner < (uintptr_t) rb->owner ? -1 : 1;
+    if (ra->start != rb->start)
+        return ra->start < rb->start ? -1 : 1;
+    return 0;
+}
+
+/* Sorts and merges the pending ranges and queues them as entries. */
+static int add_pending(struct cache_op_buf *bp)
+{
+    struct cache_range *cur;
+    unsigned mode, i;
+    int err;
+
+    if (bp->n_pending == 0)
+        return 0;
+    mode = mode_of(bp->pending_op);
+
+    if (bp->n_pending > 1)
+        qsort(bp->pending, bp->n_pending, sizeof(bp->pending[0]),
+                compare_ranges);
+
+    cur = &bp->pending[0];
+    for (i = 1; i < bp->n_pending; i ++) {
+        const struct cache_range * const next = &bp->pending[i];
+        const size_t max_gap = max_gap_of(bp, bp->pending_op, next->owner);
+        if (next->owner == cur->owner && next->start <= cur->end
+                + max_gap) {
+            cur->end = MAX(cur->end, next->end);
+            continue;
         }
+        err = add_range(bp, mode, (uint8_t*) cur->start,
+                cur->end - cur->start);
+        if (err)
+            return err;
+        cur = &bp->pending[i];
+    }
+    err = add_range(bp, mode, (uint8_t*) cur->start, cur->end - cur->start);
+
+    bp->n_pending = 0;
+    return err;
+}
+
+int cache_op_buf_add(struct cache_op_buf *bp,
+        const struct rpimemmgr_cache_op_desc *dp, const void * const owner)
+{
+    const unsigned mode = mode_of(dp->op);
+    const size_t max_gap = max_gap_of(bp, dp->op, owner);
+    struct cache_range *rp;
+    int err;
 
-        if (op_count < MAX_CACHE_OP_ENTRIES)
-            break;
+    if (mode == 0)
+        return 1;
+
+    if (dp->block_count == 0 || dp->block_size == 0)
+        return 0;
+
+    if (bp->n_pending > 0 && dp->op != bp->pending_op) {
+        err = add_pending(bp);
+        if (err)
+            return err;
+    }
+
+    /* Leave blocks that are far apart to the kernel. */
+    if (dp->block_count > 1 && dp->stride != 0
+            && dp->stride > dp->block_size + max_gap)
+        return add_strided(bp, mode, dp);
+
+    if (bp->n_pending == CACHE_OP_BUF_PENDING) {
+        err = add_pending(bp);
+        if (err)
+            return err;
     }
-    va_end(ap);
 
+    rp = &bp->pending[bp->n_pending ++];
+    rp->owner = owner;
+    rp->start = (uintptr_t) dp->usraddr;
+    rp->end = rp->start + dp->block_size;
+    if (dp->block_count > 1 && dp->stride != 0)
+        rp->end += (dp->block_count - 1) * dp->stride;
+    bp->pending_op = dp->op;
     return 0;
 }
 
+int cache_op_buf_flush(struct cache_op_buf *bp)
+{
+    int err;
+
+    err = add_pending(bp);
+    if (err)
+        return err;
+    return issue(bp);
+}
+
+int rpimemmgr_cache_op_array(const size_t n,
+        const struct rpimemmgr_cache_op_desc * const descs)
+{
+    struct cache_op_buf buf;
+    size_t i;
+
+    cache_op_buf_init(&buf, 0);
+    for (i = 0; i < n; i ++) {
+        int err = cache_op_buf_add(&buf, &descs[i], NULL);
+        if (err)
+            return err;
+    }
+    return cache_op_buf_flush(&buf);
+}
+
+/* op0, user0, size0, op1, user1, size1, ... */
+int rpimemmgr_cache_op_multiple(unsigned op_count, ...)
+{
+    struct cache_op_buf buf;
+    int err = 0;
+    va_list ap;
+
+    cache_op_buf_init(&buf, 0);
+    va_start(ap, op_count);
+    for (; op_count > 0 && !err; op_count --) {
+        struct rpimemmgr_cache_op_desc desc;
+        desc.op = va_arg(ap, enum rpimemmgr_cache_op);
+        desc.usraddr = va_arg(ap, void*);
+        desc.block_count = 1;
+        desc.block_size = va_arg(ap, size_t);
+        desc.stride = 0;
+        err = cache_op_buf_add(&buf, &desc, NULL);
+    }
+    va_end(ap);
+    if (err)
+        return err;
+
+    return cache_op_buf_flush(&buf);
+}
+
 int rpimemmgr_cache_op(const enum rpimemmgr_cache_op op, void * const p,
         const size_t size)
 {
@@ -83,58 +293,26 @@ int rpimemmgr_cache_op(const enum rpimemmgr_cache_op op, void * const p,
 /* op0, user0, block_count0, block_size0, stride0, ... */
 int rpimemmgr_cache_op_2_multiple(unsigned op_count, ...)
 {
-    unsigned i;
+    struct cache_op_buf buf;
+    int err = 0;
     va_list ap;
 
+    cache_op_buf_init(&buf, 0);
     va_start(ap, op_count);
-    for (; ; op_count -= MAX_CACHE_OP_ENTRIES) {
-        int err;
-
-        uint8_t *buf[sizeof(struct vcsm_user_clean_invalid2_s) +
-                sizeof(struct vcsm_user_clean_invalid2_block_s) *
-                        MAX_CACHE_OP_ENTRIES];
-        struct vcsm_user_clean_invalid2_s *s =
-                (struct vcsm_user_clean_invalid2_s*) buf;
-
-        const unsigned count = MIN(op_count, MAX_CACHE_OP_ENTRIES);
-        s->op_count = count;
-
-        for (i = 0; i < count; i ++) {
-            const enum rpimemmgr_cache_op op =
-                    va_arg(ap, enum rpimemmgr_cache_op);
-            unsigned mode;
-
-            switch (op) {
-                case RPIMEMMGR_CACHE_OP_INVALIDATE:
-                    mode = 1;
-                    break;
-                case RPIMEMMGR_CACHE_OP_CLEAN:
-                    mode = 2;
-                    break;
-                default:
-                    print_error("Invalid op: %d\n", op);
-                    return 1;
-            }
-
-            s->s[i].invalidate_mode = mode;
-            s->s[i].start_address = va_arg(ap, void*);
-            s->s[i].block_count = va_arg(ap, size_t);
-            s->s[i].block_size = va_arg(ap, size_t);
-            s->s[i].inter_block_stride = va_arg(ap, size_t);
-        }
-
-        err = vcsm_clean_invalid2(s);
-        if (err) {
-            print_error("Failed to sync cache: %d\n", err);
-            return err;
-        }
-
-        if (op_count < MAX_CACHE_OP_ENTRIES)
-            break;
+    for (; op_count > 0 && !err; op_count --) {
+        struct rpimemmgr_cache_op_desc desc;
+        desc.op = va_arg(ap, enum rpimemmgr_cache_op);
+        desc.usraddr = va_arg(ap, void*);
+        desc.block_count = va_arg(ap, size_t);
+        desc.block_size = va_arg(ap, size_t);
+        desc.stride = va_arg(ap, size_t);
+        err = cache_op_buf_add(&buf, &desc, NULL);
     }
     va_end(ap);
+    if (err)
+        return err;
 
-    return 0;
+    return cache_op_buf_flush(&buf);
 }
 
 int rpimemmgr_cache_op_2(const enum rpimemmgr_cache_op op, void * const p,
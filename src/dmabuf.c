@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/types.h>
+
+/*
+ * From <linux/dma-heap.h>, which kernel headers before 5.6 do not have.  The
+ * ioctl is ABI, so it is defined here rather than made a build dependency.
+ */
+struct dma_heap_allocation_data {
+    __u64 len;
+    __u32 fd;
+    __u32 fd_flags;
+    __u64 heap_flags;
+};
+#define DMA_HEAP_IOC_MAGIC 'H'
+#define DMA_HEAP_IOCTL_ALLOC \
+        _IOWR(DMA_HEAP_IOC_MAGIC, 0x0, struct dma_heap_allocation_data)
+
+/*
+ * dma-bufs for the CPU only: foreign ones imported here, and our own ones
+ * allocated from a dma-heap.  The handle is our own fd of the buffer, which
+ * keeps it alive until it is freed; there is no bus address.
+ */
+
+/*
+ * The size from fstat(), or from lseek() on kernels whose dma-bufs report
+ * none.  The offset of the caller's fd is put back; dma-bufs refuse SEEK_CUR
+ * and can only have been at 0 or at their end, so 0 is taken for them.
+ */
+int get_dmabuf_size(const int dmabuf_fd, size_t *sizep)
+{
+    struct stat st;
+    off_t size, pos;
+
+    if (fstat(dmabuf_fd, &st)) {
+        print_error("fstat: %s\n", strerror(errno));
+        return 1;
+    }
+    size = st.st_size;
+    if (size == 0) {
+        pos = lseek(dmabuf_fd, 0, SEEK_CUR);
+        size = lseek(dmabuf_fd, 0, SEEK_END);
+        if (size == (off_t) -1) {
+            print_error("lseek: %s\n", strerror(errno));
+            return 1;
+        }
+        (void) lseek(dmabuf_fd, pos == (off_t) -1 ? 0 : pos, SEEK_SET);
+    }
+    if (size == 0) {
+        print_error("dma-buf is empty\n");
+        return 1;
+    }
+    *sizep = size;
+    return 0;
+}
+
+int open_dma_heap(const char *name)
+{
+    char path[64];
+    int fd;
+
+    (void) snprintf(path, sizeof(path), "/dev/dma_heap/%s", name);
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        print_error("open: %s: %s\n", path, strerror(errno));
+    return fd;
+}
+
+int alloc_mem_dma_heap(const int fd_heap, const size_t size,
+        uint32_t *handlep, void **usraddrp)
+{
+    struct dma_heap_allocation_data data = {
+        .len = size,
+        .fd = 0,
+        .fd_flags = O_RDWR | O_CLOEXEC,
+        .heap_flags = 0,
+    };
+    void *usraddr;
+
+    if (ioctl(fd_heap, DMA_HEAP_IOCTL_ALLOC, &data) == -1) {
+        print_error("DMA_HEAP_IOCTL_ALLOC: %s\n", strerror(errno));
+        return 1;
+    }
+
+    /* The allocation is rounded up to pages; so is the mapping. */
+    usraddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, data.fd,
+            0);
+    if (usraddr == MAP_FAILED) {
+        print_error("Failed to map dma-buf: %s\n", strerror(errno));
+        (void) close(data.fd);
+        return 1;
+    }
+
+    *handlep = data.fd;
+    *usraddrp = usraddr;
+    return 0;
+}
+
+int import_mem_dmabuf(const int dmabuf_fd, const size_t size,
+        uint32_t *handlep, void **usraddrp)
+{
+    void *usraddr;
+    int fd;
+
+    fd = fcntl(dmabuf_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        print_error("fcntl: %s\n", strerror(errno));
+        return 1;
+    }
+
+    usraddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (usraddr == MAP_FAILED) {
+        print_error("Failed to map dma-buf: %s\n", strerror(errno));
+        (void) close(fd);
+        return 1;
+    }
+
+    *handlep = fd;
+    *usraddrp = usraddr;
+    return 0;
+}
+
+int export_mem_dmabuf(const uint32_t handle, int *dmabuf_fdp)
+{
+    const int fd = fcntl(handle, F_DUPFD_CLOEXEC, 0);
+
+    if (fd == -1) {
+        print_error("fcntl: %s\n", strerror(errno));
+        return 1;
+    }
+    *dmabuf_fdp = fd;
+    return 0;
+}
+
+int free_mem_dmabuf(const size_t size, const uint32_t handle, void *usraddr)
+{
+    int err_sum = 0;
+
+    if (munmap(usraddr, size)) {
+        print_error("munmap: %s\n", strerror(errno));
+        err_sum = 1;
+        /* Continue finalization. */
+    }
+    if (close(handle)) {
+        print_error("close: %s\n", strerror(errno));
+        err_sum = 1;
+    }
+    return err_sum;
+}
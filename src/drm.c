@@ -11,13 +11,19 @@
 #include "local.h"
 #include "v3d_drm.h"
 #include <drm.h>
+#include <linux/dma-buf.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
-int alloc_mem_drm(const int fd_drm, const size_t size, uint32_t *handlep,
-        uint32_t *busaddrp, void **usraddrp)
+/*
+ * All DRM ioctls go through dev->ioctl, which is drmIoctl() unless
+ * rpimemmgr_set_drm_device() installed another device.
+ */
+
+int alloc_mem_drm(const struct drm_dev *dev, const size_t size,
+        uint32_t *handlep, uint32_t *busaddrp, void **usraddrp)
 {
     uint32_t handle = 0;
     uint32_t busaddr = 0;
@@ -28,7 +34,7 @@ int alloc_mem_drm(const int fd_drm, const size_t size, uint32_t *handlep,
             .size = size,
             .flags = 0,
         };
-        int res = ioctl(fd_drm, DRM_IOCTL_V3D_CREATE_BO, &create_bo);
+        int res = dev->ioctl(dev->fd, DRM_IOCTL_V3D_CREATE_BO, &create_bo);
         if (res < 0) {
             print_error("Failed to allocate memory with DRM: %s\n", strerror(errno));
             return 1;
@@ -38,20 +44,8 @@ int alloc_mem_drm(const int fd_drm, const size_t size, uint32_t *handlep,
     }
 
     if (usraddrp != NULL) {
-        struct drm_v3d_mmap_bo mmap_bo = {
-            .handle = handle,
-            .flags = 0,
-        };
-        int res = ioctl(fd_drm, DRM_IOCTL_V3D_MMAP_BO, &mmap_bo);
-        if (res < 0) {
-            print_error("Failed to map DRM memory to userland: %s\n", strerror(errno));
-            goto clean_alloc;
-        }
-        usraddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_drm, mmap_bo.offset);
-        if (usraddr == MAP_FAILED) {
-            print_error("Failed to map DRM memory to userland: %s\n", strerror(errno));
+        if (map_mem_drm(dev, size, handle, &usraddr))
             goto clean_alloc;
-        }
         *usraddrp = usraddr;
     }
 
@@ -60,11 +54,46 @@ int alloc_mem_drm(const int fd_drm, const size_t size, uint32_t *handlep,
     return 0;
 
 clean_alloc:
-    free_mem_drm(fd_drm, size, handle, usraddr);
+    free_mem_drm(dev, size, handle, usraddr);
     return 1;
 }
 
-int free_mem_drm(const int fd_drm, const size_t size, const uint32_t handle, void *usraddr)
+int map_mem_drm(const struct drm_dev *dev, const size_t size,
+        const uint32_t handle, void **usraddrp)
+{
+    struct drm_v3d_mmap_bo mmap_bo = {
+        .handle = handle,
+        .flags = 0,
+    };
+    void *usraddr;
+    int res;
+
+    res = dev->ioctl(dev->fd, DRM_IOCTL_V3D_MMAP_BO, &mmap_bo);
+    if (res < 0) {
+        print_error("Failed to map DRM memory to userland: %s\n", strerror(errno));
+        return 1;
+    }
+    usraddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd,
+            mmap_bo.offset);
+    if (usraddr == MAP_FAILED) {
+        print_error("Failed to map DRM memory to userland: %s\n", strerror(errno));
+        return 1;
+    }
+    *usraddrp = usraddr;
+    return 0;
+}
+
+int unmap_mem_drm(const size_t size, void *usraddr)
+{
+    if (munmap(usraddr, size)) {
+        print_error("munmap: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int free_mem_drm(const struct drm_dev *dev, const size_t size,
+        const uint32_t handle, void *usraddr)
 {
     int err, err_sum = 0;
 
@@ -80,7 +109,7 @@ int free_mem_drm(const int fd_drm, const size_t size, const uint32_t handle, voi
     struct drm_gem_close gem_close = {
         .handle = handle,
     };
-    err = ioctl(fd_drm, DRM_IOCTL_GEM_CLOSE, &gem_close);
+    err = dev->ioctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
     if (err < 0) {
         print_error("Failed to free memory with DRM\n");
         err_sum = errno;
@@ -88,3 +117,104 @@ int free_mem_drm(const int fd_drm, const size_t size, const uint32_t handle, voi
 
     return err_sum;
 }
+
+/*
+ * Waits up to timeout_ns for the GPU to finish with a BO; with 0 this only
+ * polls.  Running out of time is not an error; *is_idlep tells.
+ */
+int wait_mem_drm(const struct drm_dev *dev, const uint32_t handle,
+        const uint64_t timeout_ns, bool *is_idlep)
+{
+    struct drm_v3d_wait_bo wait_bo = {
+        .handle = handle,
+        .timeout_ns = timeout_ns,
+    };
+
+    if (dev->ioctl(dev->fd, DRM_IOCTL_V3D_WAIT_BO, &wait_bo)) {
+        if (errno == ETIME || errno == EBUSY) {
+            *is_idlep = false;
+            return 0;
+        }
+        print_error("DRM_IOCTL_V3D_WAIT_BO: %s\n", strerror(errno));
+        return 1;
+    }
+    *is_idlep = true;
+    return 0;
+}
+
+int export_mem_drm(const struct drm_dev *dev, const uint32_t handle,
+        int *dmabuf_fdp)
+{
+    struct drm_prime_handle prime = {
+        .handle = handle,
+        .flags = DRM_CLOEXEC | DRM_RDWR,
+        .fd = -1,
+    };
+
+    if (dev->ioctl(dev->fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime)) {
+        print_error("Failed to export DRM memory: %s\n", strerror(errno));
+        return 1;
+    }
+    *dmabuf_fdp = prime.fd;
+    return 0;
+}
+
+/* Imports a dma-buf as a BO; busaddr is its address in the V3D MMU. */
+int import_mem_drm(const struct drm_dev *dev, const int dmabuf_fd,
+        uint32_t *handlep, uint32_t *busaddrp)
+{
+    struct drm_prime_handle prime = {
+        .handle = 0,
+        .flags = 0,
+        .fd = dmabuf_fd,
+    };
+    struct drm_v3d_get_bo_offset get_bo_offset;
+    struct drm_gem_close gem_close;
+
+    if (dev->ioctl(dev->fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &prime)) {
+        print_error("Failed to import dma-buf to DRM: %s\n", strerror(errno));
+        return 1;
+    }
+
+    get_bo_offset.handle = prime.handle;
+    get_bo_offset.offset = 0;
+    if (dev->ioctl(dev->fd, DRM_IOCTL_V3D_GET_BO_OFFSET, &get_bo_offset)) {
+        print_error("DRM_IOCTL_V3D_GET_BO_OFFSET: %s\n", strerror(errno));
+        gem_close.handle = prime.handle;
+        (void) dev->ioctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+        return 1;
+    }
+
+    *handlep = prime.handle;
+    *busaddrp = get_bo_offset.offset;
+    return 0;
+}
+
+/*
+ * The dma-buf sync interface brackets CPU access: a clean ends a CPU write
+ * and an invalidate starts a CPU read.  It always covers the whole buffer.
+ */
+int sync_mem_dmabuf(const int dmabuf_fd, const enum rpimemmgr_cache_op op)
+{
+    struct dma_buf_sync sync;
+
+    switch (op) {
+        case RPIMEMMGR_CACHE_OP_INVALIDATE:
+            sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+            break;
+        case RPIMEMMGR_CACHE_OP_CLEAN:
+            sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+            break;
+        default:
+            print_error("Invalid op: %d\n", op);
+            return 1;
+    }
+
+    while (ioctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) == -1) {
+        if (errno == EINTR || errno == EAGAIN)
+            continue;
+        print_error("Failed to sync dma-buf: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
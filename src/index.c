@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+/*
+ * Allocation index: a sorted array of non-overlapping [key, key + size)
+ * intervals, split into leaves of at most INDEX_LEAF_MAX entries so that an
+ * insertion only moves one leaf's worth of entries.  The first key of every
+ * leaf is kept in a separate contiguous array, so a lookup is two binary
+ * searches over contiguous memory with a single pointer dereference in
+ * between.  Leaves are split when full and dropped when empty.
+ */
+
+/* Returns the number of elements in keys[0, n) that are <= key. */
+static unsigned upper_bound_keys(const uintptr_t *keys, unsigned n,
+        const uintptr_t key)
+{
+    unsigned lo = 0;
+
+    while (n > 0) {
+        const unsigned half = n / 2;
+        if (keys[lo + half] <= key) {
+            lo += half + 1;
+            n -= half + 1;
+        } else
+            n = half;
+    }
+    return lo;
+}
+
+static unsigned upper_bound_leaf(const struct index_leaf *leaf,
+        const uintptr_t key)
+{
+    unsigned lo = 0, n = leaf->n;
+
+    while (n > 0) {
+        const unsigned half = n / 2;
+        if (leaf->e[lo + half].key <= key) {
+            lo += half + 1;
+            n -= half + 1;
+        } else
+            n = half;
+    }
+    return lo;
+}
+
+/* The leaf that key belongs to, or -1 if the index is empty. */
+static int find_leaf(const struct index *idx, const uintptr_t key)
+{
+    const unsigned i = upper_bound_keys(idx->first_keys, idx->n_leaves, key);
+
+    if (idx->n_leaves == 0)
+        return -1;
+    return i == 0 ? 0 : (int) i - 1;
+}
+
+static int insert_leaf(struct index *idx, const unsigned pos,
+        struct index_leaf *leaf)
+{
+    if (idx->n_leaves == idx->cap_leaves) {
+        const unsigned cap = idx->cap_leaves == 0 ? 4 : idx->cap_leaves * 2;
+        uintptr_t *first_keys;
+        struct index_leaf **leaves;
+
+        first_keys = realloc(idx->first_keys, sizeof(*first_keys) * cap);
+        if (first_keys == NULL) {
+            print_error("realloc: %s\n", strerror(errno));
+            return 1;
+        }
+        idx->first_keys = first_keys;
+
+        leaves = realloc(idx->leaves, sizeof(*leaves) * cap);
+        if (leaves == NULL) {
+            print_error("realloc: %s\n", strerror(errno));
+            return 1;
+        }
+        idx->leaves = leaves;
+        idx->cap_leaves = cap;
+    }
+
+    memmove(&idx->first_keys[pos + 1], &idx->first_keys[pos],
+            sizeof(idx->first_keys[0]) * (idx->n_leaves - pos));
+    memmove(&idx->leaves[pos + 1], &idx->leaves[pos],
+            sizeof(idx->leaves[0]) * (idx->n_leaves - pos));
+    idx->first_keys[pos] = leaf->e[0].key;
+    idx->leaves[pos] = leaf;
+    idx->n_leaves ++;
+    return 0;
+}
+
+static void remove_leaf(struct index *idx, const unsigned pos)
+{
+    free(idx->leaves[pos]);
+    idx->n_leaves --;
+    memmove(&idx->first_keys[pos], &idx->first_keys[pos + 1],
+            sizeof(idx->first_keys[0]) * (idx->n_leaves - pos));
+    memmove(&idx->leaves[pos], &idx->leaves[pos + 1],
+            sizeof(idx->leaves[0]) * (idx->n_leaves - pos));
+}
+
+void index_init(struct index *idx)
+{
+    idx->n_leaves = idx->cap_leaves = 0;
+    idx->first_keys = NULL;
+    idx->leaves = NULL;
+}
+
+void index_destroy(struct index *idx)
+{
+    unsigned i;
+
+    for (i = 0; i < idx->n_leaves; i ++)
+        free(idx->leaves[i]);
+    free(idx->first_keys);
+    free(idx->leaves);
+    index_init(idx);
+}
+
+int index_insert(struct index *idx, const uintptr_t key, const size_t size,
+        void * const value)
+{
+    struct index_leaf *leaf;
+    unsigned pos;
+    int li;
+
+    li = find_leaf(idx, key);
+    if (li < 0) {
+        leaf = malloc(sizeof(*leaf));
+        if (leaf == NULL) {
+            print_error("malloc: %s\n", strerror(errno));
+            return 1;
+        }
+        leaf->n = 1;
+        leaf->e[0].key = key;
+        leaf->e[0].size = size;
+        leaf->e[0].value = value;
+        if (insert_leaf(idx, 0, leaf)) {
+            free(leaf);
+            return 1;
+        }
+        return 0;
+    }
+
+    leaf = idx->leaves[li];
+    pos = upper_bound_leaf(leaf, key);
+    if ((pos > 0 && (leaf->e[pos - 1].key == key
+                    || key - leaf->e[pos - 1].key < leaf->e[pos - 1].size))
+            || (pos < leaf->n && leaf->e[pos].key - key < size)
+            || (pos == leaf->n && (unsigned) li + 1 < idx->n_leaves
+                    && idx->first_keys[li + 1] - key < size)) {
+        print_error("Overlapping key: 0x%08" PRIxPTR "\n", key);
+        return 1;
+    }
+
+    if (leaf->n == INDEX_LEAF_MAX) {
+        struct index_leaf *right;
+        const unsigned half = INDEX_LEAF_MAX / 2;
+
+        right = malloc(sizeof(*right));
+        if (right == NULL) {
+            print_error("malloc: %s\n", strerror(errno));
+            return 1;
+        }
+        right->n = INDEX_LEAF_MAX - half;
+        memcpy(right->e, &leaf->e[half], sizeof(leaf->e[0]) * right->n);
+        if (insert_leaf(idx, li + 1, right)) {
+            free(right);
+            return 1;
+        }
+        leaf->n = half;
+
+        if (pos > half) {
+            leaf = right;
+            pos -= half;
+            li ++;
+        }
+    }
+
+    memmove(&leaf->e[pos + 1], &leaf->e[pos],
+            sizeof(leaf->e[0]) * (leaf->n - pos));
+    leaf->e[pos].key = key;
+    leaf->e[pos].size = size;
+    leaf->e[pos].value = value;
+    leaf->n ++;
+    if (pos == 0)
+        idx->first_keys[li] = key;
+    return 0;
+}
+
+void* index_remove(struct index *idx, const uintptr_t key)
+{
+    struct index_leaf *leaf;
+    unsigned pos;
+    void *value;
+    int li;
+
+    li = find_leaf(idx, key);
+    if (li < 0)
+        return NULL;
+    leaf = idx->leaves[li];
+    pos = upper_bound_leaf(leaf, key);
+    if (pos == 0 || leaf->e[pos - 1].key != key)
+        return NULL;
+    pos --;
+
+    value = leaf->e[pos].value;
+    leaf->n --;
+    if (leaf->n == 0) {
+        remove_leaf(idx, li);
+        return value;
+    }
+    memmove(&leaf->e[pos], &leaf->e[pos + 1],
+            sizeof(leaf->e[0]) * (leaf->n - pos));
+    if (pos == 0)
+        idx->first_keys[li] = leaf->e[0].key;
+    return value;
+}
+
+const struct index_entry* index_find_range(const struct index *idx,
+        const uintptr_t addr)
+{
+    const struct index_leaf *leaf;
+    const struct index_entry *ep;
+    unsigned i;
+
+    i = upper_bound_keys(idx->first_keys, idx->n_leaves, addr);
+    if (i == 0)
+        return NULL;
+    leaf = idx->leaves[i - 1];
+    i = upper_bound_leaf(leaf, addr);
+    if (i == 0)
+        return NULL;
+    ep = &leaf->e[i - 1];
+    if (addr - ep->key >= ep->size)
+        return NULL;
+    return ep;
+}
+
+void* index_find(const struct index *idx, const uintptr_t key)
+{
+    const struct index_leaf *leaf;
+    unsigned i;
+
+    i = upper_bound_keys(idx->first_keys, idx->n_leaves, key);
+    if (i == 0)
+        return NULL;
+    leaf = idx->leaves[i - 1];
+    i = upper_bound_leaf(leaf, key);
+    if (i == 0 || leaf->e[i - 1].key != key)
+        return NULL;
+    return leaf->e[i - 1].value;
+}
+
+void* index_any(const struct index *idx)
+{
+    if (idx->n_leaves == 0)
+        return NULL;
+    return idx->leaves[0]->e[0].value;
+}
@@ -13,6 +13,8 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 
 /*
@@ -58,14 +60,17 @@
 
 #define MEM_FLAG_MASK MEM_FLAG_L1_NONALLOCATING
 
-int get_processor_by_fd(const int fd_mb) {
+#define MEM_FLAG_INDEX(flags) (((flags) & MEM_FLAG_MASK) >> 2)
+
+int get_caps_by_fd(const int fd_mb, struct rpimemmgr_caps *capsp) {
     uint32_t board_revision;
-    int err;
+    int err, processor;
+    unsigned i;
 
     err = mailbox_get_board_revision(fd_mb, &board_revision);
     if (err) {
         print_error("Failed to get board revision\n");
-        return -1;
+        return 1;
     }
 
     /*
@@ -76,14 +81,74 @@ int get_processor_by_fd(const int fd_mb) {
 
     if (board_revision >> 23 & 1) {
         /* Dedicated bit fields in the new-style code. */
-        return board_revision >> 12 & 0xf;
+        processor = board_revision >> 12 & 0xf;
+    } else {
+        /* Only BCM2835 boards use the old-style code. */
+        processor = 0;
+    }
+
+    capsp->board_revision = board_revision;
+    capsp->processor = processor;
+    for (i = 0; i < 4; i ++) {
+        capsp->mailbox_mappable[i] = false;
+        capsp->mailbox_map_offset[i] = 0;
+    }
+    if (processor == 0) { /* BCM2835 */
+        capsp->mailbox_mappable[MEM_FLAG_INDEX(MEM_FLAG_DIRECT)] = true;
+        capsp->mailbox_map_offset[MEM_FLAG_INDEX(MEM_FLAG_DIRECT)] =
+                0x20000000;
+        capsp->mailbox_mappable[MEM_FLAG_INDEX(MEM_FLAG_L1_NONALLOCATING)] =
+                true;
+    } else /* BCM2836, BCM2837, BCM2711 */
+        capsp->mailbox_mappable[MEM_FLAG_INDEX(MEM_FLAG_DIRECT)] = true;
+    return 0;
+}
+
+static int get_map_offset(const struct rpimemmgr_caps *caps,
+        const uint32_t flags, uint32_t *map_offsetp)
+{
+    if (!caps->mailbox_mappable[MEM_FLAG_INDEX(flags)]) {
+        if (caps->processor == 0)
+            print_error("flags must be one of these on BCM2835: " \
+                    "DIRECT, L1_NONALLOCATING\n");
+        else
+            print_error("flags must be DIRECT on " \
+                    "BCM2836, BCM2837, and BCM2711\n");
+        return 1;
     }
 
-    /* Only BCM2835 boards use the old-style code. */
+    *map_offsetp = caps->mailbox_map_offset[MEM_FLAG_INDEX(flags)];
     return 0;
 }
 
-int alloc_mem_mailbox(const int fd_mb, const int fd_mem, const size_t size,
+static int map_mem(const int fd_mem, const struct rpimemmgr_caps *caps,
+        const size_t size, const uint32_t busaddr, const uint32_t flags,
+        void **usraddrp)
+{
+    const uint32_t phys = BUS_TO_PHYS(busaddr
+            + caps->mailbox_map_offset[MEM_FLAG_INDEX(flags)]);
+    void *usraddr;
+
+    if (caps->processor == 0 && (busaddr & 0x20000000)) {
+        print_error("The third significant bit is set to busaddr " \
+                "on BCM2835: 0x%08x\n", busaddr);
+        return 1;
+    }
+
+    usraddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_mem,
+            phys);
+    if (usraddr == MAP_FAILED) {
+        print_error("Failed to map Mailbox memory to userland: %s\n",
+                strerror(errno));
+        return 1;
+    }
+
+    *usraddrp = usraddr;
+    return 0;
+}
+
+int alloc_mem_mailbox(const int fd_mb, const int fd_mem,
+        const struct rpimemmgr_caps *caps, const size_t size,
         const size_t align, const uint32_t flags, uint32_t *handlep,
         uint32_t *busaddrp, void **usraddrp)
 {
@@ -97,36 +162,9 @@ int alloc_mem_mailbox(const int fd_mb, const int fd_mem, const size_t size,
         return 1;
     }
 
-    const int processor = get_processor_by_fd(fd_mb);
-    if (processor < -1)
+    if (do_mapping && get_map_offset(caps, flags, &map_offset))
         return 1;
 
-    if (do_mapping) {
-        if (processor == 0) { /* BCM2835 */
-            switch (flags & MEM_FLAG_MASK) {
-                case MEM_FLAG_DIRECT:
-                    map_offset = 0x20000000;
-                    break;
-                case MEM_FLAG_L1_NONALLOCATING:
-                    map_offset = 0x00000000;
-                    break;
-                case MEM_FLAG_NORMAL:
-                case MEM_FLAG_COHERENT:
-                default:
-                    print_error("flags must be one of these on BCM2835: " \
-                            "DIRECT, L1_NONALLOCATING\n");
-                    return 1;
-            }
-        } else { /* BCM2836, BCM2837, BCM2711 */
-            if ((flags & MEM_FLAG_MASK) != MEM_FLAG_DIRECT) {
-                print_error("flags must be DIRECT on " \
-                        "BCM2836, BCM2837, and BCM2711\n");
-                return 1;
-            }
-            map_offset = 0x00000000;
-        }
-    }
-
     handle = mailbox_mem_alloc(fd_mb, size, align, flags);
     if (!handle) {
         print_error("Failed to allocate memory with Mailbox\n");
@@ -139,21 +177,8 @@ int alloc_mem_mailbox(const int fd_mb, const int fd_mem, const size_t size,
         goto clean_alloc;
     }
 
-    if (do_mapping) {
-        if (processor == 0 && (busaddr & 0x20000000)) {
-            print_error("The third significant bit is set to busaddr " \
-                    "on BCM2835: 0x%08x\n", busaddr);
-            goto clean_lock;
-        }
-
-        usraddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_mem,
-                BUS_TO_PHYS(busaddr + map_offset));
-        if (usraddr == MAP_FAILED) {
-            print_error("Failed to map Mailbox memory to userland: %s\n",
-                    strerror(errno));
-            goto clean_lock;
-        }
-    }
+    if (do_mapping && map_mem(fd_mem, caps, size, busaddr, flags, &usraddr))
+        goto clean_lock;
 
     *handlep = handle;
     *busaddrp = busaddr;
@@ -168,8 +193,150 @@ clean_alloc:
     return 1;
 }
 
-int free_mem_mailbox(const int fd_mb, const size_t size, const uint32_t handle,
-        const uint32_t busaddr, void *usraddr)
+/*
+ * The property interface of the firmware takes a buffer of any number of
+ * tags, so a batch is allocated with one message of ALLOCATE_MEMORY tags and
+ * one of LOCK_MEMORY tags per MAILBOX_BATCH_MAX requests instead of two round
+ * trips per request.  libmailbox only sends single-tag messages, so the
+ * messages are built here and sent with the ioctl of the vcio driver.
+ */
+
+#define MAILBOX_IOCTL_PROPERTY _IOWR(100, 0, char*)
+#define MAILBOX_TAG_ALLOCATE_MEMORY 0x0003000c
+#define MAILBOX_TAG_LOCK_MEMORY     0x0003000d
+#define MAILBOX_CODE_SUCCESS 0x80000000u
+
+/*
+ * Sends a message of n tags of the same kind, each carrying n_values words
+ * of request and one word of response, and stores the responses to
+ * results[], or 0 for the tags that failed.
+ */
+static int send_tags(const int fd_mb, const uint32_t tag, const unsigned n,
+        const unsigned n_values, const uint32_t *values, uint32_t *results)
+{
+    uint32_t buf[2 + MAILBOX_BATCH_MAX * (3 + 3) + 1]
+            __attribute__((aligned(16)));
+    unsigned i, j, k = 2;
+
+    for (i = 0; i < n; i ++) {
+        buf[k ++] = tag;
+        buf[k ++] = n_values * sizeof(buf[0]);
+        buf[k ++] = 0;
+        for (j = 0; j < n_values; j ++)
+            buf[k ++] = values[i * n_values + j];
+    }
+    buf[k ++] = 0;
+    buf[0] = k * sizeof(buf[0]);
+    buf[1] = 0;
+
+    if (ioctl(fd_mb, MAILBOX_IOCTL_PROPERTY, buf) == -1) {
+        print_error("ioctl: MAILBOX_IOCTL_PROPERTY: %s\n", strerror(errno));
+        return 1;
+    }
+    if (buf[1] != MAILBOX_CODE_SUCCESS) {
+        print_error("Mailbox request failed: 0x%08" PRIx32 "\n", buf[1]);
+        return 1;
+    }
+
+    for (i = 0, k = 2; i < n; i ++, k += 3 + n_values)
+        results[i] = (buf[k + 2] & MAILBOX_CODE_SUCCESS) ? buf[k + 3] : 0;
+    return 0;
+}
+
+/* Releases what alloc_mem_mailbox_batch() has set up for one request. */
+static void release_req(const int fd_mb, struct mem_req *req)
+{
+    if (req->usraddr != NULL)
+        (void) munmap(req->usraddr, req->size);
+    if (req->busaddr != 0)
+        (void) mailbox_mem_unlock(fd_mb, req->busaddr);
+    if (req->handle != 0)
+        (void) mailbox_mem_free(fd_mb, req->handle);
+    req->handle = req->busaddr = 0;
+    req->usraddr = NULL;
+}
+
+int alloc_mem_mailbox_batch(const int fd_mb, const int fd_mem,
+        const struct rpimemmgr_caps *caps, const size_t n,
+        struct mem_req *reqs, const bool do_mapping)
+{
+    uint32_t values[MAILBOX_BATCH_MAX * 3], results[MAILBOX_BATCH_MAX];
+    struct mem_req *batch[MAILBOX_BATCH_MAX];
+    unsigned n_batch, j;
+    size_t i, next = 0;
+
+    for (i = 0; i < n; i ++) {
+        uint32_t map_offset;
+        if (!reqs[i].is_done && do_mapping
+                && get_map_offset(caps, reqs[i].flags, &map_offset))
+            return 1;
+    }
+
+    while (next < n) {
+        for (n_batch = 0; next < n && n_batch < MAILBOX_BATCH_MAX; next ++) {
+            struct mem_req * const req = &reqs[next];
+            if (req->is_done)
+                continue;
+            if (req->size > UINT32_MAX || req->align > UINT32_MAX) {
+                print_error("Too large size or align: %zu, %zu\n",
+                        req->size, req->align);
+                goto clean;
+            }
+            values[n_batch * 3 + 0] = req->size;
+            values[n_batch * 3 + 1] = req->align;
+            values[n_batch * 3 + 2] = req->flags;
+            batch[n_batch ++] = req;
+        }
+        if (n_batch == 0)
+            break;
+
+        if (send_tags(fd_mb, MAILBOX_TAG_ALLOCATE_MEMORY, n_batch, 3, values,
+                    results))
+            goto clean;
+        for (j = 0; j < n_batch; j ++)
+            batch[j]->handle = results[j];
+        for (j = 0; j < n_batch; j ++) {
+            if (batch[j]->handle == 0) {
+                print_error("Failed to allocate memory with Mailbox\n");
+                goto clean;
+            }
+            values[j] = batch[j]->handle;
+        }
+
+        if (send_tags(fd_mb, MAILBOX_TAG_LOCK_MEMORY, n_batch, 1, values,
+                    results))
+            goto clean;
+        for (j = 0; j < n_batch; j ++)
+            batch[j]->busaddr = results[j];
+        for (j = 0; j < n_batch; j ++) {
+            if (batch[j]->busaddr == 0) {
+                print_error("Failed to lock memory with Mailbox\n");
+                goto clean;
+            }
+        }
+    }
+
+    for (i = 0; do_mapping && i < n; i ++) {
+        if (reqs[i].is_done)
+            continue;
+        if (map_mem(fd_mem, caps, reqs[i].size, reqs[i].busaddr,
+                    reqs[i].flags, &reqs[i].usraddr))
+            goto clean;
+    }
+
+    for (i = 0; i < n; i ++)
+        reqs[i].is_done = true;
+    return 0;
+
+clean:
+    for (i = 0; i < n; i ++)
+        if (!reqs[i].is_done)
+            release_req(fd_mb, &reqs[i]);
+    return 1;
+}
+
+int free_mem_mailbox(const int fd_mb, const size_t size,
+        const uint32_t handle, const uint32_t busaddr, void *usraddr)
 {
     int err, err_sum = 0;
 
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Slab bookkeeping for pool mode.  Each chunk is a single backend allocation
+ * dedicated to one power-of-two size class and is cut into equally sized
+ * blocks.  Chunks that still have free blocks are kept on the avail list of
+ * their class, and the others on the full list.  Free block indices are kept
+ * out of band (the chunk memory may be uncached or not even mapped), and
+ * never-used blocks are handed out by bumping n_bumped so that adding a chunk
+ * costs O(1).
+ *
+ * This file does not talk to any backend: the caller allocates chunks with
+ * pool_add_chunk() when pool_get() runs dry and frees the backend memory when
+ * pool_put() says the chunk is surplus.
+ */
+
+static void list_remove(struct pool_chunk **headp, struct pool_chunk *chunk)
+{
+    if (chunk->prev != NULL)
+        chunk->prev->next = chunk->next;
+    else
+        *headp = chunk->next;
+    if (chunk->next != NULL)
+        chunk->next->prev = chunk->prev;
+    chunk->prev = chunk->next = NULL;
+}
+
+static void list_push(struct pool_chunk **headp, struct pool_chunk *chunk)
+{
+    chunk->prev = NULL;
+    chunk->next = *headp;
+    if (*headp != NULL)
+        (*headp)->prev = chunk;
+    *headp = chunk;
+}
+
+struct pool* pool_create(const unsigned type, const uint32_t flags,
+        const size_t chunk_size, const size_t max_size)
+{
+    struct pool *pool;
+    size_t block_size;
+    unsigned i, n_classes = 0;
+
+    for (block_size = POOL_MIN_BLOCK_SIZE;
+            block_size <= max_size && block_size <= chunk_size;
+            block_size <<= 1)
+        n_classes ++;
+    if (n_classes == 0) {
+        print_error("max_size %zu is smaller than the minimum block size\n",
+                max_size);
+        return NULL;
+    }
+
+    pool = malloc(sizeof(*pool) + sizeof(pool->classes[0]) * n_classes);
+    if (pool == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    pool->type = type;
+    pool->flags = flags;
+    pool->chunk_size = chunk_size;
+    pool->n_classes = n_classes;
+    pool->next = NULL;
+    for (i = 0; i < n_classes; i ++) {
+        pool->classes[i].pool = pool;
+        pool->classes[i].block_size = (size_t) POOL_MIN_BLOCK_SIZE << i;
+        pool->classes[i].n_chunks = 0;
+        pool->classes[i].avail = NULL;
+        pool->classes[i].full = NULL;
+    }
+    return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+    free(pool);
+}
+
+int pool_class_of(const struct pool *pool, const size_t size, size_t align)
+{
+    size_t block_size = POOL_MIN_BLOCK_SIZE;
+    unsigned i = 0;
+
+    if (size == 0 || align > POOL_CHUNK_ALIGN)
+        return -1;
+    if (align == 0)
+        align = 1;
+
+    while (block_size < size || block_size < align) {
+        block_size <<= 1;
+        if (++ i >= pool->n_classes)
+            return -1;
+    }
+    return i;
+}
+
+int pool_get(struct pool *pool, const int cls, struct pool_chunk **chunkp,
+        size_t *offsetp)
+{
+    struct pool_class * const class = &pool->classes[cls];
+    struct pool_chunk * const chunk = class->avail;
+    uint32_t block;
+
+    if (chunk == NULL)
+        return 1;
+
+    if (chunk->n_free > 0)
+        block = chunk->free_stack[-- chunk->n_free];
+    else
+        block = chunk->n_bumped ++;
+    chunk->n_used ++;
+
+    if (chunk->n_free == 0 && chunk->n_bumped == chunk->n_blocks) {
+        list_remove(&class->avail, chunk);
+        list_push(&class->full, chunk);
+    }
+
+    *chunkp = chunk;
+    *offsetp = (size_t) block * class->block_size;
+    return 0;
+}
+
+struct pool_chunk* pool_add_chunk(struct pool *pool, const int cls,
+        const uint32_t handle, const uint32_t busaddr, void * const usraddr)
+{
+    struct pool_class * const class = &pool->classes[cls];
+    const unsigned n_blocks = pool->chunk_size / class->block_size;
+    struct pool_chunk *chunk;
+
+    chunk = malloc(sizeof(*chunk) + sizeof(chunk->free_stack[0]) * n_blocks);
+    if (chunk == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    chunk->class = class;
+    chunk->handle = handle;
+    chunk->busaddr = busaddr;
+    chunk->usraddr = usraddr;
+    chunk->n_blocks = n_blocks;
+    chunk->n_used = 0;
+    chunk->n_bumped = 0;
+    chunk->n_free = 0;
+    list_push(&class->avail, chunk);
+    class->n_chunks ++;
+    return chunk;
+}
+
+bool pool_put(struct pool_chunk *chunk, const size_t offset)
+{
+    struct pool_class * const class = chunk->class;
+
+    if (chunk->n_free == 0 && chunk->n_bumped == chunk->n_blocks) {
+        list_remove(&class->full, chunk);
+        list_push(&class->avail, chunk);
+    }
+
+    chunk->free_stack[chunk->n_free ++] = offset / class->block_size;
+    chunk->n_used --;
+
+    /* Keep the last chunk of a class around to avoid alloc/free thrashing. */
+    return chunk->n_used == 0 && class->n_chunks > 1;
+}
+
+void pool_remove_chunk(struct pool_chunk *chunk)
+{
+    struct pool_class * const class = chunk->class;
+
+    if (chunk->n_free == 0 && chunk->n_bumped == chunk->n_blocks)
+        list_remove(&class->full, chunk);
+    else
+        list_remove(&class->avail, chunk);
+    class->n_chunks --;
+    free(chunk);
+}
+
+struct pool_chunk* pool_any_chunk(const struct pool *pool)
+{
+    unsigned i;
+
+    for (i = 0; i < pool->n_classes; i ++) {
+        if (pool->classes[i].avail != NULL)
+            return pool->classes[i].avail;
+        if (pool->classes[i].full != NULL)
+            return pool->classes[i].full;
+    }
+    return NULL;
+}
+
+static uint64_t used_bytes(const struct pool_chunk *chunk,
+        const size_t block_size)
+{
+    uint64_t n = 0;
+
+    for (; chunk != NULL; chunk = chunk->next)
+        n += chunk->n_used;
+    return n * block_size;
+}
+
+void pool_usage(const struct pool *pool, uint64_t *bytesp,
+        uint64_t *used_bytesp)
+{
+    unsigned i;
+
+    for (i = 0; i < pool->n_classes; i ++) {
+        const struct pool_class * const class = &pool->classes[i];
+        *bytesp += (uint64_t) class->n_chunks * pool->chunk_size;
+        *used_bytesp += used_bytes(class->avail, class->block_size)
+                + used_bytes(class->full, class->block_size);
+    }
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * Bookkeeping for the recycle cache.  Released blocks stay allocated, locked
+ * and mapped, and are kept both in a hash table keyed by backend, flags and
+ * rounded size (newest first, so that hot blocks are reused) and in a global
+ * list ordered by release time (oldest first, for eviction).  Like pool.c,
+ * this file never talks to a backend: evicted entries are handed back to the
+ * caller to free.
+ */
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static unsigned hash_key(const unsigned type, const uint32_t flags,
+        const size_t size)
+{
+    const uint32_t h = (type * 0x9e3779b1u) ^ (flags * 0x85ebca6bu)
+            ^ (uint32_t) (size >> 12) * 0xc2b2ae35u;
+    return (h >> 16 ^ h) % RECYCLE_HASH_SIZE;
+}
+
+void recycle_init(struct recycle *rc)
+{
+    rc->max_bytes = 0;
+    rc->max_age_ns = 0;
+    rc->n_bytes = 0;
+    rc->oldest = rc->newest = NULL;
+    memset(rc->table, 0, sizeof(rc->table));
+}
+
+/*
+ * Round up to a page for small sizes and to a quarter of the power of two
+ * otherwise, so that at most 25% is wasted while sizes that are close together
+ * share a bucket.
+ */
+size_t recycle_round_size(const size_t size)
+{
+    size_t granule = RECYCLE_PAGE_SIZE;
+
+    if (size > RECYCLE_PAGE_SIZE * 16) {
+        unsigned shift = 0;
+        while ((size - 1) >> shift > 1)
+            shift ++;
+        granule = (size_t) 1 << (shift - 2);
+    }
+    return (size + granule - 1) & ~(granule - 1);
+}
+
+int recycle_put(struct recycle *rc, const unsigned type, const uint32_t flags,
+        const size_t size, const uint32_t handle, const uint32_t busaddr,
+        void * const usraddr)
+{
+    struct recycle_entry ** const headp =
+            &rc->table[hash_key(type, flags, size)];
+    struct recycle_entry *ep;
+
+    if (size > rc->max_bytes)
+        return 1;
+
+    ep = malloc(sizeof(*ep));
+    if (ep == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return 1;
+    }
+
+    ep->type = type;
+    ep->flags = flags;
+    ep->size = size;
+    ep->handle = handle;
+    ep->busaddr = busaddr;
+    ep->usraddr = usraddr;
+    ep->time_ns = get_time_ns();
+
+    ep->hprev = NULL;
+    ep->hnext = *headp;
+    if (*headp != NULL)
+        (*headp)->hprev = ep;
+    *headp = ep;
+
+    ep->lnext = NULL;
+    ep->lprev = rc->newest;
+    if (rc->newest != NULL)
+        rc->newest->lnext = ep;
+    else
+        rc->oldest = ep;
+    rc->newest = ep;
+
+    rc->n_bytes += size;
+    return 0;
+}
+
+static void remove_entry(struct recycle *rc, struct recycle_entry *ep)
+{
+    if (ep->hprev != NULL)
+        ep->hprev->hnext = ep->hnext;
+    else
+        rc->table[hash_key(ep->type, ep->flags, ep->size)] = ep->hnext;
+    if (ep->hnext != NULL)
+        ep->hnext->hprev = ep->hprev;
+
+    if (ep->lprev != NULL)
+        ep->lprev->lnext = ep->lnext;
+    else
+        rc->oldest = ep->lnext;
+    if (ep->lnext != NULL)
+        ep->lnext->lprev = ep->lprev;
+    else
+        rc->newest = ep->lprev;
+
+    rc->n_bytes -= ep->size;
+}
+
+bool recycle_get(struct recycle *rc, const unsigned type, const uint32_t flags,
+        const bool mapped, const size_t size, const size_t align,
+        uint32_t *handlep, uint32_t *busaddrp, void **usraddrp)
+{
+    struct recycle_entry *ep;
+
+    for (ep = rc->table[hash_key(type, flags, size)]; ep != NULL;
+            ep = ep->hnext) {
+        if (ep->type != type || ep->flags != flags || ep->size != size
+                || (ep->usraddr != NULL) != mapped)
+            continue;
+        if (align > 1 && (ep->busaddr & (align - 1)) != 0)
+            continue;
+
+        remove_entry(rc, ep);
+        *handlep = ep->handle;
+        *busaddrp = ep->busaddr;
+        *usraddrp = ep->usraddr;
+        free(ep);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Returns the oldest entry if it is older than the age limit or if the cache
+ * holds more than max_bytes, after unlinking it.  The caller frees the backend
+ * memory and then the entry itself.
+ */
+struct recycle_entry* recycle_pop_victim(struct recycle *rc,
+        const size_t max_bytes)
+{
+    struct recycle_entry * const ep = rc->oldest;
+
+    if (ep == NULL)
+        return NULL;
+    if (rc->n_bytes <= max_bytes && (rc->max_age_ns == 0
+                || get_time_ns() - ep->time_ns < rc->max_age_ns))
+        return NULL;
+
+    remove_entry(rc, ep);
+    return ep;
+}
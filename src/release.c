@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/*
+ * One thread that runs queued jobs in batches: it takes the whole queue at
+ * once, runs it without the lock, and then counts the batch as done.  While
+ * the idle callback reports more work to poll for, the thread wakes up every
+ * RELEASE_POLL_NS even if nothing is submitted.
+ */
+
+#define RELEASE_POLL_NS 1000000
+
+struct release_queue {
+    release_run_fn run;
+    release_idle_fn idle;
+    void *arg;
+    int eventfd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* Signalled on submission and on stop. */
+    pthread_cond_t cond_submit;
+    /* Signalled when a batch is done. */
+    pthread_cond_t cond_done;
+    struct release_job *head;
+    uint64_t n_submitted, n_done;
+    /* First error since the last flush. */
+    int err;
+    /* Set by release_wake() until the idle callback has been called. */
+    bool is_woken;
+    bool is_stopping;
+};
+
+static void notify(struct release_queue * const qp)
+{
+    const uint64_t one = 1;
+
+    while (write(qp->eventfd, &one, sizeof(one)) == -1 && errno == EINTR)
+        ;
+}
+
+static void wait_poll(struct release_queue * const qp)
+{
+    struct timespec t;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &t);
+    t.tv_nsec += RELEASE_POLL_NS;
+    if (t.tv_nsec >= 1000000000) {
+        t.tv_sec ++;
+        t.tv_nsec -= 1000000000;
+    }
+    (void) pthread_cond_timedwait(&qp->cond_submit, &qp->lock, &t);
+}
+
+static void* release_main(void *arg)
+{
+    struct release_queue * const qp = arg;
+    bool is_polling = false;
+
+    (void) pthread_mutex_lock(&qp->lock);
+    for (;;) {
+        struct release_job *jp;
+        uint64_t n = 0;
+        int err = 0;
+
+        /* Stop only once the queue is drained. */
+        if (qp->head == NULL && qp->is_stopping)
+            break;
+        if (qp->head == NULL && !qp->is_woken) {
+            if (is_polling)
+                wait_poll(qp);
+            else
+                (void) pthread_cond_wait(&qp->cond_submit, &qp->lock);
+        }
+        jp = qp->head;
+        qp->head = NULL;
+        qp->is_woken = false;
+        (void) pthread_mutex_unlock(&qp->lock);
+
+        /* The queue is LIFO, but frees commute. */
+        while (jp != NULL) {
+            struct release_job * const next = jp->next;
+            const int e = qp->run(jp, qp->arg);
+            if (e && !err)
+                err = e;
+            jp = next;
+            n ++;
+        }
+        if (qp->idle != NULL)
+            is_polling = qp->idle(qp->arg);
+
+        (void) pthread_mutex_lock(&qp->lock);
+        if (n != 0) {
+            qp->n_done += n;
+            if (err && !qp->err)
+                qp->err = err;
+            (void) pthread_cond_broadcast(&qp->cond_done);
+            notify(qp);
+        }
+    }
+    (void) pthread_mutex_unlock(&qp->lock);
+    return NULL;
+}
+
+struct release_queue* release_create(const release_run_fn run,
+        const release_idle_fn idle, void * const arg)
+{
+    struct release_queue *qp;
+    pthread_condattr_t attr;
+    int err;
+
+    qp = malloc(sizeof(*qp));
+    if (qp == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    qp->run = run;
+    qp->idle = idle;
+    qp->arg = arg;
+    qp->head = NULL;
+    qp->n_submitted = qp->n_done = 0;
+    qp->err = 0;
+    qp->is_woken = false;
+    qp->is_stopping = false;
+
+    qp->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (qp->eventfd == -1) {
+        print_error("eventfd: %s\n", strerror(errno));
+        goto clean_qp;
+    }
+    (void) pthread_mutex_init(&qp->lock, NULL);
+    (void) pthread_condattr_init(&attr);
+    (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    (void) pthread_cond_init(&qp->cond_submit, &attr);
+    (void) pthread_condattr_destroy(&attr);
+    (void) pthread_cond_init(&qp->cond_done, NULL);
+
+    err = pthread_create(&qp->thread, NULL, release_main, qp);
+    if (err) {
+        print_error("pthread_create: %s\n", strerror(err));
+        goto clean_sync;
+    }
+    return qp;
+
+clean_sync:
+    (void) pthread_cond_destroy(&qp->cond_done);
+    (void) pthread_cond_destroy(&qp->cond_submit);
+    (void) pthread_mutex_destroy(&qp->lock);
+    (void) close(qp->eventfd);
+clean_qp:
+    free(qp);
+    return NULL;
+}
+
+int release_destroy(struct release_queue * const qp)
+{
+    int err;
+
+    (void) pthread_mutex_lock(&qp->lock);
+    qp->is_stopping = true;
+    (void) pthread_cond_signal(&qp->cond_submit);
+    (void) pthread_mutex_unlock(&qp->lock);
+    (void) pthread_join(qp->thread, NULL);
+
+    err = qp->err;
+    (void) pthread_cond_destroy(&qp->cond_done);
+    (void) pthread_cond_destroy(&qp->cond_submit);
+    (void) pthread_mutex_destroy(&qp->lock);
+    (void) close(qp->eventfd);
+    free(qp);
+    return err;
+}
+
+void release_submit(struct release_queue * const qp,
+        struct release_job * const jp)
+{
+    (void) pthread_mutex_lock(&qp->lock);
+    jp->next = qp->head;
+    qp->head = jp;
+    qp->n_submitted ++;
+    (void) pthread_cond_signal(&qp->cond_submit);
+    (void) pthread_mutex_unlock(&qp->lock);
+}
+
+void release_wake(struct release_queue * const qp)
+{
+    (void) pthread_mutex_lock(&qp->lock);
+    qp->is_woken = true;
+    (void) pthread_cond_signal(&qp->cond_submit);
+    (void) pthread_mutex_unlock(&qp->lock);
+}
+
+int release_flush(struct release_queue * const qp)
+{
+    uint64_t target;
+    int err;
+
+    (void) pthread_mutex_lock(&qp->lock);
+    target = qp->n_submitted;
+    while (qp->n_done < target)
+        (void) pthread_cond_wait(&qp->cond_done, &qp->lock);
+    err = qp->err;
+    qp->err = 0;
+    (void) pthread_mutex_unlock(&qp->lock);
+    return err;
+}
+
+int release_eventfd(const struct release_queue * const qp)
+{
+    return qp->eventfd;
+}
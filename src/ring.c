@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Positions count bytes handed out since creation and never wrap; the offset
+ * in the buffer is the position modulo its size.  Everything in [tail, head)
+ * is in use, including the bytes skipped at the end of the buffer when a
+ * region does not fit there.  A fence records the head at the time it was
+ * added, and retiring it moves the tail up to there.
+ */
+
+struct ring_fence {
+    uint64_t end, seqno;
+};
+
+struct rpimemmgr_ring {
+    struct rpimemmgr *sp;
+    uint8_t *usraddr;
+    uint32_t busaddr;
+    size_t size;
+    uint64_t head, tail;
+    rpimemmgr_fence_poll_fn poll;
+    void *poll_arg;
+    /* Pending fences are fences[first_fence .. n_fences). */
+    struct ring_fence *fences;
+    size_t first_fence, n_fences, max_fences;
+};
+
+#define RING_ALIGN 4096
+
+int rpimemmgr_ring_create(const enum rpimemmgr_backend backend,
+        const size_t size, const uint32_t flags,
+        const rpimemmgr_fence_poll_fn poll, void * const poll_arg,
+        struct rpimemmgr_ring ** const ringp, struct rpimemmgr *sp)
+{
+    struct rpimemmgr_alloc_desc desc;
+    struct rpimemmgr_ring *ring;
+    void *usraddr;
+    int err;
+
+    if (ringp == NULL) {
+        print_error("ringp is NULL\n");
+        return 1;
+    }
+    if (size == 0 || size % RING_ALIGN != 0) {
+        print_error("size must be a non-zero multiple of %d\n", RING_ALIGN);
+        return 1;
+    }
+
+    ring = malloc(sizeof(*ring));
+    if (ring == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return 1;
+    }
+
+    desc.size = size;
+    desc.align = RING_ALIGN;
+    desc.flags = flags;
+    err = rpimemmgr_alloc_batch(backend, 1, &desc, &usraddr, &ring->busaddr,
+            sp);
+    if (err) {
+        free(ring);
+        return err;
+    }
+
+    ring->sp = sp;
+    ring->usraddr = usraddr;
+    ring->size = size;
+    ring->head = ring->tail = 0;
+    ring->poll = poll;
+    ring->poll_arg = poll_arg;
+    ring->fences = NULL;
+    ring->first_fence = ring->n_fences = ring->max_fences = 0;
+    *ringp = ring;
+    return 0;
+}
+
+int rpimemmgr_ring_destroy(struct rpimemmgr_ring * const ring)
+{
+    int err;
+
+    if (ring == NULL) {
+        print_error("ring is NULL\n");
+        return 1;
+    }
+
+    err = rpimemmgr_free_by_usraddr(ring->usraddr, ring->sp);
+    free(ring->fences);
+    free(ring);
+    return err;
+}
+
+void rpimemmgr_ring_retire(struct rpimemmgr_ring * const ring,
+        const uint64_t completed)
+{
+    while (ring->first_fence < ring->n_fences
+            && ring->fences[ring->first_fence].seqno <= completed) {
+        ring->tail = ring->fences[ring->first_fence].end;
+        ring->first_fence ++;
+    }
+    if (ring->first_fence == ring->n_fences)
+        ring->first_fence = ring->n_fences = 0;
+}
+
+/* Returns the position where a region of size bytes can start, if any. */
+static bool find_space(const struct rpimemmgr_ring * const ring,
+        const size_t size, const size_t align, uint64_t * const startp)
+{
+    const size_t offset = ring->head % ring->size;
+    uint64_t start = ring->head + (-offset & (align - 1));
+
+    /* Never straddle the end of the buffer: skip to the start instead. */
+    if (start % ring->size + size > ring->size
+            || start % ring->size < offset)
+        start = ring->head + (ring->size - offset);
+    if (start + size - ring->tail > ring->size)
+        return false;
+    *startp = start;
+    return true;
+}
+
+int rpimemmgr_ring_alloc(struct rpimemmgr_ring * const ring,
+        const size_t size, const size_t align, void ** const usraddrp,
+        uint32_t * const busaddrp)
+{
+    uint64_t start;
+
+    if (ring == NULL) {
+        print_error("ring is NULL\n");
+        return 1;
+    }
+    if (size == 0 || size > ring->size) {
+        print_error("Invalid size: %zu\n", size);
+        return 1;
+    }
+    if (align == 0 || (align & (align - 1)) != 0 || align > RING_ALIGN) {
+        print_error("align must be a power of two up to %d\n", RING_ALIGN);
+        return 1;
+    }
+
+    if (!find_space(ring, size, align, &start)) {
+        if (ring->poll != NULL)
+            rpimemmgr_ring_retire(ring, ring->poll(ring->poll_arg));
+        if (!find_space(ring, size, align, &start))
+            return 1;
+    }
+
+    ring->head = start + size;
+    if (usraddrp != NULL)
+        *usraddrp = ring->usraddr + start % ring->size;
+    if (busaddrp != NULL)
+        *busaddrp = ring->busaddr + start % ring->size;
+    return 0;
+}
+
+int rpimemmgr_ring_fence(struct rpimemmgr_ring * const ring,
+        const uint64_t seqno)
+{
+    if (ring == NULL) {
+        print_error("ring is NULL\n");
+        return 1;
+    }
+    if (ring->n_fences > ring->first_fence
+            && ring->fences[ring->n_fences - 1].seqno > seqno) {
+        print_error("seqno went backwards: %llu\n",
+                (unsigned long long) seqno);
+        return 1;
+    }
+    /* Nothing allocated since the last fence. */
+    if (ring->head == (ring->n_fences > ring->first_fence
+                ? ring->fences[ring->n_fences - 1].end : ring->tail))
+        return 0;
+
+    if (ring->n_fences == ring->max_fences) {
+        if (ring->first_fence != 0) {
+            /* Reuse the retired slots at the front. */
+            memmove(ring->fences, ring->fences + ring->first_fence,
+                    sizeof(*ring->fences)
+                    * (ring->n_fences - ring->first_fence));
+            ring->n_fences -= ring->first_fence;
+            ring->first_fence = 0;
+        } else {
+            const size_t max = ring->max_fences ? ring->max_fences * 2 : 16;
+            struct ring_fence * const fences = realloc(ring->fences,
+                    sizeof(*fences) * max);
+            if (fences == NULL) {
+                print_error("realloc: %s\n", strerror(errno));
+                return 1;
+            }
+            ring->fences = fences;
+            ring->max_fences = max;
+        }
+    }
+
+    ring->fences[ring->n_fences].end = ring->head;
+    ring->fences[ring->n_fences].seqno = seqno;
+    ring->n_fences ++;
+    return 0;
+}
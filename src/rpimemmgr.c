@@ -14,92 +14,667 @@
 #include <mailbox.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <errno.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <search.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+/*
+ * Default gap bridged between two synced ranges of a buffer.  It is a guess,
+ * not a measurement: a cache line operation over 1 KiB is taken to cost about
+ * as much as the fixed overhead of another entry.  test/cache_op_speed finds
+ * the crossover on a given board.
+ */
+#define SYNC_GAP_DEFAULT 1024
+
+/* Indexed by enum rpimemmgr_dma_heap. */
+static const char * const dma_heap_names[] = {"system", "linux,cma"};
+#define N_DMA_HEAPS (sizeof(dma_heap_names) / sizeof(dma_heap_names[0]))
+
+/*
+ * Locking in thread-safe mode: lock protects the pools, the recycle cache, the
+ * configuration and the list of per-thread caches; index_lock protects the
+ * two indices and is taken after lock when both are needed; init_lock
+ * serializes the lazy opening of the backends.  No backend call is made with
+ * lock or index_lock held.  Without thread-safe mode none of them is taken.
+ */
 struct rpimemmgr_priv {
+    bool is_thread_safe;
+    pthread_mutex_t lock, init_lock;
+    pthread_rwlock_t index_lock;
+    pthread_key_t tcache_key;
+    struct tcache *tcaches;
     bool is_vcsm_inited;
-    int fd_mb, fd_mem, fd_drm;
-    void *busaddr_based_root;
-    void *usraddr_based_root;
+    int fd_mb, fd_mem;
+    struct drm_dev drm;
+    int fd_heaps[N_DMA_HEAPS];
+    /* Valid once fd_mb is open. */
+    struct rpimemmgr_caps caps;
+    /*
+     * Every mem_elem is in busaddr_index, unless it is a dma-buf without a
+     * bus address, and, if it is mapped, usraddr_index.
+     */
+    struct index busaddr_index;
+    struct index usraddr_index;
+    size_t pool_chunk_size, pool_max_size;
+    /* 0 until rpimemmgr_set_mailbox_window(). */
+    size_t mailbox_window_size;
+    struct pool *pools;
+    struct recycle recycle;
+    /* NULL until the first simulated allocation. */
+    struct sim_space *sim_space;
+    /* Added to every simulated alloc and free; see sim_delay(). */
+    unsigned sim_alloc_us, sim_free_us;
+    /* SYNC_GAP_DEFAULT until rpimemmgr_set_sync_gap(). */
+    size_t sync_max_gap;
+    /* NULL until rpimemmgr_start_xfer_workers(). */
+    struct xfer_queue *xfer;
+    /*
+     * DRM buffers freed with rpimemmgr_free_deferred_by_*() that the GPU may
+     * still use, linked by deferred_next.  Guarded by lock.
+     */
+    struct mem_elem *deferred;
+    /* NULL until rpimemmgr_start_release_thread(). */
+    struct release_queue *release;
+    /* Bumped with count(); see stats.c. */
+    struct rpimemmgr_stats stats;
+    /* NULL until rpimemmgr_publish_stats(). */
+    struct shm_stats *shm_stats;
 };
 
 struct mem_elem {
+    /* In the order of enum rpimemmgr_backend; indexes mem_ops[]. */
     enum mem_elem_type{
-        MEM_TYPE_VCSM    = 1<<0,
-        MEM_TYPE_MAILBOX = 1<<1,
-        MEM_TYPE_DRM     = 1<<2,
+        MEM_TYPE_VCSM,
+        MEM_TYPE_MAILBOX,
+        MEM_TYPE_DRM,
+        MEM_TYPE_SIM,
+        /* For the CPU only; handle is an fd, flags is the dma-heap if any. */
+        MEM_TYPE_DMABUF,
+        N_MEM_TYPES
     } type;
     size_t size;
+    uint32_t flags;
     uint32_t handle, busaddr;
     const void *usraddr;
+    /* Non-NULL if this is a sub-range of a pool chunk. */
+    struct pool_chunk *chunk;
+    /*
+     * Set while the block sits in a per-thread cache or on the deferred list.
+     * It stays registered meanwhile but is invisible to lookups.
+     */
+    bool cached;
+    struct mem_elem *deferred_next;
+    /* PRIME fd of DRM memory, exported on first sync; -1 otherwise. */
+    int dmabuf_fd;
+    /* Foreign memory, which is never recycled. */
+    bool is_imported;
+    /* Shared with others, who may still use it; never recycled either. */
+    bool is_exported;
+    /* Queued on the release thread once unregistered. */
+    struct release_job release_job;
+};
+
+/*
+ * What the core needs from a backend.  open, alloc and free are mandatory;
+ * the other functions are NULL where the backend cannot do it.  See the
+ * backends section below for the table.
+ */
+struct mem_ops {
+    const char *name;
+    /* Whether there is a bus address, which pools and lookups need. */
+    bool has_busaddr;
+    /* Whether flags means anything; it is 0 otherwise. */
+    bool has_flags;
+    /* Whether allocation without usraddrp leaves the buffer unmapped. */
+    bool is_mapping_optional;
+    /* Whether a sync always covers the whole buffer. */
+    bool is_sync_whole;
+    /* Whether rpimemmgr_set_mailbox_window() applies. */
+    bool is_windowed;
+    /* Opens the backend on first use; cheap once it is open. */
+    int (*open)(const uint32_t flags, const bool do_mapping,
+            struct rpimemmgr *sp);
+    int (*alloc)(const size_t size, const size_t align, const uint32_t flags,
+            uint32_t *handlep, uint32_t *busaddrp, void **usraddrp,
+            struct rpimemmgr *sp);
+    /* All the requests of a batch that are not done yet, if faster. */
+    int (*alloc_batch)(const size_t n, struct mem_req *reqs,
+            const bool do_mapping, struct rpimemmgr *sp);
+    int (*free)(const size_t size, const uint32_t handle,
+            const uint32_t busaddr, void *usraddr, struct rpimemmgr *sp);
+    /* Maps and unmaps a buffer of its own after allocation. */
+    int (*map)(const struct mem_elem *ep, void **usraddrp,
+            struct rpimemmgr *sp);
+    int (*unmap)(const struct mem_elem *ep, void *usraddr,
+            struct rpimemmgr *sp);
+    /* Polls (timeout_ns = 0) or waits until the device is done with it. */
+    int (*wait)(const struct mem_elem *ep, const uint64_t timeout_ns,
+            bool *is_idlep, struct rpimemmgr *sp);
+    /* NULL if the CPU mapping never needs maintenance. */
+    int (*sync)(struct mem_elem *ep, const struct rpimemmgr_cache_op_desc *dp,
+            struct cache_op_buf *bp, struct rpimemmgr *sp);
+    int (*export)(const struct mem_elem *ep, int *dmabuf_fdp,
+            struct rpimemmgr *sp);
+    /* NULL if the CPU mapping is always cached. */
+    bool (*is_uncached)(const uint32_t flags);
+    /* NULL if every buffer may be recycled. */
+    bool (*is_recyclable)(const uint32_t flags);
 };
 
-static int mem_elem_busaddr_compar(const void *pa, const void *pb)
+static const struct mem_ops* get_ops(const enum mem_elem_type type);
+
+static void lock_priv(struct rpimemmgr_priv *priv)
 {
-    const struct mem_elem *na = (const struct mem_elem*) pa,
-                          *nb = (const struct mem_elem*) pb;
-    if (na->busaddr < nb->busaddr)
-        return -1;
-    if (na->busaddr > nb->busaddr)
-        return 1;
-    return 0;
+    if (priv->is_thread_safe)
+        (void) pthread_mutex_lock(&priv->lock);
 }
 
-static int mem_elem_usraddr_compar(const void *pa, const void *pb)
+static void unlock_priv(struct rpimemmgr_priv *priv)
 {
-    const struct mem_elem *na = (const struct mem_elem*) pa,
-                          *nb = (const struct mem_elem*) pb;
-    if (na->usraddr < nb->usraddr)
-        return -1;
-    if (na->usraddr > nb->usraddr)
-        return 1;
-    return 0;
+    if (priv->is_thread_safe)
+        (void) pthread_mutex_unlock(&priv->lock);
 }
 
-static int free_elem(struct mem_elem *ep, struct rpimemmgr *sp)
+static void rdlock_index(struct rpimemmgr_priv *priv)
+{
+    if (priv->is_thread_safe)
+        (void) pthread_rwlock_rdlock(&priv->index_lock);
+}
+
+static void wrlock_index(struct rpimemmgr_priv *priv)
+{
+    if (priv->is_thread_safe)
+        (void) pthread_rwlock_wrlock(&priv->index_lock);
+}
+
+static void unlock_index(struct rpimemmgr_priv *priv)
+{
+    if (priv->is_thread_safe)
+        (void) pthread_rwlock_unlock(&priv->index_lock);
+}
+
+static void lock_init(struct rpimemmgr_priv *priv)
+{
+    if (priv->is_thread_safe)
+        (void) pthread_mutex_lock(&priv->init_lock);
+}
+
+static void unlock_init(struct rpimemmgr_priv *priv)
+{
+    if (priv->is_thread_safe)
+        (void) pthread_mutex_unlock(&priv->init_lock);
+}
+
+/* Whether an environment variable is set to a non-zero value. */
+static bool is_env_set(const char * const name)
+{
+    const char * const value = getenv(name);
+
+    return value != NULL && value[0] != '\0' && value[0] != '0';
+}
+
+static void count(uint64_t *p, const uint64_t v, struct rpimemmgr *sp)
+{
+    stats_add(p, v, sp->priv->is_thread_safe);
+}
+
+static bool is_cached(const struct mem_elem *ep)
+{
+    return __atomic_load_n(&ep->cached, __ATOMIC_RELAXED);
+}
+
+static void set_cached(struct mem_elem *ep, const bool cached)
+{
+    __atomic_store_n(&ep->cached, cached, __ATOMIC_RELAXED);
+}
+
+/*
+ * Whether the CPU mapping is uncached or write-combined, where the streaming
+ * kernels beat libc.  Simulated memory stands in for GPU memory, so it takes
+ * the same path, which also keeps the kernels tested off a Raspberry Pi.
+ */
+static bool is_uncached_type(const enum mem_elem_type type,
+        const uint32_t flags)
+{
+    const struct mem_ops * const ops = get_ops(type);
+
+    return ops->is_uncached != NULL && ops->is_uncached(flags);
+}
+
+/*
+ * Accounts for n buffers of size bytes in total taken from the backend, of
+ * which uncached_size bytes are mapped uncached.
+ */
+static void count_alloc(const enum mem_elem_type type, const size_t n,
+        const size_t size, const size_t uncached_size, struct rpimemmgr *sp)
+{
+    struct rpimemmgr_backend_stats * const bp =
+            &sp->priv->stats.backends[type];
+
+    count(&bp->n_allocs, n, sp);
+    stats_live_add(bp, n, size, sp->priv->is_thread_safe);
+    count(&bp->live_uncached_bytes, uncached_size, sp);
+}
+
+static int alloc_mem(const enum mem_elem_type type, const size_t size,
+        const size_t align, const uint32_t flags, uint32_t *handlep,
+        uint32_t *busaddrp, void **usraddrp, struct rpimemmgr *sp)
+{
+    const uint64_t start = stats_now();
+    int err;
+
+    err = get_ops(type)->alloc(size, align, flags, handlep, busaddrp,
+            usraddrp, sp);
+    stats_latency(sp->priv->stats.backends[type].alloc_latency, start,
+            sp->priv->is_thread_safe);
+    if (!err)
+        count_alloc(type, 1, size, is_uncached_type(type, flags) ? size : 0,
+                sp);
+    return err;
+}
+
+/* The memory is gone even if this fails, so it is always accounted. */
+static int free_mem(const enum mem_elem_type type, const size_t size,
+        const uint32_t flags, const uint32_t handle, const uint32_t busaddr,
+        void *usraddr, struct rpimemmgr *sp)
 {
-    void *node_from_busaddr_based;
-    void *node_from_usraddr_based;
+    struct rpimemmgr_backend_stats * const bp =
+            &sp->priv->stats.backends[type];
+    const uint64_t start = stats_now();
+    int err;
+
+    err = get_ops(type)->free(size, handle, busaddr, usraddr, sp);
+    stats_latency(bp->free_latency, start, sp->priv->is_thread_safe);
+    count(&bp->n_frees, 1, sp);
+    stats_live_sub(bp, size, sp->priv->is_thread_safe);
+    if (is_uncached_type(type, flags))
+        count(&bp->live_uncached_bytes, -(uint64_t) size, sp);
+    return err;
+}
+
+/*
+ * Unlinks the entries to be evicted from the recycle cache into a list
+ * chained with lnext.  Call with lock held.
+ */
+static struct recycle_entry* pop_victims(const size_t max_bytes,
+        struct rpimemmgr *sp)
+{
+    struct recycle_entry *victims = NULL, *ep;
+
+    while ((ep = recycle_pop_victim(&sp->priv->recycle, max_bytes)) != NULL) {
+        ep->lnext = victims;
+        victims = ep;
+    }
+    return victims;
+}
+
+/* Frees what pop_victims() returned.  Call without lock held. */
+static int free_victims(struct recycle_entry *victims, struct rpimemmgr *sp)
+{
+    int err_sum = 0;
+
+    while (victims != NULL) {
+        struct recycle_entry * const ep = victims;
+        int err = free_mem(ep->type, ep->size, ep->flags, ep->handle,
+                ep->busaddr, ep->usraddr, sp);
+        if (err) {
+            err_sum = err;
+            /* Continue trimming. */
+        }
+        victims = ep->lnext;
+        free(ep);
+    }
+    return err_sum;
+}
+
+static int trim_recycle(const size_t max_bytes, struct rpimemmgr *sp)
+{
+    struct recycle_entry *victims;
+
+    lock_priv(sp->priv);
+    victims = pop_victims(max_bytes, sp);
+    unlock_priv(sp->priv);
+    return free_victims(victims, sp);
+}
+
+static bool is_recycle_enabled(struct rpimemmgr *sp)
+{
+    return __atomic_load_n(&sp->priv->recycle.max_bytes, __ATOMIC_RELAXED)
+            != 0;
+}
+
+/*
+ * Memory that the backend zero-fills on allocation cannot be handed out again
+ * without clearing it, which would defeat the purpose of recycling.
+ */
+static bool is_recyclable(const enum mem_elem_type type, const uint32_t flags)
+{
+    const struct mem_ops * const ops = get_ops(type);
 
-    node_from_busaddr_based = tdelete(ep, &sp->priv->busaddr_based_root,
-            mem_elem_busaddr_compar);
-    node_from_usraddr_based = tdelete(ep, &sp->priv->usraddr_based_root,
-            mem_elem_usraddr_compar);
-    if (node_from_busaddr_based == NULL || node_from_usraddr_based == NULL) {
+    return ops->is_recyclable == NULL || ops->is_recyclable(flags);
+}
+
+/* alloc_mem() that tries the recycle cache first. */
+static int get_mem(const enum mem_elem_type type, const size_t size,
+        const size_t align, const uint32_t flags, uint32_t *handlep,
+        uint32_t *busaddrp, void **usraddrp, struct rpimemmgr *sp)
+{
+    if (is_recycle_enabled(sp) && is_recyclable(type, flags)) {
+        void *usraddr;
+        bool found;
+
+        lock_priv(sp->priv);
+        found = recycle_get(&sp->priv->recycle, type, flags,
+                usraddrp != NULL, size, align, handlep, busaddrp, &usraddr);
+        unlock_priv(sp->priv);
+        if (found) {
+            if (usraddrp != NULL)
+                *usraddrp = usraddr;
+            return 0;
+        }
+    }
+
+    return alloc_mem(type, size, align, flags, handlep, busaddrp, usraddrp,
+            sp);
+}
+
+/* free_mem() that keeps the memory in the recycle cache if enabled. */
+static int put_mem(const enum mem_elem_type type, const size_t size,
+        const uint32_t flags, const uint32_t handle, const uint32_t busaddr,
+        void *usraddr, struct rpimemmgr *sp)
+{
+    if (is_recycle_enabled(sp) && is_recyclable(type, flags)) {
+        struct recycle_entry *victims = NULL;
+        bool kept;
+
+        lock_priv(sp->priv);
+        kept = !recycle_put(&sp->priv->recycle, type, flags, size, handle,
+                busaddr, usraddr);
+        if (kept)
+            victims = pop_victims(sp->priv->recycle.max_bytes, sp);
+        unlock_priv(sp->priv);
+        if (kept)
+            return free_victims(victims, sp);
+    }
+
+    return free_mem(type, size, flags, handle, busaddr, usraddr, sp);
+}
+
+/* Unlinks a chunk and frees its memory.  Call without lock held. */
+static int free_chunk(struct pool_chunk *chunk, struct rpimemmgr *sp)
+{
+    const struct pool * const pool = chunk->class->pool;
+    const uint32_t handle = chunk->handle, busaddr = chunk->busaddr;
+    void * const usraddr = chunk->usraddr;
+
+    lock_priv(sp->priv);
+    pool_remove_chunk(chunk);
+    unlock_priv(sp->priv);
+    return put_mem(pool->type, pool->chunk_size, pool->flags, handle, busaddr,
+            usraddr, sp);
+}
+
+/* Returns a block to its chunk, and the chunk to the backend if surplus. */
+static int put_block(struct pool_chunk *chunk, const size_t offset,
+        struct rpimemmgr *sp)
+{
+    const struct pool * const pool = chunk->class->pool;
+    const uint32_t handle = chunk->handle, busaddr = chunk->busaddr;
+    void * const usraddr = chunk->usraddr;
+    bool is_surplus;
+
+    lock_priv(sp->priv);
+    is_surplus = pool_put(chunk, offset);
+    if (is_surplus)
+        pool_remove_chunk(chunk);
+    unlock_priv(sp->priv);
+    if (!is_surplus)
+        return 0;
+
+    return put_mem(pool->type, pool->chunk_size, pool->flags, handle, busaddr,
+            usraddr, sp);
+}
+
+/* Frees the memory of an unregistered mem_elem, and the mem_elem. */
+static int finish_release(struct mem_elem *ep, struct rpimemmgr *sp)
+{
+    int err;
+
+    if (ep->dmabuf_fd != -1 && close(ep->dmabuf_fd))
+        print_error("close: %s\n", strerror(errno));
+
+    if (ep->chunk != NULL)
+        err = put_block(ep->chunk, ep->busaddr - ep->chunk->busaddr, sp);
+    else if (ep->is_imported || ep->is_exported)
+        err = free_mem(ep->type, ep->size, ep->flags, ep->handle,
+                ep->busaddr, (void*)ep->usraddr, sp);
+    else
+        err = put_mem(ep->type, ep->size, ep->flags, ep->handle, ep->busaddr,
+                (void*)ep->usraddr, sp);
+
+    free(ep);
+    return err;
+}
+
+/*
+ * Unregisters a mem_elem and frees its memory, on the release thread if it
+ * runs.
+ */
+static int release_elem(struct mem_elem *ep, struct rpimemmgr *sp)
+{
+    struct release_queue *release;
+    bool found;
+
+    wrlock_index(sp->priv);
+    found = (ep->busaddr == 0
+                || index_remove(&sp->priv->busaddr_index, ep->busaddr) == ep)
+            && (ep->usraddr == NULL || index_remove(&sp->priv->usraddr_index,
+                    (uintptr_t) ep->usraddr) == ep);
+    unlock_index(sp->priv);
+    if (!found) {
         print_error("Node not found\n");
         return 1;
     }
 
-    switch (ep->type) {
-        case MEM_TYPE_VCSM:
-            return free_mem_vcsm(ep->handle, (void*)ep->usraddr);
-        case MEM_TYPE_MAILBOX:
-            return free_mem_mailbox(sp->priv->fd_mb, ep->size, ep->handle,
-                    ep->busaddr, (void*)ep->usraddr);
-        case MEM_TYPE_DRM:
-            return free_mem_drm(sp->priv->fd_drm, ep->size, ep->handle,
-                    (void*)ep->usraddr);
-        default:
-            print_error("Unknown memory type: 0x%08x\n", ep->type);
-            return 1;
+    release = __atomic_load_n(&sp->priv->release, __ATOMIC_ACQUIRE);
+    if (release != NULL) {
+        release_submit(release, &ep->release_job);
+        return 0;
     }
+    return finish_release(ep, sp);
+}
 
-    free(ep);
+static struct tcache* get_tcache(struct rpimemmgr *sp)
+{
+    struct tcache *tc;
+
+    if (!sp->priv->is_thread_safe)
+        return NULL;
+
+    tc = pthread_getspecific(sp->priv->tcache_key);
+    if (tc != NULL)
+        return tc;
+
+    tc = tcache_create(sp);
+    if (tc == NULL)
+        return NULL;
+    if (pthread_setspecific(sp->priv->tcache_key, tc)) {
+        print_error("pthread_setspecific failed\n");
+        tcache_destroy(tc);
+        return NULL;
+    }
+
+    lock_priv(sp->priv);
+    tc->prev = NULL;
+    tc->next = sp->priv->tcaches;
+    if (tc->next != NULL)
+        tc->next->prev = tc;
+    sp->priv->tcaches = tc;
+    unlock_priv(sp->priv);
+    return tc;
+}
+
+/*
+ * Bumps one of the counters of struct tcache_stats: in the calling thread's
+ * tcache in thread-safe mode, in sp->priv->stats otherwise.
+ */
+#define count_hot(field, v, sp) \
+        do { \
+            struct tcache * const tc_ = get_tcache(sp); \
+            if (tc_ != NULL) \
+                __atomic_store_n(&tc_->stats.field, tc_->stats.field + (v), \
+                        __ATOMIC_RELAXED); \
+            else \
+                count(&(sp)->priv->stats.field, (v), (sp)); \
+        } while (0)
+
+/* Adds the counters of a tcache to dst.  Call with lock held. */
+static void add_tcache_stats(struct rpimemmgr_stats *dst,
+        const struct tcache *tc)
+{
+    dst->n_lookups += __atomic_load_n(&tc->stats.n_lookups, __ATOMIC_RELAXED);
+    dst->n_syncs += __atomic_load_n(&tc->stats.n_syncs, __ATOMIC_RELAXED);
+    dst->bytes_cleaned += __atomic_load_n(&tc->stats.bytes_cleaned,
+            __ATOMIC_RELAXED);
+    dst->bytes_invalidated += __atomic_load_n(&tc->stats.bytes_invalidated,
+            __ATOMIC_RELAXED);
+}
+
+/*
+ * Moves the counters of a tcache that goes away to sp->priv->stats.  Call with
+ * lock held, so that readers see them in exactly one of the two places.
+ */
+static void fold_tcache_stats(const struct tcache *tc, struct rpimemmgr *sp)
+{
+    count(&sp->priv->stats.n_lookups, tc->stats.n_lookups, sp);
+    count(&sp->priv->stats.n_syncs, tc->stats.n_syncs, sp);
+    count(&sp->priv->stats.bytes_cleaned, tc->stats.bytes_cleaned, sp);
+    count(&sp->priv->stats.bytes_invalidated, tc->stats.bytes_invalidated,
+            sp);
+}
+
+/* Destructor of tcache_key: gives the cached blocks back on thread exit. */
+static void tcache_exit(void *arg)
+{
+    struct tcache * const tc = arg;
+    struct rpimemmgr * const sp = tc->owner;
+    struct mem_elem *ep;
+
+    lock_priv(sp->priv);
+    fold_tcache_stats(tc, sp);
+    if (tc->prev != NULL)
+        tc->prev->next = tc->next;
+    else
+        sp->priv->tcaches = tc->next;
+    if (tc->next != NULL)
+        tc->next->prev = tc->prev;
+    unlock_priv(sp->priv);
+
+    while ((ep = tcache_drain(tc)) != NULL) {
+        set_cached(ep, false);
+        (void) release_elem(ep, sp);
+    }
+    tcache_destroy(tc);
+}
+
+/* Makes all cached blocks visible again; they are still registered. */
+static void drain_all_tcaches(struct rpimemmgr *sp)
+{
+    while (sp->priv->tcaches != NULL) {
+        struct tcache * const tc = sp->priv->tcaches;
+        struct mem_elem *ep;
+
+        while ((ep = tcache_drain(tc)) != NULL)
+            set_cached(ep, false);
+        fold_tcache_stats(tc, sp);
+        sp->priv->tcaches = tc->next;
+        tcache_destroy(tc);
+    }
+}
+
+static int free_elem(struct mem_elem *ep, struct rpimemmgr *sp)
+{
+    count(&sp->priv->stats.n_frees, 1, sp);
+    if (ep->chunk != NULL) {
+        struct tcache * const tc = get_tcache(sp);
+        if (tc != NULL && tcache_push(tc, ep->chunk->class, ep)) {
+            set_cached(ep, true);
+            return 0;
+        }
+    }
+
+    return release_elem(ep, sp);
+}
+
+/*
+ * Releases the deferred buffers that the GPU is done with, or waits for all of
+ * them with do_wait.  The list is taken whole so that concurrent reapers poll
+ * disjoint buffers.  The ones that are not idle, because they are busy or
+ * their wait failed, are put back unless is_final, i.e. unless sp is being
+ * finalized.
+ */
+static int reap_deferred(const bool do_wait, const bool is_final,
+        struct rpimemmgr *sp)
+{
+    struct mem_elem *ep, *busy = NULL, **busy_tailp = &busy;
+    int err_sum = 0;
+
+    lock_priv(sp->priv);
+    ep = sp->priv->deferred;
+    __atomic_store_n(&sp->priv->deferred, NULL, __ATOMIC_RELAXED);
+    unlock_priv(sp->priv);
+
+    while (ep != NULL) {
+        struct mem_elem * const next = ep->deferred_next;
+        bool is_idle = false;
+        int err;
+
+        err = get_ops(ep->type)->wait(ep, do_wait ? UINT64_MAX : 0,
+                &is_idle, sp);
+        if (err)
+            err_sum = err;
+        /* A buffer that cannot be waited for is only let go at the end. */
+        if (is_idle || (do_wait && is_final)) {
+            err = release_elem(ep, sp);
+            if (err)
+                err_sum = err;
+        } else {
+            *busy_tailp = ep;
+            busy_tailp = &ep->deferred_next;
+        }
+        ep = next;
+    }
+
+    if (busy != NULL) {
+        lock_priv(sp->priv);
+        *busy_tailp = sp->priv->deferred;
+        __atomic_store_n(&sp->priv->deferred, busy, __ATOMIC_RELAXED);
+        unlock_priv(sp->priv);
+    }
+    return err_sum;
+}
+
+/* Called on alloc and free so that deferred buffers do not pile up. */
+static void reap_deferred_if_any(struct rpimemmgr *sp)
+{
+    if (__atomic_load_n(&sp->priv->deferred, __ATOMIC_RELAXED) != NULL)
+        (void) reap_deferred(false, false, sp);
 }
 
 static int free_all_elems(struct rpimemmgr *sp)
 {
+    struct mem_elem *ep;
     int err_sum = 0;
-    while (sp->priv->busaddr_based_root != NULL) {
-        int err = free_elem(*(struct mem_elem**) sp->priv->busaddr_based_root,
-                sp);
+    while ((ep = index_any(&sp->priv->busaddr_index)) != NULL
+            || (ep = index_any(&sp->priv->usraddr_index)) != NULL) {
+        int err = release_elem(ep, sp);
         if (err) {
             err_sum = err;
             /* Continue finalization. */
@@ -108,12 +683,31 @@ static int free_all_elems(struct rpimemmgr *sp)
     return err_sum;
 }
 
+static int free_all_pools(struct rpimemmgr *sp)
+{
+    int err_sum = 0;
+    while (sp->priv->pools != NULL) {
+        struct pool * const pool = sp->priv->pools;
+        struct pool_chunk *chunk;
+        while ((chunk = pool_any_chunk(pool)) != NULL) {
+            int err = free_chunk(chunk, sp);
+            if (err) {
+                err_sum = err;
+                /* Continue finalization. */
+            }
+        }
+        sp->priv->pools = pool->next;
+        pool_destroy(pool);
+    }
+    return err_sum;
+}
+
 static int register_mem(const enum mem_elem_type type, const size_t size,
-        const uint32_t handle, const uint32_t busaddr,
-        void * const usraddr, struct rpimemmgr *sp)
+        const uint32_t flags, const uint32_t handle, const uint32_t busaddr,
+        void * const usraddr, struct pool_chunk * const chunk,
+        const bool is_imported, struct rpimemmgr *sp)
 {
-    struct mem_elem *ep, *ep_ret;
-    void *node = NULL;
+    struct mem_elem *ep;
 
     ep = malloc(sizeof(*ep));
     if (ep == NULL) {
@@ -121,368 +715,2291 @@ static int register_mem(const enum mem_elem_type type, const size_t size,
         return 1;
     }
 
-    ep->type = type;
-    ep->size = size;
-    ep->handle = handle;
-    ep->busaddr = busaddr;
-    ep->usraddr = usraddr;
+    ep->type = type;
+    ep->size = size;
+    ep->flags = flags;
+    ep->handle = handle;
+    ep->busaddr = busaddr;
+    ep->usraddr = usraddr;
+    ep->chunk = chunk;
+    ep->cached = false;
+    ep->dmabuf_fd = -1;
+    ep->is_imported = is_imported;
+    ep->is_exported = false;
+
+    wrlock_index(sp->priv);
+    if (busaddr != 0
+            && index_insert(&sp->priv->busaddr_index, busaddr, size, ep)) {
+        print_error("Duplicate busaddr (internal error)\n");
+        goto clean_ep;
+    }
+
+    if (usraddr != NULL && index_insert(&sp->priv->usraddr_index,
+                (uintptr_t) usraddr, size, ep)) {
+        print_error("Duplicate usraddr (internal error)\n");
+        goto clean_and_delete_ep;
+    }
+    unlock_index(sp->priv);
+
+    return 0;
+
+clean_and_delete_ep:
+    if (busaddr != 0)
+        (void) index_remove(&sp->priv->busaddr_index, busaddr);
+clean_ep:
+    unlock_index(sp->priv);
+    free(ep);
+    return 1;
+}
+
+/* Looks a registered, not cached mem_elem up by its start address. */
+static struct mem_elem* find_elem(const struct index *idx, const uintptr_t key,
+        struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    count_hot(n_lookups, 1, sp);
+
+    rdlock_index(sp->priv);
+    ep = index_find(idx, key);
+    if (ep != NULL && is_cached(ep))
+        ep = NULL;
+    unlock_index(sp->priv);
+    return ep;
+}
+
+/*
+ * Returns the pool that serves this request in pool mode, creating it on first
+ * use, or NULL if the request should go to the backend directly.  Only
+ * mapped memory is pooled.  Pools are never removed before finalization, so
+ * the list can be walked without lock.
+ */
+/*
+ * Chunk and largest block size of the pools of a backend, max_size = 0 for
+ * none.  Mailbox windows take the place of pool mode where they apply.
+ */
+static void get_pool_sizes(const enum mem_elem_type type, size_t *chunk_sizep,
+        size_t *max_sizep, struct rpimemmgr *sp)
+{
+    const size_t window_size = __atomic_load_n(
+            &sp->priv->mailbox_window_size, __ATOMIC_RELAXED);
+
+    if (get_ops(type)->is_windowed && window_size != 0) {
+        *chunk_sizep = *max_sizep = window_size;
+        return;
+    }
+    *chunk_sizep = __atomic_load_n(&sp->priv->pool_chunk_size,
+            __ATOMIC_RELAXED);
+    *max_sizep = __atomic_load_n(&sp->priv->pool_max_size, __ATOMIC_RELAXED);
+}
+
+static struct pool* find_pool(const enum mem_elem_type type,
+        const uint32_t flags, const size_t size, const size_t align,
+        const bool do_mapping, int *clsp, struct rpimemmgr *sp)
+{
+    size_t chunk_size, max_size;
+    struct pool *pool;
+    int cls;
+
+    get_pool_sizes(type, &chunk_size, &max_size, sp);
+
+    /*
+     * Blocks of a chunk without a bus address could not be told apart, and
+     * freed blocks are handed out again without being zeroed.
+     */
+    if (!do_mapping || size == 0 || !get_ops(type)->has_busaddr
+            || !is_recyclable(type, flags) || size > max_size)
+        return NULL;
+
+    for (pool = __atomic_load_n(&sp->priv->pools, __ATOMIC_ACQUIRE);
+            pool != NULL; pool = pool->next)
+        if (pool->type == type && pool->flags == flags
+                && pool->chunk_size == chunk_size)
+            break;
+
+    if (pool == NULL) {
+        lock_priv(sp->priv);
+        for (pool = sp->priv->pools; pool != NULL; pool = pool->next)
+            if (pool->type == type && pool->flags == flags
+                    && pool->chunk_size == chunk_size)
+                break;
+        if (pool == NULL) {
+            pool = pool_create(type, flags, chunk_size, max_size);
+            if (pool != NULL) {
+                pool->next = sp->priv->pools;
+                __atomic_store_n(&sp->priv->pools, pool, __ATOMIC_RELEASE);
+            }
+        }
+        unlock_priv(sp->priv);
+        if (pool == NULL)
+            return NULL;
+    }
+
+    cls = pool_class_of(pool, size, align);
+    if (cls < 0)
+        return NULL;
+    *clsp = cls;
+    return pool;
+}
+
+static int alloc_pooled(struct pool *pool, const int cls, uint32_t *busaddrp,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    struct pool_class * const class = &pool->classes[cls];
+    struct tcache * const tc = get_tcache(sp);
+    struct pool_chunk *chunk;
+    struct mem_elem *ep;
+    size_t offset;
+    uint8_t *usraddr;
+    int err;
+
+    if (tc != NULL && (ep = tcache_pop(tc, class)) != NULL) {
+        set_cached(ep, false);
+        *busaddrp = ep->busaddr;
+        *usraddrp = (void*) ep->usraddr;
+        return 0;
+    }
+
+    lock_priv(sp->priv);
+    if (pool_get(pool, cls, &chunk, &offset)) {
+        uint32_t handle, busaddr;
+        void *p;
+
+        unlock_priv(sp->priv);
+        err = get_mem(pool->type, pool->chunk_size, POOL_CHUNK_ALIGN,
+                pool->flags, &handle, &busaddr, &p, sp);
+        if (err)
+            return err;
+
+        lock_priv(sp->priv);
+        chunk = pool_add_chunk(pool, cls, handle, busaddr, p);
+        if (chunk == NULL) {
+            unlock_priv(sp->priv);
+            (void) put_mem(pool->type, pool->chunk_size, pool->flags, handle,
+                    busaddr, p, sp);
+            return 1;
+        }
+
+        (void) pool_get(pool, cls, &chunk, &offset);
+    }
+    unlock_priv(sp->priv);
+
+    /*
+     * Register the whole block so that it can be handed out again from a
+     * per-thread cache for any size in the class.
+     */
+    usraddr = (uint8_t*) chunk->usraddr + offset;
+    err = register_mem(pool->type, class->block_size, pool->flags,
+            chunk->handle, chunk->busaddr + offset, usraddr, chunk, false,
+            sp);
+    if (err) {
+        (void) put_block(chunk, offset, sp);
+        return err;
+    }
+
+    *busaddrp = chunk->busaddr + offset;
+    *usraddrp = usraddr;
+    return 0;
+}
+
+static int alloc_and_register(const enum mem_elem_type type, const size_t size,
+        const size_t align, const uint32_t flags, const bool do_mapping,
+        void **usraddrp, uint32_t *busaddrp, struct rpimemmgr *sp)
+{
+    uint32_t handle, busaddr;
+    void *usraddr = NULL;
+    struct pool *pool;
+    int cls, err;
+
+    reap_deferred_if_any(sp);
+
+    pool = find_pool(type, flags, size, align, do_mapping, &cls, sp);
+    if (pool != NULL) {
+        err = alloc_pooled(pool, cls, &busaddr, &usraddr, sp);
+        if (err)
+            return err;
+    } else {
+        /* Round up so that recycled blocks can serve nearby sizes. */
+        const size_t alloc_size = is_recycle_enabled(sp)
+                ? recycle_round_size(size) : size;
+
+        err = get_mem(type, alloc_size, align, flags, &handle, &busaddr,
+                do_mapping ? &usraddr : NULL, sp);
+        if (err)
+            return err;
+
+        err = register_mem(type, alloc_size, flags, handle, busaddr, usraddr,
+                NULL, false, sp);
+        if (err) {
+            (void) put_mem(type, alloc_size, flags, handle, busaddr, usraddr,
+                    sp);
+            return err;
+        }
+    }
+
+    count(&sp->priv->stats.n_allocs, 1, sp);
+    if (usraddrp)
+        *usraddrp = usraddr;
+    if (busaddrp)
+        *busaddrp = busaddr;
+    return 0;
+}
+
+/*
+ * Registers the requests of a batch that do not come from a pool, taking the
+ * index lock only once.  All or nothing.
+ */
+static int register_reqs(const enum mem_elem_type type, const size_t n,
+        const struct mem_req *reqs, struct rpimemmgr *sp)
+{
+    struct mem_elem **eps;
+    size_t i, n_inserted;
+
+    eps = calloc(n, sizeof(*eps));
+    if (eps == NULL) {
+        print_error("calloc: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (i = 0; i < n; i ++) {
+        if (reqs[i].is_pooled)
+            continue;
+        eps[i] = malloc(sizeof(*eps[i]));
+        if (eps[i] == NULL) {
+            print_error("malloc: %s\n", strerror(errno));
+            goto clean_eps;
+        }
+        eps[i]->type = type;
+        eps[i]->size = reqs[i].size;
+        eps[i]->flags = reqs[i].flags;
+        eps[i]->handle = reqs[i].handle;
+        eps[i]->busaddr = reqs[i].busaddr;
+        eps[i]->usraddr = reqs[i].usraddr;
+        eps[i]->chunk = NULL;
+        eps[i]->cached = false;
+        eps[i]->dmabuf_fd = -1;
+        eps[i]->is_imported = false;
+        eps[i]->is_exported = false;
+    }
+
+    wrlock_index(sp->priv);
+    for (n_inserted = 0; n_inserted < n; n_inserted ++) {
+        struct mem_elem * const ep = eps[n_inserted];
+        if (ep == NULL)
+            continue;
+        if (ep->busaddr != 0 && index_insert(&sp->priv->busaddr_index,
+                    ep->busaddr, ep->size, ep)) {
+            print_error("Duplicate busaddr (internal error)\n");
+            goto clean_inserted;
+        }
+        if (ep->usraddr != NULL && index_insert(&sp->priv->usraddr_index,
+                    (uintptr_t) ep->usraddr, ep->size, ep)) {
+            print_error("Duplicate usraddr (internal error)\n");
+            if (ep->busaddr != 0)
+                (void) index_remove(&sp->priv->busaddr_index, ep->busaddr);
+            goto clean_inserted;
+        }
+    }
+    unlock_index(sp->priv);
+
+    free(eps);
+    return 0;
+
+clean_inserted:
+    while (n_inserted -- > 0) {
+        struct mem_elem * const ep = eps[n_inserted];
+        if (ep == NULL)
+            continue;
+        if (ep->busaddr != 0)
+            (void) index_remove(&sp->priv->busaddr_index, ep->busaddr);
+        if (ep->usraddr != NULL)
+            (void) index_remove(&sp->priv->usraddr_index,
+                    (uintptr_t) ep->usraddr);
+    }
+    unlock_index(sp->priv);
+clean_eps:
+    for (i = 0; i < n; i ++)
+        free(eps[i]);
+    free(eps);
+    return 1;
+}
+
+/* get_mem() for all the requests of a batch that are not done yet. */
+static int get_mems(const enum mem_elem_type type, const size_t n,
+        struct mem_req *reqs, const bool do_mapping, struct rpimemmgr *sp)
+{
+    size_t i;
+
+    if (is_recycle_enabled(sp)) {
+        lock_priv(sp->priv);
+        for (i = 0; i < n; i ++) {
+            struct mem_req * const req = &reqs[i];
+            if (req->is_done || !is_recyclable(type, req->flags))
+                continue;
+            req->is_done = recycle_get(&sp->priv->recycle, type, req->flags,
+                    do_mapping, req->size, req->align, &req->handle,
+                    &req->busaddr, &req->usraddr);
+        }
+        unlock_priv(sp->priv);
+    }
+
+    if (get_ops(type)->alloc_batch != NULL) {
+        const uint64_t start = stats_now();
+        size_t n_new = 0, size_new = 0, uncached_new = 0;
+        int err;
+
+        for (i = 0; i < n; i ++) {
+            if (reqs[i].is_done)
+                continue;
+            n_new ++;
+            size_new += reqs[i].size;
+            if (is_uncached_type(type, reqs[i].flags))
+                uncached_new += reqs[i].size;
+        }
+        err = get_ops(type)->alloc_batch(n, reqs, do_mapping, sp);
+        stats_latency(sp->priv->stats.backends[type].alloc_latency, start,
+                sp->priv->is_thread_safe);
+        if (!err)
+            count_alloc(type, n_new, size_new, uncached_new, sp);
+        return err;
+    }
+
+    for (i = 0; i < n; i ++) {
+        struct mem_req * const req = &reqs[i];
+        int err;
+
+        if (req->is_done)
+            continue;
+        err = alloc_mem(type, req->size, req->align, req->flags,
+                &req->handle, &req->busaddr,
+                do_mapping ? &req->usraddr : NULL, sp);
+        if (err) {
+            while (i -- > 0)
+                if (!reqs[i].is_done)
+                    (void) free_mem(type, reqs[i].size, reqs[i].flags,
+                            reqs[i].handle, reqs[i].busaddr, reqs[i].usraddr,
+                            sp);
+            return err;
+        }
+    }
+
+    for (i = 0; i < n; i ++)
+        reqs[i].is_done = true;
+    return 0;
+}
+
+static int alloc_batch(const enum mem_elem_type type, const size_t n,
+        const struct rpimemmgr_alloc_desc *descs, const bool do_mapping,
+        void **usraddrs, uint32_t *busaddrs, struct rpimemmgr *sp)
+{
+    struct mem_req *reqs;
+    size_t i;
+    int err;
+
+    reap_deferred_if_any(sp);
+
+    reqs = calloc(n, sizeof(*reqs));
+    if (reqs == NULL) {
+        print_error("calloc: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (i = 0; i < n; i ++) {
+        struct mem_req * const req = &reqs[i];
+        struct pool *pool;
+        int cls;
+
+        req->size = descs[i].size;
+        req->align = descs[i].align;
+        req->flags = get_ops(type)->has_flags ? descs[i].flags : 0;
+
+        pool = find_pool(type, req->flags, req->size, req->align, do_mapping,
+                &cls, sp);
+        if (pool != NULL) {
+            err = alloc_pooled(pool, cls, &req->busaddr, &req->usraddr, sp);
+            if (err)
+                goto clean;
+            req->is_pooled = req->is_done = true;
+        } else if (is_recycle_enabled(sp))
+            req->size = recycle_round_size(req->size);
+    }
+
+    err = get_mems(type, n, reqs, do_mapping, sp);
+    if (err)
+        goto clean;
+
+    err = register_reqs(type, n, reqs, sp);
+    if (err)
+        goto clean;
+
+    count(&sp->priv->stats.n_allocs, n, sp);
+    for (i = 0; i < n; i ++) {
+        if (usraddrs != NULL)
+            usraddrs[i] = reqs[i].usraddr;
+        if (busaddrs != NULL)
+            busaddrs[i] = reqs[i].busaddr;
+    }
+    free(reqs);
+    return 0;
+
+clean:
+    for (i = 0; i < n; i ++) {
+        struct mem_req * const req = &reqs[i];
+        if (!req->is_done)
+            continue;
+        if (req->is_pooled) {
+            struct mem_elem * const ep =
+                    find_elem(&sp->priv->busaddr_index, req->busaddr, sp);
+            if (ep != NULL)
+                (void) release_elem(ep, sp);
+        } else
+            (void) put_mem(type, req->size, req->flags, req->handle,
+                    req->busaddr, req->usraddr, sp);
+    }
+    free(reqs);
+    return err;
+}
+
+static int open_mailbox(struct rpimemmgr *sp)
+{
+    int err = 0;
+
+    if (__atomic_load_n(&sp->priv->fd_mb, __ATOMIC_ACQUIRE) != -1)
+        return 0;
+
+    lock_init(sp->priv);
+    if (sp->priv->fd_mb == -1) {
+        const int fd = mailbox_open();
+        if (fd == -1) {
+            print_error("Failed to open Mailbox\n");
+            err = -1;
+        } else if (get_caps_by_fd(fd, &sp->priv->caps)) {
+            (void) mailbox_close(fd);
+            err = -1;
+        } else
+            __atomic_store_n(&sp->priv->fd_mb, fd, __ATOMIC_RELEASE);
+    }
+    unlock_init(sp->priv);
+    return err;
+}
+
+static int open_mem(struct rpimemmgr *sp)
+{
+    int err = 0;
+
+    if (__atomic_load_n(&sp->priv->fd_mem, __ATOMIC_ACQUIRE) != -1)
+        return 0;
+
+    lock_init(sp->priv);
+    if (sp->priv->fd_mem == -1) {
+        /*
+         * This fd will be used only for mapping Mailbox memory, which is
+         * non-cached.  That's why we specify O_SYNC here.
+         */
+        const int fd = open("/dev/mem", O_RDWR | O_SYNC);
+        if (fd == -1) {
+            print_error("open: /dev/mem: %s\n", strerror(errno));
+            err = 1;
+        } else
+            __atomic_store_n(&sp->priv->fd_mem, fd, __ATOMIC_RELEASE);
+    }
+    unlock_init(sp->priv);
+    return err;
+}
+
+static int open_drm(struct rpimemmgr *sp)
+{
+    int err = 0;
+
+    if (__atomic_load_n(&sp->priv->drm.fd, __ATOMIC_ACQUIRE) != -1)
+        return 0;
+
+    lock_init(sp->priv);
+    if (sp->priv->drm.fd == -1) {
+        const int fd = drmOpen("v3d", NULL);
+        if (fd == -1) {
+            print_error("Failed to open DRM device\n");
+            err = -1;
+        } else
+            __atomic_store_n(&sp->priv->drm.fd, fd, __ATOMIC_RELEASE);
+    }
+    unlock_init(sp->priv);
+    return err;
+}
+
+static int open_heap(const enum rpimemmgr_dma_heap heap,
+        struct rpimemmgr *sp)
+{
+    int err = 0;
+
+    if ((unsigned) heap >= N_DMA_HEAPS) {
+        print_error("Unknown dma-heap: %d\n", heap);
+        return 1;
+    }
+    if (__atomic_load_n(&sp->priv->fd_heaps[heap], __ATOMIC_ACQUIRE) != -1)
+        return 0;
+
+    lock_init(sp->priv);
+    if (sp->priv->fd_heaps[heap] == -1) {
+        const int fd = open_dma_heap(dma_heap_names[heap]);
+        if (fd == -1) {
+            print_error("Failed to open dma-heap\n");
+            err = -1;
+        } else
+            __atomic_store_n(&sp->priv->fd_heaps[heap], fd, __ATOMIC_RELEASE);
+    }
+    unlock_init(sp->priv);
+    return err;
+}
+
+static int init_vcsm(struct rpimemmgr *sp)
+{
+    int err = 0;
+
+    if (__atomic_load_n(&sp->priv->is_vcsm_inited, __ATOMIC_ACQUIRE))
+        return 0;
+
+    lock_init(sp->priv);
+    if (!sp->priv->is_vcsm_inited) {
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+        err = vcsm_init_ex(sp->vcsm_use_cma, sp->vcsm_fd);
+#else
+        err = vcsm_init();
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
+        if (err)
+            print_error("Failed to initialize VCSM\n");
+        else
+            __atomic_store_n(&sp->priv->is_vcsm_inited, true,
+                    __ATOMIC_RELEASE);
+    }
+    unlock_init(sp->priv);
+    return err;
+}
+
+static int sync_drm(struct mem_elem *ep, const enum rpimemmgr_cache_op op,
+        struct rpimemmgr *sp)
+{
+    int fd = __atomic_load_n(&ep->dmabuf_fd, __ATOMIC_ACQUIRE);
+
+    if (fd == -1) {
+        int expected = -1;
+
+        if (export_mem_drm(&sp->priv->drm, ep->handle, &fd))
+            return 1;
+        if (!__atomic_compare_exchange_n(&ep->dmabuf_fd, &expected, fd,
+                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            /* Another thread has exported it in the meantime. */
+            (void) close(fd);
+            fd = expected;
+        }
+    }
+
+    return sync_mem_dmabuf(fd, op);
+}
+
+/*
+ * Backends.  Each entry of backend_ops wraps the functions of one backend
+ * file, picking its fds and state out of priv.  A new backend needs a
+ * mem_elem_type, an entry here and an RPIMEMMGR_BACKEND_* at the same index.
+ */
+
+static bool is_uncached_always(const uint32_t flags)
+{
+    (void) flags;
+    return true;
+}
+
+static int ops_dmabuf_sync(struct mem_elem *ep,
+        const struct rpimemmgr_cache_op_desc *dp, struct cache_op_buf *bp,
+        struct rpimemmgr *sp)
+{
+    (void) bp;
+    (void) sp;
+    return sync_mem_dmabuf(ep->handle, dp->op);
+}
+
+static int ops_vcsm_open(const uint32_t flags, const bool do_mapping,
+        struct rpimemmgr *sp)
+{
+    (void) flags;
+    (void) do_mapping;
+    return init_vcsm(sp);
+}
+
+static int ops_vcsm_alloc(const size_t size, const size_t align,
+        const uint32_t flags, uint32_t *handlep, uint32_t *busaddrp,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    (void) sp;
+    return alloc_mem_vcsm(size, align, flags, handlep, busaddrp, usraddrp);
+}
+
+static int ops_vcsm_free(const size_t size, const uint32_t handle,
+        const uint32_t busaddr, void *usraddr, struct rpimemmgr *sp)
+{
+    (void) size;
+    (void) busaddr;
+    (void) sp;
+    return free_mem_vcsm(handle, usraddr);
+}
+
+/* Ranges of VCSM memory are merged and issued in as few ioctls as possible. */
+static int ops_vcsm_sync(struct mem_elem *ep,
+        const struct rpimemmgr_cache_op_desc *dp, struct cache_op_buf *bp,
+        struct rpimemmgr *sp)
+{
+    (void) sp;
+    return cache_op_buf_add(bp, dp, ep);
+}
+
+static int ops_vcsm_export(const struct mem_elem *ep, int *dmabuf_fdp,
+        struct rpimemmgr *sp)
+{
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+    if (sp->vcsm_use_cma)
+        return export_mem_vcsm(ep->handle, dmabuf_fdp);
+#else
+    (void) ep;
+    (void) dmabuf_fdp;
+    (void) sp;
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
+    print_error("VCSM memory can be exported only with CMA\n");
+    return 1;
+}
+
+static bool ops_vcsm_is_uncached(const uint32_t flags)
+{
+    return flags == VCSM_CACHE_TYPE_NONE || flags == VCSM_CACHE_TYPE_VC;
+}
+
+/*
+ * The fds are kept open on failure: other allocations (and pool chunks) may
+ * still need them.  They are closed in rpimemmgr_finalize().
+ */
+static int ops_mailbox_open(const uint32_t flags, const bool do_mapping,
+        struct rpimemmgr *sp)
+{
+    (void) flags;
+    if (open_mailbox(sp))
+        return 1;
+    return do_mapping ? open_mem(sp) : 0;
+}
+
+/* ALLOCATE_MEMORY and LOCK_MEMORY, or UNLOCK_MEMORY and RELEASE_MEMORY. */
+#define MAILBOX_MSGS_PER_BUF 2
+
+static int ops_mailbox_alloc(const size_t size, const size_t align,
+        const uint32_t flags, uint32_t *handlep, uint32_t *busaddrp,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    count(&sp->priv->stats.n_mailbox_msgs, MAILBOX_MSGS_PER_BUF, sp);
+    return alloc_mem_mailbox(sp->priv->fd_mb, sp->priv->fd_mem,
+            &sp->priv->caps, size, align, flags, handlep, busaddrp,
+            usraddrp);
+}
+
+static int ops_mailbox_alloc_batch(const size_t n, struct mem_req *reqs,
+        const bool do_mapping, struct rpimemmgr *sp)
+{
+    size_t i, n_new = 0;
+
+    for (i = 0; i < n; i ++)
+        if (!reqs[i].is_done)
+            n_new ++;
+    /* The same two messages, each for up to MAILBOX_BATCH_MAX buffers. */
+    count(&sp->priv->stats.n_mailbox_msgs, MAILBOX_MSGS_PER_BUF
+            * ((n_new + MAILBOX_BATCH_MAX - 1) / MAILBOX_BATCH_MAX), sp);
+    return alloc_mem_mailbox_batch(sp->priv->fd_mb, sp->priv->fd_mem,
+            &sp->priv->caps, n, reqs, do_mapping);
+}
+
+static int ops_mailbox_free(const size_t size, const uint32_t handle,
+        const uint32_t busaddr, void *usraddr, struct rpimemmgr *sp)
+{
+    count(&sp->priv->stats.n_mailbox_msgs, MAILBOX_MSGS_PER_BUF, sp);
+    return free_mem_mailbox(sp->priv->fd_mb, size, handle, busaddr,
+            usraddr);
+}
+
+/* Zeroed memory must come from the firmware, not from the cache. */
+static bool ops_mailbox_is_recyclable(const uint32_t flags)
+{
+    return !(flags & MEM_FLAG_ZERO);
+}
+
+static int ops_drm_open(const uint32_t flags, const bool do_mapping,
+        struct rpimemmgr *sp)
+{
+    (void) flags;
+    (void) do_mapping;
+    return open_drm(sp);
+}
+
+static int ops_drm_alloc(const size_t size, const size_t align,
+        const uint32_t flags, uint32_t *handlep, uint32_t *busaddrp,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    (void) align;
+    (void) flags;
+    return alloc_mem_drm(&sp->priv->drm, size, handlep, busaddrp,
+            usraddrp);
+}
+
+static int ops_drm_free(const size_t size, const uint32_t handle,
+        const uint32_t busaddr, void *usraddr, struct rpimemmgr *sp)
+{
+    (void) busaddr;
+    return free_mem_drm(&sp->priv->drm, size, handle, usraddr);
+}
+
+static int ops_drm_map(const struct mem_elem *ep, void **usraddrp,
+        struct rpimemmgr *sp)
+{
+    return map_mem_drm(&sp->priv->drm, ep->size, ep->handle, usraddrp);
+}
+
+static int ops_drm_unmap(const struct mem_elem *ep, void *usraddr,
+        struct rpimemmgr *sp)
+{
+    (void) sp;
+    return unmap_mem_drm(ep->size, usraddr);
+}
+
+static int ops_drm_wait(const struct mem_elem *ep, const uint64_t timeout_ns,
+        bool *is_idlep, struct rpimemmgr *sp)
+{
+    return wait_mem_drm(&sp->priv->drm, ep->handle, timeout_ns, is_idlep);
+}
+
+static int ops_drm_sync(struct mem_elem *ep,
+        const struct rpimemmgr_cache_op_desc *dp, struct cache_op_buf *bp,
+        struct rpimemmgr *sp)
+{
+    (void) bp;
+    return sync_drm(ep, dp->op, sp);
+}
+
+static int ops_drm_export(const struct mem_elem *ep, int *dmabuf_fdp,
+        struct rpimemmgr *sp)
+{
+    return export_mem_drm(&sp->priv->drm, ep->handle, dmabuf_fdp);
+}
+
+static int ops_sim_open(const uint32_t flags, const bool do_mapping,
+        struct rpimemmgr *sp)
+{
+    int err = 0;
+
+    (void) flags;
+    (void) do_mapping;
+
+    if (__atomic_load_n(&sp->priv->sim_space, __ATOMIC_ACQUIRE) != NULL)
+        return 0;
+
+    lock_init(sp->priv);
+    if (sp->priv->sim_space == NULL) {
+        struct sim_space * const ssp = sim_space_create();
+        if (ssp == NULL)
+            err = 1;
+        else
+            __atomic_store_n(&sp->priv->sim_space, ssp, __ATOMIC_RELEASE);
+    }
+    unlock_init(sp->priv);
+    return err;
+}
+
+static int ops_sim_alloc(const size_t size, const size_t align,
+        const uint32_t flags, uint32_t *handlep, uint32_t *busaddrp,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    (void) flags;
+    sim_delay(__atomic_load_n(&sp->priv->sim_alloc_us, __ATOMIC_RELAXED));
+    return alloc_mem_sim(sp->priv->sim_space, size, align, handlep, busaddrp,
+            usraddrp);
+}
+
+static int ops_sim_free(const size_t size, const uint32_t handle,
+        const uint32_t busaddr, void *usraddr, struct rpimemmgr *sp)
+{
+    (void) handle;
+    sim_delay(__atomic_load_n(&sp->priv->sim_free_us, __ATOMIC_RELAXED));
+    return free_mem_sim(sp->priv->sim_space, size, busaddr, usraddr);
+}
+
+static int ops_dmabuf_open(const uint32_t flags, const bool do_mapping,
+        struct rpimemmgr *sp)
+{
+    (void) do_mapping;
+    return open_heap(flags, sp);
+}
+
+static int ops_dmabuf_alloc(const size_t size, const size_t align,
+        const uint32_t flags, uint32_t *handlep, uint32_t *busaddrp,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    (void) align;
+    *busaddrp = 0;
+    return alloc_mem_dma_heap(sp->priv->fd_heaps[flags], size, handlep,
+            usraddrp);
+}
+
+static int ops_dmabuf_free(const size_t size, const uint32_t handle,
+        const uint32_t busaddr, void *usraddr, struct rpimemmgr *sp)
+{
+    (void) busaddr;
+    (void) sp;
+    return free_mem_dmabuf(size, handle, usraddr);
+}
+
+static int ops_dmabuf_export(const struct mem_elem *ep, int *dmabuf_fdp,
+        struct rpimemmgr *sp)
+{
+    (void) sp;
+    return export_mem_dmabuf(ep->handle, dmabuf_fdp);
+}
+
+static const struct mem_ops backend_ops[N_MEM_TYPES] = {
+    [MEM_TYPE_VCSM] = {
+        .name = "VCSM",
+        .has_busaddr = true,
+        .has_flags = true,
+        .open = ops_vcsm_open,
+        .alloc = ops_vcsm_alloc,
+        .free = ops_vcsm_free,
+        .sync = ops_vcsm_sync,
+        .export = ops_vcsm_export,
+        .is_uncached = ops_vcsm_is_uncached,
+    },
+    /* /dev/mem is opened with O_SYNC, so there is nothing to sync. */
+    [MEM_TYPE_MAILBOX] = {
+        .name = "Mailbox",
+        .has_busaddr = true,
+        .has_flags = true,
+        .is_mapping_optional = true,
+        .is_windowed = true,
+        .open = ops_mailbox_open,
+        .alloc = ops_mailbox_alloc,
+        .alloc_batch = ops_mailbox_alloc_batch,
+        .free = ops_mailbox_free,
+        .is_uncached = is_uncached_always,
+        .is_recyclable = ops_mailbox_is_recyclable,
+    },
+    /* V3D maps BOs write-combined. */
+    [MEM_TYPE_DRM] = {
+        .name = "DRM",
+        .has_busaddr = true,
+        .is_mapping_optional = true,
+        .is_sync_whole = true,
+        .open = ops_drm_open,
+        .alloc = ops_drm_alloc,
+        .free = ops_drm_free,
+        .map = ops_drm_map,
+        .unmap = ops_drm_unmap,
+        .wait = ops_drm_wait,
+        .sync = ops_drm_sync,
+        .export = ops_drm_export,
+        .is_uncached = is_uncached_always,
+    },
+    /*
+     * Never touched by a device, so there is nothing to sync, but it stands
+     * in for GPU memory in the choice of copy kernels.
+     */
+    [MEM_TYPE_SIM] = {
+        .name = "Simulated",
+        .has_busaddr = true,
+        .open = ops_sim_open,
+        .alloc = ops_sim_alloc,
+        .free = ops_sim_free,
+        .is_uncached = is_uncached_always,
+    },
+    /*
+     * alloc is dma-heap allocation, with the heap as flags.  Imported
+     * dma-bufs share free, sync and export but come from
+     * rpimemmgr_import_dmabuf() instead of alloc.
+     */
+    [MEM_TYPE_DMABUF] = {
+        .name = "dma-buf",
+        .has_flags = true,
+        .is_sync_whole = true,
+        .open = ops_dmabuf_open,
+        .alloc = ops_dmabuf_alloc,
+        .free = ops_dmabuf_free,
+        .sync = ops_dmabuf_sync,
+        .export = ops_dmabuf_export,
+    },
+};
+
+static const struct mem_ops* get_ops(const enum mem_elem_type type)
+{
+    return &backend_ops[type];
+}
+
+static void print_stats(FILE *fp, const struct rpimemmgr_stats *statsp)
+{
+    const char *names[RPIMEMMGR_N_BACKENDS];
+    unsigned i;
+
+    for (i = 0; i < RPIMEMMGR_N_BACKENDS; i ++)
+        names[i] = backend_ops[i].name;
+    stats_print(fp, statsp, names);
+}
+
+int rpimemmgr_init(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_priv *priv;
+    size_t i;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    priv = malloc(sizeof(*priv));
+    if (priv == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return 1;
+    }
+
+    priv->is_thread_safe = false;
+    priv->tcaches = NULL;
+    priv->is_vcsm_inited = 0;
+    priv->fd_mb = -1;
+    priv->fd_mem = -1;
+    priv->drm.fd = -1;
+    priv->drm.ioctl = drmIoctl;
+    for (i = 0; i < N_DMA_HEAPS; i ++)
+        priv->fd_heaps[i] = -1;
+    index_init(&priv->busaddr_index);
+    index_init(&priv->usraddr_index);
+    priv->pool_chunk_size = 0;
+    priv->pool_max_size = 0;
+    priv->mailbox_window_size = 0;
+    priv->pools = NULL;
+    recycle_init(&priv->recycle);
+    priv->sim_space = NULL;
+    priv->sim_alloc_us = priv->sim_free_us = 0;
+    memset(&priv->stats, 0, sizeof(priv->stats));
+    priv->shm_stats = NULL;
+    priv->sync_max_gap = SYNC_GAP_DEFAULT;
+    priv->xfer = NULL;
+    priv->deferred = NULL;
+    priv->release = NULL;
+    sp->priv = priv;
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+    sp->vcsm_use_cma = 0;
+    sp->vcsm_fd = -1;
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
+    return 0;
+}
+
+int rpimemmgr_enable_thread_safety(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_priv *priv;
+    pthread_rwlockattr_t attr;
+    int err;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+    priv = sp->priv;
+
+    if (priv->is_thread_safe)
+        return 0;
+
+    err = pthread_mutex_init(&priv->lock, NULL);
+    if (err) {
+        print_error("pthread_mutex_init: %s\n", strerror(err));
+        return 1;
+    }
+
+    err = pthread_mutex_init(&priv->init_lock, NULL);
+    if (err) {
+        print_error("pthread_mutex_init: %s\n", strerror(err));
+        goto clean_lock;
+    }
+
+    /*
+     * Translations are far more frequent than allocations, but a steady
+     * stream of them must not starve alloc and free.
+     */
+    err = pthread_rwlockattr_init(&attr);
+    if (err) {
+        print_error("pthread_rwlockattr_init: %s\n", strerror(err));
+        goto clean_init_lock;
+    }
+#ifdef __GLIBC__
+    (void) pthread_rwlockattr_setkind_np(&attr,
+            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif /* __GLIBC__ */
+    err = pthread_rwlock_init(&priv->index_lock, &attr);
+    (void) pthread_rwlockattr_destroy(&attr);
+    if (err) {
+        print_error("pthread_rwlock_init: %s\n", strerror(err));
+        goto clean_init_lock;
+    }
+
+    err = pthread_key_create(&priv->tcache_key, tcache_exit);
+    if (err) {
+        print_error("pthread_key_create: %s\n", strerror(err));
+        goto clean_index_lock;
+    }
+
+    priv->is_thread_safe = true;
+    return 0;
+
+clean_index_lock:
+    (void) pthread_rwlock_destroy(&priv->index_lock);
+clean_init_lock:
+    (void) pthread_mutex_destroy(&priv->init_lock);
+clean_lock:
+    (void) pthread_mutex_destroy(&priv->lock);
+    return 1;
+}
+
+int rpimemmgr_finalize(struct rpimemmgr *sp)
+{
+    size_t i;
+    int err, err_sum = 0;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    /* The publisher walks the pools; stop it before they go. */
+    if (sp->priv->shm_stats != NULL)
+        shm_stats_destroy(sp->priv->shm_stats);
+
+    /* Pending transfers still touch the buffers; finish them first. */
+    if (sp->priv->xfer != NULL)
+        xfer_destroy(sp->priv->xfer);
+
+    /* Free the rest synchronously after the queued releases. */
+    if (sp->priv->release != NULL) {
+        err = release_destroy(sp->priv->release);
+        sp->priv->release = NULL;
+        if (err) {
+            err_sum = err;
+            /* Continue finalization. */
+        }
+    }
+
+    if (sp->priv->is_thread_safe) {
+        /*
+         * Other threads must be done with sp by now.  Their caches are
+         * freed here; the key is deleted first so that the destructors of
+         * threads exiting later do not touch them.
+         */
+        (void) pthread_key_delete(sp->priv->tcache_key);
+        drain_all_tcaches(sp);
+    }
+
+    /* Return everything to the backends from here on. */
+    sp->priv->recycle.max_bytes = 0;
+
+    err = reap_deferred(true, true, sp);
+    if (err) {
+        err_sum = err;
+        /* Continue finalization. */
+    }
+
+    err = free_all_elems(sp);
+    if (err) {
+        err_sum = err;
+        /* Continue finalization. */
+    }
+
+    err = free_all_pools(sp);
+    if (err) {
+        err_sum = err;
+        /* Continue finalization. */
+    }
+
+    err = trim_recycle(0, sp);
+    if (err) {
+        err_sum = err;
+        /* Continue finalization. */
+    }
+
+    if (sp->priv->is_vcsm_inited)
+        vcsm_exit();
+
+    if (sp->priv->fd_mb != -1) {
+        err = mailbox_close(sp->priv->fd_mb);
+        if (err) {
+            print_error("Failed to close Mailbox\n");
+            err_sum = err;
+            /* Continue finalization. */
+        }
+    }
+
+    if (sp->priv->fd_mem != -1) {
+        err = close(sp->priv->fd_mem);
+        if (err) {
+            print_error("close: %s\n", strerror(errno));
+            err_sum = err;
+            /* Continue finalization. */
+        }
+    }
+
+    if (sp->priv->drm.fd != -1) {
+        err = close(sp->priv->drm.fd);
+        if (err) {
+            print_error("close: %s\n", strerror(errno));
+            err_sum = err;
+            /* Continue finalization. */
+        }
+    }
+
+    for (i = 0; i < N_DMA_HEAPS; i ++) {
+        if (sp->priv->fd_heaps[i] == -1)
+            continue;
+        err = close(sp->priv->fd_heaps[i]);
+        if (err) {
+            print_error("close: %s\n", strerror(errno));
+            err_sum = err;
+            /* Continue finalization. */
+        }
+    }
+
+    if (sp->priv->is_thread_safe) {
+        (void) pthread_rwlock_destroy(&sp->priv->index_lock);
+        (void) pthread_mutex_destroy(&sp->priv->init_lock);
+        (void) pthread_mutex_destroy(&sp->priv->lock);
+    }
+
+    /* Everything is released by now, so live figures show leaks. */
+    if (is_env_set("RPIMEMMGR_STATS"))
+        print_stats(stderr, &sp->priv->stats);
+
+    sim_space_destroy(sp->priv->sim_space);
+    index_destroy(&sp->priv->busaddr_index);
+    index_destroy(&sp->priv->usraddr_index);
+    free(sp->priv);
+    return err_sum;
+}
+
+int rpimemmgr_get_processor(struct rpimemmgr *sp) {
+    if (open_mailbox(sp))
+        return -1;
+
+    return sp->priv->caps.processor;
+}
+
+int rpimemmgr_get_caps(struct rpimemmgr_caps *capsp, struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    if (open_mailbox(sp))
+        return 1;
+
+    *capsp = sp->priv->caps;
+    return 0;
+}
+
+/* Opens the backend and allocates; see struct mem_ops for the mapping. */
+static int alloc_by_type(const enum mem_elem_type type, const size_t size,
+        const size_t align, const uint32_t flags, void **usraddrp,
+        uint32_t *busaddrp, struct rpimemmgr *sp)
+{
+    const struct mem_ops * const ops = get_ops(type);
+    const bool do_mapping = !ops->is_mapping_optional || usraddrp != NULL;
+    int err;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+    /* Without a bus address, an unmapped buffer is unreachable. */
+    if (!ops->has_busaddr && usraddrp == NULL) {
+        print_error("usraddrp is NULL\n");
+        return 1;
+    }
+
+    err = ops->open(flags, do_mapping, sp);
+    if (err)
+        return err;
+
+    return alloc_and_register(type, size, align, flags, do_mapping, usraddrp,
+            busaddrp, sp);
+}
+
+int rpimemmgr_alloc_vcsm(const size_t size, const size_t align,
+        const VCSM_CACHE_TYPE_T cache_type, void **usraddrp, uint32_t *busaddrp,
+        struct rpimemmgr *sp)
+{
+    return alloc_by_type(MEM_TYPE_VCSM, size, align, cache_type, usraddrp,
+            busaddrp, sp);
+}
+
+int rpimemmgr_alloc_mailbox(const size_t size, const size_t align,
+        const uint32_t flags, void **usraddrp, uint32_t *busaddrp,
+        struct rpimemmgr *sp)
+{
+    return alloc_by_type(MEM_TYPE_MAILBOX, size, align, flags, usraddrp,
+            busaddrp, sp);
+}
+
+int rpimemmgr_alloc_drm(const size_t size, void **usraddrp, uint32_t *busaddrp, struct rpimemmgr *sp)
+{
+    return alloc_by_type(MEM_TYPE_DRM, size, 0, 0, usraddrp, busaddrp, sp);
+}
+
+int rpimemmgr_alloc_dma_heap(const size_t size,
+        const enum rpimemmgr_dma_heap heap, void **usraddrp,
+        struct rpimemmgr *sp)
+{
+    return alloc_by_type(MEM_TYPE_DMABUF, size, 0, heap, usraddrp, NULL, sp);
+}
+
+int rpimemmgr_alloc_sim(const size_t size, const size_t align,
+        void **usraddrp, uint32_t *busaddrp, struct rpimemmgr *sp)
+{
+    return alloc_by_type(MEM_TYPE_SIM, size, align, 0, usraddrp, busaddrp,
+            sp);
+}
+
+int rpimemmgr_set_sim_latency(const unsigned alloc_us, const unsigned free_us,
+        struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    __atomic_store_n(&sp->priv->sim_alloc_us, alloc_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&sp->priv->sim_free_us, free_us, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int rpimemmgr_alloc_batch(const enum rpimemmgr_backend backend,
+        const size_t n, const struct rpimemmgr_alloc_desc * const descs,
+        void **usraddrs, uint32_t *busaddrs, struct rpimemmgr *sp)
+{
+    enum mem_elem_type type;
+    const struct mem_ops *ops;
+    bool do_mapping;
+    size_t i;
+    int err = 0;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    if (n == 0)
+        return 0;
+    if (descs == NULL) {
+        print_error("descs is NULL\n");
+        return 1;
+    }
+    if ((unsigned) backend >= N_MEM_TYPES) {
+        print_error("Unknown backend: %d\n", backend);
+        return 1;
+    }
+
+    type = (enum mem_elem_type) backend;
+    ops = get_ops(type);
+    do_mapping = !ops->is_mapping_optional || usraddrs != NULL;
+    if (!ops->has_busaddr && usraddrs == NULL) {
+        print_error("usraddrs is NULL\n");
+        return 1;
+    }
+
+    /* Only dma-heaps differ by flags; the others are open after the first. */
+    for (i = 0; i < n && !err; i ++)
+        err = ops->open(ops->has_flags ? descs[i].flags : 0, do_mapping, sp);
+    if (err)
+        return err;
+
+    return alloc_batch(type, n, descs, do_mapping, usraddrs, busaddrs, sp);
+}
+
+int rpimemmgr_set_pool(const size_t chunk_size, const size_t max_size,
+        struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    if (max_size != 0) {
+        if (chunk_size == 0 || chunk_size % POOL_CHUNK_ALIGN != 0) {
+            print_error("chunk_size must be a non-zero multiple of %d\n",
+                    POOL_CHUNK_ALIGN);
+            return 1;
+        }
+        if (max_size < POOL_MIN_BLOCK_SIZE || max_size > chunk_size) {
+            print_error("max_size must be in [%d, chunk_size]\n",
+                    POOL_MIN_BLOCK_SIZE);
+            return 1;
+        }
+    }
+
+    lock_priv(sp->priv);
+    __atomic_store_n(&sp->priv->pool_chunk_size, chunk_size,
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&sp->priv->pool_max_size, max_size, __ATOMIC_RELAXED);
+    unlock_priv(sp->priv);
+    return 0;
+}
+
+int rpimemmgr_set_mailbox_window(const size_t window_size,
+        struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    if (window_size % POOL_CHUNK_ALIGN != 0) {
+        print_error("window_size must be a multiple of %d\n",
+                POOL_CHUNK_ALIGN);
+        return 1;
+    }
+
+    __atomic_store_n(&sp->priv->mailbox_window_size, window_size,
+            __ATOMIC_RELAXED);
+    return 0;
+}
+
+int rpimemmgr_set_recycle(const size_t max_bytes, const unsigned max_age_ms,
+        struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    lock_priv(sp->priv);
+    __atomic_store_n(&sp->priv->recycle.max_bytes, max_bytes,
+            __ATOMIC_RELAXED);
+    sp->priv->recycle.max_age_ns = (uint64_t) max_age_ms * 1000000;
+    unlock_priv(sp->priv);
+    return trim_recycle(max_bytes, sp);
+}
+
+int rpimemmgr_trim_recycle(const size_t max_bytes, struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    return trim_recycle(max_bytes, sp);
+}
+
+int rpimemmgr_free_by_busaddr(const uint32_t busaddr, struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    reap_deferred_if_any(sp);
+
+    ep = find_elem(&sp->priv->busaddr_index, busaddr, sp);
+    if (ep == NULL) {
+        print_error("No such mem_elem: busaddr=0x%08x\n", busaddr);
+        return 1;
+    }
+
+    return free_elem(ep, sp);
+}
+
+int rpimemmgr_free_by_usraddr(void * const usraddr, struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    reap_deferred_if_any(sp);
+
+    ep = find_elem(&sp->priv->usraddr_index, (uintptr_t) usraddr, sp);
+    if (ep == NULL) {
+        print_error("No such mem_elem: usraddr=%p\n", usraddr);
+        return 1;
+    }
+
+    return free_elem(ep, sp);
+}
+
+static int free_deferred(struct mem_elem *ep, struct rpimemmgr *sp)
+{
+    struct release_queue *release;
+
+    if (get_ops(ep->type)->wait == NULL) {
+        print_error("%s memory cannot be freed deferred\n",
+                get_ops(ep->type)->name);
+        return 1;
+    }
+
+    count(&sp->priv->stats.n_frees, 1, sp);
+
+    /* Hide it from lookups until it is released. */
+    set_cached(ep, true);
+    lock_priv(sp->priv);
+    ep->deferred_next = sp->priv->deferred;
+    __atomic_store_n(&sp->priv->deferred, ep, __ATOMIC_RELAXED);
+    unlock_priv(sp->priv);
+
+    release = __atomic_load_n(&sp->priv->release, __ATOMIC_ACQUIRE);
+    if (release != NULL)
+        release_wake(release);
+    return 0;
+}
+
+int rpimemmgr_free_deferred_by_busaddr(const uint32_t busaddr,
+        struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    reap_deferred_if_any(sp);
+
+    ep = find_elem(&sp->priv->busaddr_index, busaddr, sp);
+    if (ep == NULL) {
+        print_error("No such mem_elem: busaddr=0x%08x\n", busaddr);
+        return 1;
+    }
+
+    return free_deferred(ep, sp);
+}
+
+int rpimemmgr_free_deferred_by_usraddr(void * const usraddr,
+        struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    reap_deferred_if_any(sp);
+
+    ep = find_elem(&sp->priv->usraddr_index, (uintptr_t) usraddr, sp);
+    if (ep == NULL) {
+        print_error("No such mem_elem: usraddr=%p\n", usraddr);
+        return 1;
+    }
+
+    return free_deferred(ep, sp);
+}
+
+int rpimemmgr_reap_deferred(const bool do_wait, struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    return reap_deferred(do_wait, false, sp);
+}
+
+static int run_release(struct release_job * const jp, void * const arg)
+{
+    struct mem_elem * const ep = (struct mem_elem*) ((char*) jp
+            - offsetof(struct mem_elem, release_job));
+
+    return finish_release(ep, arg);
+}
+
+/* The release thread also polls the deferred buffers while there are any. */
+static bool idle_release(void * const arg)
+{
+    struct rpimemmgr * const sp = arg;
+
+    reap_deferred_if_any(sp);
+    return __atomic_load_n(&sp->priv->deferred, __ATOMIC_RELAXED) != NULL;
+}
+
+int rpimemmgr_start_release_thread(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_priv *priv;
+    int err = 0;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+    priv = sp->priv;
+
+    if (!priv->is_thread_safe) {
+        print_error("Call rpimemmgr_enable_thread_safety() first\n");
+        return 1;
+    }
+
+    lock_priv(priv);
+    if (priv->release != NULL) {
+        print_error("Release thread is already started\n");
+        err = 1;
+    } else {
+        struct release_queue * const qp = release_create(run_release,
+                idle_release, sp);
+        if (qp == NULL)
+            err = 1;
+        else
+            __atomic_store_n(&priv->release, qp, __ATOMIC_RELEASE);
+    }
+    unlock_priv(priv);
+    return err;
+}
+
+int rpimemmgr_flush_releases(struct rpimemmgr *sp)
+{
+    struct release_queue *qp;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    qp = __atomic_load_n(&sp->priv->release, __ATOMIC_ACQUIRE);
+    return qp != NULL ? release_flush(qp) : 0;
+}
+
+int rpimemmgr_get_release_eventfd(struct rpimemmgr *sp)
+{
+    struct release_queue *qp;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return -1;
+    }
+
+    qp = __atomic_load_n(&sp->priv->release, __ATOMIC_ACQUIRE);
+    if (qp == NULL) {
+        print_error("Release thread is not started\n");
+        return -1;
+    }
+    return release_eventfd(qp);
+}
+
+/* Only whole DRM buffers can be mapped and unmapped after allocation. */
+static struct mem_elem* find_lazy_elem(const uint32_t busaddr,
+        struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    ep = find_elem(&sp->priv->busaddr_index, busaddr, sp);
+    if (ep == NULL) {
+        print_error("No such mem_elem: busaddr=0x%08x\n", busaddr);
+        return NULL;
+    }
+    if (get_ops(ep->type)->map == NULL || ep->chunk != NULL) {
+        print_error("busaddr=0x%08x is not a mappable buffer of its own\n",
+                busaddr);
+        return NULL;
+    }
+    return ep;
+}
+
+int rpimemmgr_map_by_busaddr(const uint32_t busaddr, void **usraddrp,
+        struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+    void *usraddr;
+    bool is_raced = false;
+    int err;
+
+    if (sp == NULL || usraddrp == NULL) {
+        print_error("sp or usraddrp is NULL\n");
+        return 1;
+    }
+
+    ep = find_lazy_elem(busaddr, sp);
+    if (ep == NULL)
+        return 1;
+
+    rdlock_index(sp->priv);
+    usraddr = (void*) ep->usraddr;
+    unlock_index(sp->priv);
+    if (usraddr != NULL) {
+        *usraddrp = usraddr;
+        return 0;
+    }
+
+    err = get_ops(ep->type)->map(ep, &usraddr, sp);
+    if (err)
+        return err;
+
+    wrlock_index(sp->priv);
+    if (ep->usraddr != NULL)
+        is_raced = true;
+    else if (index_insert(&sp->priv->usraddr_index, (uintptr_t) usraddr,
+                ep->size, ep)) {
+        print_error("Duplicate usraddr (internal error)\n");
+        err = 1;
+    } else
+        ep->usraddr = usraddr;
+    unlock_index(sp->priv);
+
+    /* Another thread mapped it first; use that mapping. */
+    if (is_raced || err) {
+        (void) get_ops(ep->type)->unmap(ep, usraddr, sp);
+        usraddr = (void*) ep->usraddr;
+    }
+    if (!err)
+        *usraddrp = usraddr;
+    return err;
+}
+
+int rpimemmgr_unmap_by_busaddr(const uint32_t busaddr, struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+    void *usraddr;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    ep = find_lazy_elem(busaddr, sp);
+    if (ep == NULL)
+        return 1;
+
+    wrlock_index(sp->priv);
+    usraddr = (void*) ep->usraddr;
+    if (usraddr != NULL) {
+        (void) index_remove(&sp->priv->usraddr_index, (uintptr_t) usraddr);
+        ep->usraddr = NULL;
+    }
+    unlock_index(sp->priv);
+
+    if (usraddr == NULL)
+        return 0;
+    return get_ops(ep->type)->unmap(ep, usraddr, sp);
+}
+
+/*
+ * Whether a buffer starting at busaddr is registered.  Importing a buffer of
+ * our own yields its bus address and, for DRM, its very GEM handle.
+ */
+static bool is_registered_busaddr(const uint32_t busaddr,
+        struct rpimemmgr *sp)
+{
+    bool found;
+
+    rdlock_index(sp->priv);
+    found = index_find(&sp->priv->busaddr_index, busaddr) != NULL;
+    unlock_index(sp->priv);
+    return found;
+}
+
+int rpimemmgr_import_dmabuf(const enum rpimemmgr_backend backend,
+        const int dmabuf_fd, size_t *sizep, void **usraddrp,
+        uint32_t *busaddrp, struct rpimemmgr *sp)
+{
+    enum mem_elem_type type;
+    uint32_t flags, handle, busaddr = 0;
+    void *usraddr = NULL;
+    size_t size;
+    int err;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    err = get_dmabuf_size(dmabuf_fd, &size);
+    if (err)
+        return err;
+
+    switch (backend) {
+        case RPIMEMMGR_BACKEND_DRM:
+            type = MEM_TYPE_DRM;
+            err = open_drm(sp);
+            err = err ? err
+                    : import_mem_drm(&sp->priv->drm, dmabuf_fd, &handle,
+                            &busaddr);
+            /* The handle belongs to the registered BO; leave it open. */
+            if (!err && is_registered_busaddr(busaddr, sp)) {
+                print_error("dma-buf is already registered: busaddr=0x%08x\n",
+                        busaddr);
+                return 1;
+            }
+            if (!err && usraddrp != NULL && map_mem_drm(&sp->priv->drm,
+                        size, handle, &usraddr)) {
+                (void) free_mem_drm(&sp->priv->drm, size, handle, NULL);
+                err = 1;
+            }
+            break;
+        case RPIMEMMGR_BACKEND_VCSM:
+            type = MEM_TYPE_VCSM;
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+            err = init_vcsm(sp);
+            err = err ? err
+                    : import_mem_vcsm(dmabuf_fd, &handle, &busaddr, &usraddr);
+#else
+            print_error("VCSM cannot import dma-bufs\n");
+            err = 1;
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
+            break;
+        case RPIMEMMGR_BACKEND_DMABUF:
+            type = MEM_TYPE_DMABUF;
+            if (usraddrp == NULL) {
+                print_error("usraddrp is NULL\n");
+                return 1;
+            }
+            err = import_mem_dmabuf(dmabuf_fd, size, &handle, &usraddr);
+            break;
+        default:
+            print_error("Backend %d cannot import dma-bufs\n", backend);
+            return 1;
+    }
+    if (err)
+        return err;
+
+    /* Cached like VCSM memory of type HOST; it is the exporter's memory. */
+    flags = type == MEM_TYPE_VCSM ? VCSM_CACHE_TYPE_HOST : 0;
+    if (busaddr != 0 && is_registered_busaddr(busaddr, sp)) {
+        print_error("dma-buf is already registered: busaddr=0x%08x\n",
+                busaddr);
+        (void) get_ops(type)->free(size, handle, busaddr, usraddr, sp);
+        return 1;
+    }
+    /* Held from the backend like allocated memory until it is freed. */
+    count_alloc(type, 1, size, is_uncached_type(type, flags) ? size : 0, sp);
+
+    err = register_mem(type, size, flags, handle, busaddr, usraddr, NULL,
+            true, sp);
+    if (err) {
+        (void) free_mem(type, size, flags, handle, busaddr, usraddr, sp);
+        return err;
+    }
+
+    if (sizep != NULL)
+        *sizep = size;
+    if (usraddrp != NULL)
+        *usraddrp = usraddr;
+    if (busaddrp != NULL)
+        *busaddrp = busaddr;
+    return 0;
+}
+
+/* Exported buffers go back to the backend when freed, never to recycle. */
+static int export_elem(struct mem_elem * const ep, int *dmabuf_fdp,
+        struct rpimemmgr *sp)
+{
+    int err;
+
+    if (dmabuf_fdp == NULL) {
+        print_error("dmabuf_fdp is NULL\n");
+        return 1;
+    }
+    if (ep->chunk != NULL) {
+        print_error("Pooled blocks cannot be exported\n");
+        return 1;
+    }
+
+    if (get_ops(ep->type)->export == NULL) {
+        print_error("%s memory cannot be exported\n",
+                get_ops(ep->type)->name);
+        return 1;
+    }
+    err = get_ops(ep->type)->export(ep, dmabuf_fdp, sp);
+    if (!err)
+        __atomic_store_n(&ep->is_exported, true, __ATOMIC_RELAXED);
+    return err;
+}
+
+int rpimemmgr_export_dmabuf_by_busaddr(const uint32_t busaddr,
+        int *dmabuf_fdp, struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    ep = find_elem(&sp->priv->busaddr_index, busaddr, sp);
+    if (ep == NULL) {
+        print_error("No such mem_elem: busaddr=0x%08x\n", busaddr);
+        return 1;
+    }
+
+    return export_elem(ep, dmabuf_fdp, sp);
+}
+
+int rpimemmgr_export_dmabuf_by_usraddr(const void * const usraddr,
+        int *dmabuf_fdp, struct rpimemmgr *sp)
+{
+    struct mem_elem *ep;
+
+    ep = find_elem(&sp->priv->usraddr_index, (uintptr_t) usraddr, sp);
+    if (ep == NULL) {
+        print_error("No such mem_elem: usraddr=%p\n", usraddr);
+        return 1;
+    }
+
+    return export_elem(ep, dmabuf_fdp, sp);
+}
+
+uint32_t rpimemmgr_usraddr_to_busaddr(const void * const usraddr,
+        struct rpimemmgr *sp)
+{
+    const struct index_entry *found;
+    uint32_t busaddr = 0;
+    bool is_found = false;
+
+    count_hot(n_lookups, 1, sp);
+
+    rdlock_index(sp->priv);
+    found = index_find_range(&sp->priv->usraddr_index, (uintptr_t) usraddr);
+    if (found != NULL && !is_cached(found->value)) {
+        const struct mem_elem * const node = found->value;
+        is_found = true;
+        /* Imported dma-bufs may have none. */
+        if (node->busaddr != 0)
+            busaddr = node->busaddr + ((uintptr_t) usraddr - found->key);
+    }
+    unlock_index(sp->priv);
+
+    if (!is_found)
+        print_error("usraddr=%p is not found\n", usraddr);
+    else if (busaddr == 0)
+        print_error("usraddr=%p has no bus address\n", usraddr);
+    return busaddr;
+}
+
+uint32_t rpimemmgr_usraddr_to_handle(const void * const usraddr,
+        struct rpimemmgr *sp)
+{
+    const struct index_entry *found;
+    uint32_t handle = 0;
+    bool is_found = false;
+
+    count_hot(n_lookups, 1, sp);
+
+    rdlock_index(sp->priv);
+    found = index_find_range(&sp->priv->usraddr_index, (uintptr_t) usraddr);
+    if (found != NULL && !is_cached(found->value)) {
+        const struct mem_elem * const node = found->value;
+        handle = node->handle;
+        is_found = true;
+    }
+    unlock_index(sp->priv);
+
+    if (!is_found)
+        print_error("usraddr=%p is not found\n", usraddr);
+    return handle;
+}
+
+/*
+ * Returns the mapped mem_elem that contains the whole range [usraddr,
+ * usraddr + len), or NULL.  For a pooled block the mem_elem is the block, not
+ * its chunk.
+ */
+static struct mem_elem* find_range_elem(const void * const usraddr,
+        const size_t len, struct rpimemmgr *sp)
+{
+    const uintptr_t start = (uintptr_t) usraddr;
+    const struct index_entry *found;
+    struct mem_elem *ep = NULL;
+
+    count_hot(n_lookups, 1, sp);
+
+    rdlock_index(sp->priv);
+    found = index_find_range(&sp->priv->usraddr_index, start);
+    if (found != NULL && !is_cached(found->value)
+            && len <= found->size - (start - found->key))
+        ep = found->value;
+    unlock_index(sp->priv);
+
+    if (ep == NULL)
+        print_error("usraddr=%p size=%zu is not in a buffer\n", usraddr,
+                len);
+    return ep;
+}
+
+static struct mem_elem* find_sync_elem(
+        const struct rpimemmgr_cache_op_desc *dp, struct rpimemmgr *sp)
+{
+    return find_range_elem(dp->usraddr,
+            (dp->block_count - 1) * dp->stride + dp->block_size, sp);
+}
+
+int rpimemmgr_sync_array(const size_t n,
+        const struct rpimemmgr_cache_op_desc * const descs,
+        struct rpimemmgr *sp)
+{
+    const struct mem_elem *last_ep = NULL;
+    enum rpimemmgr_cache_op last_op = RPIMEMMGR_CACHE_OP_INVALIDATE;
+    struct cache_op_buf buf;
+    size_t i;
+    int err;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
+    }
+
+    cache_op_buf_init(&buf, __atomic_load_n(&sp->priv->sync_max_gap,
+                __ATOMIC_RELAXED));
+    for (i = 0; i < n; i ++) {
+        const struct rpimemmgr_cache_op_desc * const dp = &descs[i];
+        const struct mem_ops *ops;
+        struct mem_elem *ep;
 
-    ep_ret = tsearch(ep, &sp->priv->busaddr_based_root,
-            mem_elem_busaddr_compar);
-    if (ep_ret == NULL) {
-        print_error("Internal error in tsearch\n");
-        goto clean_ep;
-    }
-    if (*(struct mem_elem**) ep_ret != ep) {
-        print_error("Duplicate busaddr (internal error)\n");
-        goto clean_ep;
-    }
+        if (dp->block_count == 0 || dp->block_size == 0)
+            continue;
 
-    ep_ret = tsearch(ep, &sp->priv->usraddr_based_root,
-            mem_elem_usraddr_compar);
-    if (ep_ret == NULL) {
-        print_error("Internal error in tsearch\n");
-        goto clean_and_delete_ep;
+        ep = find_sync_elem(dp, sp);
+        if (ep == NULL)
+            return 1;
+
+        count_hot(n_syncs, 1, sp);
+        if (dp->op == RPIMEMMGR_CACHE_OP_CLEAN)
+            count_hot(bytes_cleaned,
+                    (uint64_t) dp->block_count * dp->block_size, sp);
+        else
+            count_hot(bytes_invalidated,
+                    (uint64_t) dp->block_count * dp->block_size, sp);
+
+        ops = get_ops(ep->type);
+        if (ops->sync == NULL)
+            continue;
+        /* A dma-buf sync covers the whole buffer; do it once. */
+        if (ops->is_sync_whole && ep == last_ep && dp->op == last_op)
+            continue;
+        err = ops->sync(ep, dp, &buf, sp);
+        if (err)
+            return err;
+        last_ep = ep;
+        last_op = dp->op;
     }
-    if (*(struct mem_elem**) ep_ret != ep) {
-        print_error("Duplicate usraddr (internal error)\n");
-        goto clean_and_delete_ep;
+
+    return cache_op_buf_flush(&buf);
+}
+
+int rpimemmgr_set_sync_gap(const size_t max_gap, struct rpimemmgr *sp)
+{
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
     }
 
+    __atomic_store_n(&sp->priv->sync_max_gap, max_gap, __ATOMIC_RELAXED);
     return 0;
+}
 
-clean_and_delete_ep:
-    node = tdelete(ep, &sp->priv->busaddr_based_root, mem_elem_busaddr_compar);
-    if (node == NULL) {
-        print_error("Node not found\n");
-        goto clean_ep;
-    }
+int rpimemmgr_sync(const enum rpimemmgr_cache_op op, void * const usraddr,
+        const size_t size, struct rpimemmgr *sp)
+{
+    const struct rpimemmgr_cache_op_desc desc = {
+        .op = op,
+        .usraddr = usraddr,
+        .block_count = 1,
+        .block_size = size,
+        .stride = 0,
+    };
 
-clean_ep:
-    free(ep);
-    return 1;
+    return rpimemmgr_sync_array(1, &desc, sp);
 }
 
-int rpimemmgr_init(struct rpimemmgr *sp)
+static bool is_uncached(const struct mem_elem * const ep)
 {
-    struct rpimemmgr_priv *priv;
+    return is_uncached_type(ep->type, ep->flags);
+}
+
+int rpimemmgr_memcpy_to(void * const dst, const void * const src,
+        const size_t size, struct rpimemmgr *sp)
+{
+    const struct mem_elem *ep;
 
     if (sp == NULL) {
         print_error("sp is NULL\n");
         return 1;
     }
+    if (size == 0)
+        return 0;
 
-    priv = malloc(sizeof(*priv));
-    if (priv == NULL) {
-        print_error("malloc: %s\n", strerror(errno));
+    ep = find_range_elem(dst, size, sp);
+    if (ep == NULL)
         return 1;
-    }
 
-    priv->is_vcsm_inited = 0;
-    priv->fd_mb = -1;
-    priv->fd_mem = -1;
-    priv->fd_drm = -1;
-    priv->busaddr_based_root = NULL;
-    priv->usraddr_based_root = NULL;
-    sp->priv = priv;
-#ifdef RPIMEMMGR_VCSM_HAS_CMA
-    sp->vcsm_use_cma = 0;
-    sp->vcsm_fd = -1;
-#endif /* RPIMEMMGR_VCSM_HAS_CMA */
+    if (is_uncached(ep))
+        stream_copy(dst, src, size);
+    else
+        (void) memcpy(dst, src, size);
     return 0;
 }
 
-int rpimemmgr_finalize(struct rpimemmgr *sp)
+int rpimemmgr_memset(void * const dst, const int c, const size_t size,
+        struct rpimemmgr *sp)
 {
-    int err, err_sum = 0;
+    const struct mem_elem *ep;
 
     if (sp == NULL) {
         print_error("sp is NULL\n");
         return 1;
     }
+    if (size == 0)
+        return 0;
 
-    err = free_all_elems(sp);
-    if (err) {
-        err_sum = err;
-        /* Continue finalization. */
-    }
-
-    if (sp->priv->is_vcsm_inited)
-        vcsm_exit();
-
-    if (sp->priv->fd_mb != -1) {
-        err = mailbox_close(sp->priv->fd_mb);
-        if (err) {
-            print_error("Failed to close Mailbox\n");
-            err_sum = err;
-            /* Continue finalization. */
-        }
-    }
-
-    if (sp->priv->fd_mem != -1) {
-        err = close(sp->priv->fd_mem);
-        if (err) {
-            print_error("close: %s\n", strerror(errno));
-            err_sum = err;
-            /* Continue finalization. */
-        }
-    }
-
-    if (sp->priv->fd_drm != -1) {
-        err = close(sp->priv->fd_drm);
-        if (err) {
-            print_error("close: %s\n", strerror(errno));
-            err_sum = err;
-            /* Continue finalization. */
-        }
-    }
+    ep = find_range_elem(dst, size, sp);
+    if (ep == NULL)
+        return 1;
 
-    free(sp->priv);
-    return err_sum;
+    if (is_uncached(ep))
+        stream_set(dst, c, size);
+    else
+        (void) memset(dst, c, size);
+    return 0;
 }
 
-int rpimemmgr_get_processor(struct rpimemmgr *sp) {
-    if (sp->priv->fd_mb == -1) {
-        const int fd = mailbox_open();
-        if (fd == -1) {
-            print_error("Failed to open Mailbox\n");
-            return -1;
-        }
-        sp->priv->fd_mb = fd;
+static int run_xfer(struct rpimemmgr_xfer * const jp, void * const arg)
+{
+    struct rpimemmgr * const sp = arg;
+    int err;
+
+    if (jp->is_upload) {
+        if (jp->use_stream)
+            stream_copy(jp->dst, jp->src, jp->size);
+        else
+            (void) memcpy(jp->dst, jp->src, jp->size);
+        return rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, jp->dst, jp->size,
+                sp);
     }
 
-    return get_processor_by_fd(sp->priv->fd_mb);
+    err = rpimemmgr_sync(RPIMEMMGR_CACHE_OP_INVALIDATE, (void*) jp->src,
+            jp->size, sp);
+    if (err)
+        return err;
+    (void) memcpy(jp->dst, jp->src, jp->size);
+    return 0;
 }
 
-int rpimemmgr_alloc_vcsm(const size_t size, const size_t align,
-        const VCSM_CACHE_TYPE_T cache_type, void **usraddrp, uint32_t *busaddrp,
+int rpimemmgr_start_xfer_workers(const unsigned n_workers,
         struct rpimemmgr *sp)
 {
-    uint32_t handle, busaddr;
-    void *usraddr;
-    int err;
+    struct rpimemmgr_priv *priv;
+    int err = 0;
 
     if (sp == NULL) {
         print_error("sp is NULL\n");
         return 1;
     }
+    priv = sp->priv;
 
-    if (!sp->priv->is_vcsm_inited) {
-#ifdef RPIMEMMGR_VCSM_HAS_CMA
-        err = vcsm_init_ex(sp->vcsm_use_cma, sp->vcsm_fd);
-#else
-        err = vcsm_init();
-#endif /* RPIMEMMGR_VCSM_HAS_CMA */
-        if (err) {
-            print_error("Failed to initialize VCSM\n");
-            return err;
-        }
-        sp->priv->is_vcsm_inited = !0;
+    if (!priv->is_thread_safe) {
+        print_error("Call rpimemmgr_enable_thread_safety() first\n");
+        return 1;
     }
-
-    err = alloc_mem_vcsm(size, align, cache_type, &handle, &busaddr, &usraddr);
-    if (err)
-        return err;
-
-    err = register_mem(MEM_TYPE_VCSM, size, handle, busaddr, usraddr, sp);
-    if (err) {
-        (void) free_mem_vcsm(handle, usraddr);
-        return err;
+    if (n_workers == 0) {
+        print_error("n_workers is zero\n");
+        return 1;
     }
 
-    if (usraddrp)
-        *usraddrp = usraddr;
-    if (busaddrp)
-        *busaddrp = busaddr;
-    return 0;
+    lock_priv(priv);
+    if (priv->xfer != NULL) {
+        print_error("Workers are already started\n");
+        err = 1;
+    } else {
+        struct xfer_queue * const qp = xfer_create(n_workers, run_xfer, sp);
+        if (qp == NULL)
+            err = 1;
+        else
+            __atomic_store_n(&priv->xfer, qp, __ATOMIC_RELEASE);
+    }
+    unlock_priv(priv);
+    return err;
 }
 
-int rpimemmgr_alloc_mailbox(const size_t size, const size_t align,
-        const uint32_t flags, void **usraddrp, uint32_t *busaddrp,
-        struct rpimemmgr *sp)
+static int submit_xfer(const bool is_upload, void * const dst,
+        const void * const src, const size_t size,
+        struct rpimemmgr_xfer ** const xferp, struct rpimemmgr *sp)
 {
-    uint32_t handle, busaddr;
-    const bool do_mapping = (usraddrp != NULL);
-    int err;
+    struct xfer_queue *qp;
+    const struct mem_elem *ep;
+    struct rpimemmgr_xfer *jp;
 
     if (sp == NULL) {
         print_error("sp is NULL\n");
         return 1;
     }
 
-    if (sp->priv->fd_mb == -1) {
-        const int fd = mailbox_open();
-        if (fd == -1) {
-            print_error("Failed to open Mailbox\n");
-            return fd;
-        }
-        sp->priv->fd_mb = fd;
+    qp = __atomic_load_n(&sp->priv->xfer, __ATOMIC_ACQUIRE);
+    if (qp == NULL) {
+        print_error("No workers; call rpimemmgr_start_xfer_workers()\n");
+        return 1;
     }
 
-    if (do_mapping && sp->priv->fd_mem == -1) {
-        /*
-         * This fd will be used only for mapping Mailbox memory, which is
-         * non-cached.  That's why we specify O_SYNC here.
-         */
-        const int fd = open("/dev/mem", O_RDWR | O_SYNC);
-        if (fd == -1) {
-            print_error("open: /dev/mem: %s\n", strerror(errno));
-            goto clean_mb;
-        }
-        sp->priv->fd_mem = fd;
+    ep = find_range_elem(is_upload ? dst : src, size, sp);
+    if (ep == NULL)
+        return 1;
+
+    jp = malloc(sizeof(*jp));
+    if (jp == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return 1;
     }
+    jp->dst = dst;
+    jp->src = src;
+    jp->size = size;
+    jp->is_upload = is_upload;
+    jp->use_stream = is_uncached(ep);
+    jp->is_detached = xferp == NULL;
+    jp->err = 0;
+
+    /*
+     * Keyed by the buffer, so that jobs on one buffer run in order.  A
+     * pooled block is a buffer of its own here.
+     */
+    xfer_submit(qp, (uintptr_t) ep->usraddr, jp);
+    if (xferp != NULL)
+        *xferp = jp;
+    return 0;
+}
 
-    err = alloc_mem_mailbox(sp->priv->fd_mb, sp->priv->fd_mem, size, align,
-            flags, &handle, &busaddr, usraddrp);
-    if (err)
-        goto clean_mem;
+int rpimemmgr_upload_async(void * const dst, const void * const src,
+        const size_t size, struct rpimemmgr_xfer ** const xferp,
+        struct rpimemmgr *sp)
+{
+    return submit_xfer(true, dst, src, size, xferp, sp);
+}
 
-    err = register_mem(MEM_TYPE_MAILBOX, size, handle, busaddr,
-            usraddrp != NULL ? *usraddrp : NULL, sp);
-    if (err)
-        goto clean_alloc;
+int rpimemmgr_download_async(void * const dst, const void * const src,
+        const size_t size, struct rpimemmgr_xfer ** const xferp,
+        struct rpimemmgr *sp)
+{
+    return submit_xfer(false, dst, src, size, xferp, sp);
+}
 
-    if (busaddrp)
-        *busaddrp = busaddr;
-    return 0;
+int rpimemmgr_xfer_wait(struct rpimemmgr_xfer * const xfer,
+        struct rpimemmgr *sp)
+{
+    if (sp == NULL || xfer == NULL) {
+        print_error("sp or xfer is NULL\n");
+        return 1;
+    }
 
-clean_alloc:
-    (void) free_mem_mailbox(sp->priv->fd_mb, size, handle, busaddr,
-            usraddrp != NULL ? *usraddrp : NULL);
-clean_mem:
-    if (do_mapping)
-        (void) close(sp->priv->fd_mem);
-    sp->priv->fd_mem = -1;
-clean_mb:
-    (void) mailbox_close(sp->priv->fd_mb);
-    sp->priv->fd_mb = -1;
-    return 1;
+    return xfer_wait(sp->priv->xfer, xfer);
 }
 
-int rpimemmgr_alloc_drm(const size_t size, void **usraddrp, uint32_t *busaddrp, struct rpimemmgr *sp)
+bool rpimemmgr_xfer_is_done(const struct rpimemmgr_xfer * const xfer,
+        struct rpimemmgr *sp)
 {
-    uint32_t handle, busaddr;
-    void *usraddr;
-    int err;
+    /* Done rather than pending, so that a polling loop does not spin. */
+    if (sp == NULL || xfer == NULL) {
+        print_error("sp or xfer is NULL\n");
+        return true;
+    }
 
+    return xfer_is_done(sp->priv->xfer, xfer);
+}
+
+int rpimemmgr_get_xfer_eventfd(struct rpimemmgr *sp)
+{
     if (sp == NULL) {
         print_error("sp is NULL\n");
-        return 1;
+        return -1;
     }
-
-    if (sp->priv->fd_drm == -1) {
-        const int fd = drmOpen("v3d", NULL);
-        if (fd == -1) {
-            print_error("drmOpen returned -1\n");
-            return fd;
-        }
-        sp->priv->fd_drm = fd;
+    if (sp->priv->xfer == NULL) {
+        print_error("No workers; call rpimemmgr_start_xfer_workers()\n");
+        return -1;
     }
 
-    err = alloc_mem_drm(sp->priv->fd_drm, size, &handle, &busaddr, &usraddr);
-    if (err)
-        return err;
+    return xfer_eventfd(sp->priv->xfer);
+}
 
-    err = register_mem(MEM_TYPE_DRM, size, handle, busaddr, usraddr, sp);
-    if (err) {
-        (void) free_mem_drm(handle, size, handle, usraddr);
-        return err;
-    }
+const char* rpimemmgr_get_copy_kernel(void)
+{
+    return stream_kernel_name();
+}
 
-    if (usraddrp)
-        *usraddrp = usraddr;
-    if (busaddrp)
-        *busaddrp = busaddr;
-    return 0;
+int rpimemmgr_borrow_drm_fd(struct rpimemmgr *sp) {
+    return sp->priv->drm.fd;
 }
 
-int rpimemmgr_free_by_busaddr(const uint32_t busaddr, struct rpimemmgr *sp)
+int rpimemmgr_set_drm_device(const int fd_drm,
+        const rpimemmgr_drm_ioctl_fn drm_ioctl, struct rpimemmgr *sp)
 {
-    void *node;
-    struct mem_elem elem_key = {
-        .busaddr = busaddr
-    };
+    int err = 0;
 
-    node = tfind(&elem_key, &sp->priv->busaddr_based_root,
-            mem_elem_busaddr_compar);
-    if (node == NULL) {
-        print_error("No such mem_elem: busaddr=0x%08x\n", busaddr);
+    if (sp == NULL || drm_ioctl == NULL) {
+        print_error("sp or drm_ioctl is NULL\n");
+        return 1;
+    }
+    if (fd_drm < 0) {
+        print_error("Invalid fd_drm: %d\n", fd_drm);
         return 1;
     }
 
-    return free_elem(*(struct mem_elem**) node, sp);
+    lock_init(sp->priv);
+    if (sp->priv->drm.fd != -1) {
+        print_error("DRM device is already open\n");
+        err = 1;
+    } else {
+        /* Published along with drm.fd. */
+        sp->priv->drm.ioctl = drm_ioctl;
+        __atomic_store_n(&sp->priv->drm.fd, fd_drm, __ATOMIC_RELEASE);
+    }
+    unlock_init(sp->priv);
+    return err;
 }
 
-int rpimemmgr_free_by_usraddr(void * const usraddr, struct rpimemmgr *sp)
+/* The shared counters plus those of the threads that are still running. */
+static void get_stats(struct rpimemmgr_stats *statsp, struct rpimemmgr *sp)
 {
-    void *node;
-    struct mem_elem elem_key = {
-        .usraddr = usraddr
-    };
-
-    node = tfind(&elem_key, &sp->priv->usraddr_based_root,
-            mem_elem_usraddr_compar);
-    if (node == NULL) {
-        print_error("No such mem_elem: usraddr=%p\n", usraddr);
-        return 1;
-    }
+    const struct tcache *tc;
 
-    return free_elem(*(struct mem_elem**) node, sp);
+    lock_priv(sp->priv);
+    stats_snapshot(statsp, &sp->priv->stats);
+    for (tc = sp->priv->tcaches; tc != NULL; tc = tc->next)
+        add_tcache_stats(statsp, tc);
+    unlock_priv(sp->priv);
 }
 
-#define IN_RANGE(val, lo, hi) ((lo) <= (val) && (val) < (hi))
-static int find_busaddr_by_usraddr(const void *pa, const void *pb)
+int rpimemmgr_get_stats(struct rpimemmgr_stats *statsp, struct rpimemmgr *sp)
 {
-    const struct mem_elem *na = (const struct mem_elem*) pa;
-    const struct mem_elem *nb = (const struct mem_elem*) pb;
-    const struct mem_elem *key = na->size == 0 ? na : nb;
-    const struct mem_elem *target = na->size == 0 ? nb : na;
-    if (IN_RANGE(key->usraddr, target->usraddr,
-                target->usraddr + target->size)) {
-        return 0;
-    } else if (key->usraddr < target->usraddr) {
-        return -1;
-    } else {
+    if (sp == NULL || statsp == NULL) {
+        print_error("sp or statsp is NULL\n");
         return 1;
     }
+
+    get_stats(statsp, sp);
+    return 0;
 }
 
-uint32_t rpimemmgr_usraddr_to_busaddr(const void * const usraddr,
-        struct rpimemmgr *sp)
+/* Pools and the recycle cache are read under lock; the counters are not. */
+static void fill_shm_snapshot(struct rpimemmgr_shm_snapshot *dst, void *arg)
 {
-    struct mem_elem elem_key = {
-        .size = 0,
-        .usraddr = usraddr,
-    };
-    void* found = tfind(&elem_key, &sp->priv->usraddr_based_root,
-            find_busaddr_by_usraddr);
-    if (found == NULL) {
-        print_error("usraddr=%p is not found\n", usraddr);
-        return 0;
-    }
-    struct mem_elem* node = *(struct mem_elem**)found;
-
-    return node->busaddr + (usraddr - node->usraddr);
+    struct rpimemmgr * const sp = arg;
+    const struct pool *pool;
+
+    dst->pool_bytes = dst->pool_used_bytes = 0;
+    lock_priv(sp->priv);
+    for (pool = sp->priv->pools; pool != NULL; pool = pool->next)
+        pool_usage(pool, &dst->pool_bytes, &dst->pool_used_bytes);
+    dst->recycle_bytes = sp->priv->recycle.n_bytes;
+    unlock_priv(sp->priv);
+    get_stats(&dst->stats, sp);
+    dst->time_ns = stats_now();
 }
 
-uint32_t rpimemmgr_usraddr_to_handle(const void * const usraddr,
+int rpimemmgr_publish_stats(const char *label, const unsigned interval_ms,
         struct rpimemmgr *sp)
 {
-    struct mem_elem elem_key = {
-        .size = 0,
-        .usraddr = usraddr,
-    };
-    void* found = tfind(&elem_key, &sp->priv->usraddr_based_root,
-            find_busaddr_by_usraddr);
-    if (found == NULL) {
-        print_error("usraddr=%p is not found\n", usraddr);
-        return 0;
+    struct rpimemmgr_priv *priv;
+    int err = 0;
+
+    if (sp == NULL) {
+        print_error("sp is NULL\n");
+        return 1;
     }
-    struct mem_elem* node = *(struct mem_elem**)found;
+    priv = sp->priv;
 
-    return node->handle;
-}
+    if (!priv->is_thread_safe) {
+        print_error("Call rpimemmgr_enable_thread_safety() first\n");
+        return 1;
+    }
+    if (interval_ms == 0) {
+        print_error("interval_ms is zero\n");
+        return 1;
+    }
 
-int rpimemmgr_borrow_drm_fd(struct rpimemmgr *sp) {
-    return sp->priv->fd_drm;
+    /* Not lock, which the first snapshot takes right away. */
+    lock_init(priv);
+    if (priv->shm_stats != NULL) {
+        print_error("Statistics are already published\n");
+        err = 1;
+    } else {
+        priv->shm_stats = shm_stats_create(label, interval_ms,
+                fill_shm_snapshot, sp);
+        if (priv->shm_stats == NULL)
+            err = 1;
+    }
+    unlock_init(priv);
+    return err;
 }
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+/*
+ * Publisher of snapshots into a POSIX shared memory object.  One thread
+ * writes a snapshot every interval under a seqlock; readers in other
+ * processes retry while seq is odd or has moved.  The snapshot is all
+ * uint64_t and is copied word by word with atomic accesses, so that neither
+ * side tears a counter.
+ */
+
+/* Long enough for "/rpimemmgr.<pid>.<n>". */
+#define SHM_NAME_MAX 64
+/* Reader retries before giving up on a writer that died mid-write. */
+#define SHM_READ_TRIES 1000
+
+#define SNAPSHOT_WORDS \
+        (sizeof(struct rpimemmgr_shm_snapshot) / sizeof(uint64_t))
+
+struct shm_stats {
+    shm_stats_fill_fn fill;
+    void *arg;
+    char name[SHM_NAME_MAX];
+    struct rpimemmgr_shm_stats *shm;
+    unsigned interval_ms;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond_stop;
+    bool is_stopping;
+};
+
+/* Objects created so far in this process, for unique names. */
+static unsigned n_created;
+
+static void write_snapshot(struct rpimemmgr_shm_stats * const shm,
+        const struct rpimemmgr_shm_snapshot * const src)
+{
+    const uint64_t seq = shm->seq;
+    const uint64_t * const s = (const uint64_t*) src;
+    uint64_t * const d = (uint64_t*) &shm->snapshot;
+    size_t i;
+
+    /* The only writer, so seq needs no read-modify-write. */
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < SNAPSHOT_WORDS; i ++)
+        __atomic_store_n(&d[i], s[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void publish(struct shm_stats * const shp)
+{
+    struct rpimemmgr_shm_snapshot snapshot;
+
+    shp->fill(&snapshot, shp->arg);
+    write_snapshot(shp->shm, &snapshot);
+}
+
+static void add_ms(struct timespec * const tp, const unsigned ms)
+{
+    tp->tv_sec += ms / 1000;
+    tp->tv_nsec += (long) (ms % 1000) * 1000000;
+    if (tp->tv_nsec >= 1000000000) {
+        tp->tv_sec ++;
+        tp->tv_nsec -= 1000000000;
+    }
+}
+
+/* Publishes at a fixed cadence, however long a snapshot takes. */
+static void* shm_stats_main(void *arg)
+{
+    struct shm_stats * const shp = arg;
+    struct timespec t;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &t);
+    (void) pthread_mutex_lock(&shp->lock);
+    for (;;) {
+        add_ms(&t, shp->interval_ms);
+        while (!shp->is_stopping && pthread_cond_timedwait(&shp->cond_stop,
+                    &shp->lock, &t) != ETIMEDOUT)
+            ;
+        if (shp->is_stopping)
+            break;
+        (void) pthread_mutex_unlock(&shp->lock);
+        publish(shp);
+        (void) pthread_mutex_lock(&shp->lock);
+    }
+    (void) pthread_mutex_unlock(&shp->lock);
+    return NULL;
+}
+
+/*
+ * The header and a first snapshot are written before magic, so a reader that
+ * sees magic sees a complete object.
+ */
+static struct rpimemmgr_shm_stats* create_object(const char * const name,
+        const char * const label, const unsigned interval_ms)
+{
+    struct rpimemmgr_shm_stats *shm;
+    int fd;
+
+    /* Left behind by a process that died with the same pid. */
+    (void) shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        print_error("shm_open: %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(*shm))) {
+        print_error("ftruncate: %s\n", strerror(errno));
+        goto clean_fd;
+    }
+    shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+            0);
+    if (shm == MAP_FAILED) {
+        print_error("mmap: %s\n", strerror(errno));
+        goto clean_fd;
+    }
+    (void) close(fd);
+
+    shm->version = RPIMEMMGR_SHM_VERSION;
+    shm->pid = getpid();
+    shm->interval_ms = interval_ms;
+    if (label != NULL)
+        (void) strncpy(shm->label, label, sizeof(shm->label) - 1);
+    return shm;
+
+clean_fd:
+    (void) close(fd);
+    (void) shm_unlink(name);
+    return NULL;
+}
+
+struct shm_stats* shm_stats_create(const char *label,
+        const unsigned interval_ms, const shm_stats_fill_fn fill,
+        void * const arg)
+{
+    struct shm_stats *shp;
+    pthread_condattr_t attr;
+    int err;
+
+    shp = malloc(sizeof(*shp));
+    if (shp == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    shp->fill = fill;
+    shp->arg = arg;
+    shp->interval_ms = interval_ms;
+    shp->is_stopping = false;
+    (void) snprintf(shp->name, sizeof(shp->name), RPIMEMMGR_SHM_PREFIX "%d.%u",
+            (int) getpid(), __atomic_fetch_add(&n_created, 1,
+                    __ATOMIC_RELAXED));
+
+    shp->shm = create_object(shp->name, label, interval_ms);
+    if (shp->shm == NULL)
+        goto clean_shp;
+    publish(shp);
+    __atomic_store_n(&shp->shm->magic, RPIMEMMGR_SHM_MAGIC,
+            __ATOMIC_RELEASE);
+
+    (void) pthread_mutex_init(&shp->lock, NULL);
+    (void) pthread_condattr_init(&attr);
+    (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    (void) pthread_cond_init(&shp->cond_stop, &attr);
+    (void) pthread_condattr_destroy(&attr);
+
+    err = pthread_create(&shp->thread, NULL, shm_stats_main, shp);
+    if (err) {
+        print_error("pthread_create: %s\n", strerror(err));
+        goto clean_sync;
+    }
+    return shp;
+
+clean_sync:
+    (void) pthread_cond_destroy(&shp->cond_stop);
+    (void) pthread_mutex_destroy(&shp->lock);
+    (void) munmap(shp->shm, sizeof(*shp->shm));
+    (void) shm_unlink(shp->name);
+clean_shp:
+    free(shp);
+    return NULL;
+}
+
+void shm_stats_destroy(struct shm_stats * const shp)
+{
+    (void) pthread_mutex_lock(&shp->lock);
+    shp->is_stopping = true;
+    (void) pthread_cond_signal(&shp->cond_stop);
+    (void) pthread_mutex_unlock(&shp->lock);
+    (void) pthread_join(shp->thread, NULL);
+
+    /* Readers that have it mapped keep the last snapshot. */
+    if (shm_unlink(shp->name))
+        print_error("shm_unlink: %s: %s\n", shp->name, strerror(errno));
+    (void) munmap(shp->shm, sizeof(*shp->shm));
+    (void) pthread_cond_destroy(&shp->cond_stop);
+    (void) pthread_mutex_destroy(&shp->lock);
+    free(shp);
+}
+
+int rpimemmgr_read_shm_stats(struct rpimemmgr_shm_snapshot *dst,
+        const struct rpimemmgr_shm_stats *shm)
+{
+    uint64_t * const d = (uint64_t*) dst;
+    const uint64_t * const s = (const uint64_t*) &shm->snapshot;
+    unsigned try;
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != RPIMEMMGR_SHM_MAGIC
+            || shm->version != RPIMEMMGR_SHM_VERSION) {
+        print_error("Not a version %d rpimemmgr stats object\n",
+                RPIMEMMGR_SHM_VERSION);
+        return 1;
+    }
+
+    for (try = 0; try < SHM_READ_TRIES; try ++) {
+        const uint64_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        size_t i;
+
+        if (seq % 2 == 0) {
+            for (i = 0; i < SNAPSHOT_WORDS; i ++)
+                d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+                return 0;
+        }
+        (void) sched_yield();
+    }
+    print_error("Snapshot is still being written\n");
+    return 1;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * The simulated backend hands out anonymous memory with synthetic bus
+ * addresses so that the allocator itself can be exercised on any Linux host.
+ * Bus addresses come from [SIM_BUSADDR_BASE, SIM_BUSADDR_END), whose pages
+ * are tracked in a bitmap: the search starts after the last allocation and
+ * wraps around at the end of the window, skipping pages that are still
+ * allocated, so long-lived buffers never share an address with new ones.
+ * They are never touched by hardware.  The handle is the bus address itself.
+ * sim_delay() stands in for the time a real backend spends in the kernel.
+ */
+
+#define SIM_BUSADDR_BASE 0x40000000u
+#define SIM_BUSADDR_END  0xc0000000u
+#define SIM_PAGE_SIZE 4096
+#define SIM_N_PAGES ((SIM_BUSADDR_END - SIM_BUSADDR_BASE) / SIM_PAGE_SIZE)
+
+struct sim_space {
+    pthread_mutex_t lock;
+    /* Page to search from next. */
+    uint32_t next;
+    /* One bit per page of the window, set while allocated. */
+    uint64_t used[SIM_N_PAGES / 64];
+};
+
+struct sim_space* sim_space_create(void)
+{
+    struct sim_space *ssp;
+    int err;
+
+    ssp = calloc(1, sizeof(*ssp));
+    if (ssp == NULL) {
+        print_error("calloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    err = pthread_mutex_init(&ssp->lock, NULL);
+    if (err) {
+        print_error("pthread_mutex_init: %s\n", strerror(err));
+        free(ssp);
+        return NULL;
+    }
+    return ssp;
+}
+
+void sim_space_destroy(struct sim_space * const ssp)
+{
+    if (ssp == NULL)
+        return;
+    (void) pthread_mutex_destroy(&ssp->lock);
+    free(ssp);
+}
+
+static bool is_page_used(const struct sim_space * const ssp, const uint32_t i)
+{
+    return ssp->used[i / 64] >> (i % 64) & 1;
+}
+
+static void mark_pages(struct sim_space * const ssp, uint32_t i,
+        const uint32_t n, const bool is_used)
+{
+    const uint32_t end = i + n;
+
+    for (; i < end; i ++) {
+        if (is_used)
+            ssp->used[i / 64] |= (uint64_t) 1 << (i % 64);
+        else
+            ssp->used[i / 64] &= ~((uint64_t) 1 << (i % 64));
+    }
+}
+
+/*
+ * First free run of n pages aligned to a pages from ssp->next on, wrapping
+ * around once.  Returns SIM_N_PAGES if there is none.
+ */
+static uint32_t find_pages(const struct sim_space * const ssp,
+        const uint32_t n, const uint32_t a)
+{
+    const uint32_t start = ssp->next;
+    bool is_wrapped = false;
+    uint32_t i, j;
+
+    i = (start + a - 1) & ~(a - 1);
+    for (;;) {
+        if (i > SIM_N_PAGES - n) {
+            if (is_wrapped)
+                return SIM_N_PAGES;
+            is_wrapped = true;
+            i = 0;
+        }
+        /* Runs from start on were tried before the wrap. */
+        if (is_wrapped && i >= start)
+            return SIM_N_PAGES;
+        for (j = 0; j < n && !is_page_used(ssp, i + j); j ++)
+            ;
+        if (j == n)
+            return i;
+        i = (i + j + 1 + a - 1) & ~(a - 1);
+    }
+}
+
+int alloc_mem_sim(struct sim_space * const ssp, const size_t size,
+        size_t align, uint32_t *handlep, uint32_t *busaddrp, void **usraddrp)
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t map_size = (size + page_size - 1) & ~(page_size - 1);
+    uint32_t busaddr, i;
+    uint8_t *p;
+
+    if (size == 0 || size >= SIM_BUSADDR_END - SIM_BUSADDR_BASE) {
+        print_error("Invalid size: %zu\n", size);
+        return 1;
+    }
+    if (align < page_size)
+        align = page_size;
+    if (align & (align - 1)) {
+        print_error("Alignment %zu is not a power of two\n", align);
+        return 1;
+    }
+    /* The base is aligned to this, and so are the pages from it. */
+    if (align > SIM_BUSADDR_BASE) {
+        print_error("Alignment %zu is too large\n", align);
+        return 1;
+    }
+
+    (void) pthread_mutex_lock(&ssp->lock);
+    i = find_pages(ssp, map_size / SIM_PAGE_SIZE, align / SIM_PAGE_SIZE);
+    if (i != SIM_N_PAGES) {
+        mark_pages(ssp, i, map_size / SIM_PAGE_SIZE, true);
+        ssp->next = i + map_size / SIM_PAGE_SIZE;
+    }
+    (void) pthread_mutex_unlock(&ssp->lock);
+    if (i == SIM_N_PAGES) {
+        print_error("Out of simulated bus addresses for %zu bytes\n", size);
+        return 1;
+    }
+    busaddr = SIM_BUSADDR_BASE + i * SIM_PAGE_SIZE;
+
+    /* Over-map and trim so that usraddr honors the alignment as well. */
+    p = mmap(NULL, map_size + align - page_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        print_error("mmap: %s\n", strerror(errno));
+        goto clean_pages;
+    }
+    if (align > page_size) {
+        uint8_t * const q = (uint8_t*) (((uintptr_t) p + align - 1)
+                & ~(uintptr_t) (align - 1));
+        if (q != p)
+            (void) munmap(p, q - p);
+        if (align - page_size - (q - p) != 0)
+            (void) munmap(q + map_size, align - page_size - (q - p));
+        p = q;
+    }
+
+    *handlep = busaddr;
+    *busaddrp = busaddr;
+    *usraddrp = p;
+    return 0;
+
+clean_pages:
+    (void) pthread_mutex_lock(&ssp->lock);
+    mark_pages(ssp, i, map_size / SIM_PAGE_SIZE, false);
+    (void) pthread_mutex_unlock(&ssp->lock);
+    return 1;
+}
+
+int free_mem_sim(struct sim_space * const ssp, const size_t size,
+        const uint32_t busaddr, void *usraddr)
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t map_size = (size + page_size - 1) & ~(page_size - 1);
+    int err;
+
+    err = munmap(usraddr, size);
+    if (err) {
+        print_error("munmap: %s\n", strerror(errno));
+        return err;
+    }
+
+    (void) pthread_mutex_lock(&ssp->lock);
+    mark_pages(ssp, (busaddr - SIM_BUSADDR_BASE) / SIM_PAGE_SIZE,
+            map_size / SIM_PAGE_SIZE, false);
+    (void) pthread_mutex_unlock(&ssp->lock);
+    return 0;
+}
+
+/* Sleeps rather than spins, as a thread blocked in an ioctl would. */
+void sim_delay(const unsigned us)
+{
+    struct timespec t;
+
+    if (us == 0)
+        return;
+    t.tv_sec = us / 1000000;
+    t.tv_nsec = (long) (us % 1000000) * 1000;
+    while (nanosleep(&t, &t) == -1 && errno == EINTR)
+        ;
+}
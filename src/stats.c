@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * Always-on counters.  In thread-safe mode they are relaxed atomics, which
+ * cost an uncontended locked add each; otherwise plain adds.  Nothing here
+ * takes a lock, so the counters may be bumped from any path.
+ */
+
+void stats_add(uint64_t *p, const uint64_t v, const bool is_atomic)
+{
+    if (is_atomic)
+        (void) __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+    else
+        *p += v;
+}
+
+static void update_peak(uint64_t *peakp, const uint64_t v,
+        const bool is_atomic)
+{
+    uint64_t peak;
+
+    if (!is_atomic) {
+        if (v > *peakp)
+            *peakp = v;
+        return;
+    }
+    peak = __atomic_load_n(peakp, __ATOMIC_RELAXED);
+    while (v > peak && !__atomic_compare_exchange_n(peakp, &peak, v, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void stats_live_add(struct rpimemmgr_backend_stats *bp, const size_t n,
+        const size_t size, const bool is_atomic)
+{
+    uint64_t count, bytes;
+
+    if (is_atomic) {
+        count = __atomic_add_fetch(&bp->live_count, n, __ATOMIC_RELAXED);
+        bytes = __atomic_add_fetch(&bp->live_bytes, size, __ATOMIC_RELAXED);
+    } else {
+        count = bp->live_count += n;
+        bytes = bp->live_bytes += size;
+    }
+    update_peak(&bp->peak_count, count, is_atomic);
+    update_peak(&bp->peak_bytes, bytes, is_atomic);
+}
+
+void stats_live_sub(struct rpimemmgr_backend_stats *bp, const size_t size,
+        const bool is_atomic)
+{
+    stats_add(&bp->live_count, -(uint64_t) 1, is_atomic);
+    stats_add(&bp->live_bytes, -(uint64_t) size, is_atomic);
+}
+
+uint64_t stats_now(void)
+{
+    struct timespec t;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Bucket 0 is below 1 us, bucket i is [2^(i-1), 2^i) us. */
+void stats_latency(uint64_t *hist, const uint64_t start_ns,
+        const bool is_atomic)
+{
+    const uint64_t us = (stats_now() - start_ns) / 1000;
+    unsigned i = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+    if (i >= RPIMEMMGR_N_LATENCY_BUCKETS)
+        i = RPIMEMMGR_N_LATENCY_BUCKETS - 1;
+    stats_add(&hist[i], 1, is_atomic);
+}
+
+/* The structure is all uint64_t, so it is copied word by word. */
+void stats_snapshot(struct rpimemmgr_stats *dst,
+        const struct rpimemmgr_stats *src)
+{
+    const uint64_t *s = (const uint64_t*) src;
+    uint64_t *d = (uint64_t*) dst;
+    size_t i;
+
+    for (i = 0; i < sizeof(*src) / sizeof(uint64_t); i ++)
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
+
+/* Upper bound of a bucket in microseconds, for printing. */
+static uint64_t bucket_limit(const unsigned i)
+{
+    return (uint64_t) 1 << i;
+}
+
+static void print_hist(FILE *fp, const char *name, const uint64_t *hist)
+{
+    unsigned i;
+
+    fprintf(fp, "    %s latency:", name);
+    for (i = 0; i < RPIMEMMGR_N_LATENCY_BUCKETS; i ++) {
+        if (hist[i] == 0)
+            continue;
+        if (i == RPIMEMMGR_N_LATENCY_BUCKETS - 1)
+            fprintf(fp, " >=%" PRIu64 "us:%" PRIu64, bucket_limit(i - 1),
+                    hist[i]);
+        else
+            fprintf(fp, " <%" PRIu64 "us:%" PRIu64, bucket_limit(i),
+                    hist[i]);
+    }
+    fprintf(fp, "\n");
+}
+
+void stats_print(FILE *fp, const struct rpimemmgr_stats *statsp,
+        const char * const names[])
+{
+    unsigned i;
+
+    fprintf(fp, "rpimemmgr: %" PRIu64 " allocs, %" PRIu64 " frees, %" PRIu64
+            " lookups, %" PRIu64 " syncs (%" PRIu64 " bytes cleaned, %" PRIu64
+            " invalidated), %" PRIu64 " Mailbox messages\n",
+            statsp->n_allocs, statsp->n_frees, statsp->n_lookups,
+            statsp->n_syncs, statsp->bytes_cleaned,
+            statsp->bytes_invalidated, statsp->n_mailbox_msgs);
+    for (i = 0; i < RPIMEMMGR_N_BACKENDS; i ++) {
+        const struct rpimemmgr_backend_stats * const bp =
+                &statsp->backends[i];
+        if (bp->n_allocs == 0)
+            continue;
+        fprintf(fp, "  %s: %" PRIu64 " allocs, %" PRIu64 " frees, live %"
+                PRIu64 " bytes (%" PRIu64 " uncached) in %" PRIu64 " (peak %"
+                PRIu64 " bytes in %" PRIu64 ")\n", names[i], bp->n_allocs,
+                bp->n_frees, bp->live_bytes, bp->live_uncached_bytes,
+                bp->live_count, bp->peak_bytes, bp->peak_count);
+        print_hist(fp, "alloc", bp->alloc_latency);
+        print_hist(fp, "free ", bp->free_latency);
+    }
+}
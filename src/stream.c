@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(RPIMEMMGR_HAVE_NEON) && defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/*
+ * Uncached and write-combined memory is slow with narrow or unaligned
+ * stores: each one can become a bus transaction of its own.  The kernels here
+ * align the destination first and then store in 64-byte bursts, which fill
+ * whole write-combining buffers.  Which kernel is used is decided once at the
+ * first call from what the CPU supports.
+ */
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+
+void stream_copy_scalar(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    for (; size > 0 && ((uintptr_t) d & 7) != 0; size --)
+        *d ++ = *s ++;
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        word_t w[8];
+        unsigned i;
+        /* Load the whole burst before storing any of it. */
+        memcpy(w, s, 64);
+        for (i = 0; i < 8; i ++)
+            ((word_t*) d)[i] = w[i];
+    }
+    for (; size >= 8; size -= 8, d += 8, s += 8) {
+        word_t w;
+        memcpy(&w, s, 8);
+        *(word_t*) d = w;
+    }
+    for (; size > 0; size --)
+        *d ++ = *s ++;
+}
+
+void stream_set_scalar(void *dst, const int c, size_t size)
+{
+    const word_t w = (uint8_t) c * UINT64_C(0x0101010101010101);
+    uint8_t *d = dst;
+
+    for (; size > 0 && ((uintptr_t) d & 7) != 0; size --)
+        *d ++ = (uint8_t) c;
+    for (; size >= 64; size -= 64, d += 64) {
+        unsigned i;
+        for (i = 0; i < 8; i ++)
+            ((word_t*) d)[i] = w;
+    }
+    for (; size >= 8; size -= 8, d += 8)
+        *(word_t*) d = w;
+    for (; size > 0; size --)
+        *d ++ = (uint8_t) c;
+}
+
+static struct {
+    void (*copy)(void *dst, const void *src, size_t size);
+    void (*set)(void *dst, int c, size_t size);
+    const char *name;
+} kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void)
+{
+    kernels.copy = stream_copy_scalar;
+    kernels.set = stream_set_scalar;
+    kernels.name = "scalar";
+
+    /* For testing and comparing the fallback on any CPU. */
+    if (getenv("RPIMEMMGR_NO_SIMD") != NULL)
+        return;
+
+#if defined(RPIMEMMGR_HAVE_NEON)
+#if defined(__arm__)
+    if (!(getauxval(AT_HWCAP) & HWCAP_NEON))
+        return;
+#endif /* defined(__arm__) */
+    kernels.copy = stream_copy_neon;
+    kernels.set = stream_set_neon;
+    kernels.name = "neon";
+#elif defined(RPIMEMMGR_HAVE_SSE2)
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse2"))
+        return;
+    kernels.copy = stream_copy_sse2;
+    kernels.set = stream_set_sse2;
+    kernels.name = "sse2";
+#endif
+}
+
+void stream_copy(void *dst, const void *src, const size_t size)
+{
+    (void) pthread_once(&kernels_once, select_kernels);
+    kernels.copy(dst, src, size);
+}
+
+void stream_set(void *dst, const int c, const size_t size)
+{
+    (void) pthread_once(&kernels_once, select_kernels);
+    kernels.set(dst, c, size);
+}
+
+const char* stream_kernel_name(void)
+{
+    (void) pthread_once(&kernels_once, select_kernels);
+    return kernels.name;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdint.h>
+#include <arm_neon.h>
+
+/*
+ * Built for ARMv7 with -mfpu=neon where the 32-bit compiler does not target
+ * NEON itself, and called only after HWCAP_NEON is checked.  ARMv7 has no
+ * non-temporal store hint, so the bursts are plain 64-byte stores of four Q
+ * registers, which the write buffer merges into one transaction on uncached
+ * memory.
+ */
+
+void stream_copy_neon(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = -(uintptr_t) d & 15;
+
+    if (size < 64) {
+        stream_copy_scalar(d, s, size);
+        return;
+    }
+    stream_copy_scalar(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        const uint8x16_t a = vld1q_u8(s), b = vld1q_u8(s + 16),
+                c = vld1q_u8(s + 32), e = vld1q_u8(s + 48);
+        __builtin_prefetch(s + 256);
+        vst1q_u8(d, a);
+        vst1q_u8(d + 16, b);
+        vst1q_u8(d + 32, c);
+        vst1q_u8(d + 48, e);
+    }
+    stream_copy_scalar(d, s, size);
+}
+
+void stream_set_neon(void *dst, const int c, size_t size)
+{
+    const uint8x16_t v = vdupq_n_u8((uint8_t) c);
+    uint8_t *d = dst;
+    size_t head = -(uintptr_t) d & 15;
+
+    if (size < 64) {
+        stream_set_scalar(d, c, size);
+        return;
+    }
+    stream_set_scalar(d, c, head);
+    d += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64) {
+        vst1q_u8(d, v);
+        vst1q_u8(d + 16, v);
+        vst1q_u8(d + 32, v);
+        vst1q_u8(d + 48, v);
+    }
+    stream_set_scalar(d, c, size);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdint.h>
+#include <emmintrin.h>
+
+/*
+ * Non-temporal 16-byte stores in 64-byte bursts, so that the destination
+ * does not pollute the cache and write-combined memory sees full lines.  The
+ * stores are weakly ordered; the sfence makes them visible in order with
+ * whatever the caller does next, e.g. kicking the GPU.
+ */
+
+void stream_copy_sse2(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = -(uintptr_t) d & 15;
+
+    if (size < 64) {
+        stream_copy_scalar(d, s, size);
+        return;
+    }
+    stream_copy_scalar(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        const __m128i a = _mm_loadu_si128((const __m128i*) s),
+                b = _mm_loadu_si128((const __m128i*) (s + 16)),
+                c = _mm_loadu_si128((const __m128i*) (s + 32)),
+                e = _mm_loadu_si128((const __m128i*) (s + 48));
+        _mm_stream_si128((__m128i*) d, a);
+        _mm_stream_si128((__m128i*) (d + 16), b);
+        _mm_stream_si128((__m128i*) (d + 32), c);
+        _mm_stream_si128((__m128i*) (d + 48), e);
+    }
+    _mm_sfence();
+    stream_copy_scalar(d, s, size);
+}
+
+void stream_set_sse2(void *dst, const int c, size_t size)
+{
+    const __m128i v = _mm_set1_epi8((char) c);
+    uint8_t *d = dst;
+    size_t head = -(uintptr_t) d & 15;
+
+    if (size < 64) {
+        stream_set_scalar(d, c, size);
+        return;
+    }
+    stream_set_scalar(d, c, head);
+    d += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64) {
+        _mm_stream_si128((__m128i*) d, v);
+        _mm_stream_si128((__m128i*) (d + 16), v);
+        _mm_stream_si128((__m128i*) (d + 32), v);
+        _mm_stream_si128((__m128i*) (d + 48), v);
+    }
+    _mm_sfence();
+    stream_set_scalar(d, c, size);
+}
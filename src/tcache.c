@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Per-thread caches of freed pool blocks.  A cache has a few magazines, each
+ * holding up to TCACHE_DEPTH blocks of one pool size class.  A magazine that
+ * runs empty can be taken over by another class.  Blocks are opaque here; the
+ * caller keeps them registered and marks them as cached so that they can be
+ * handed out again without touching any shared state.
+ */
+
+struct tcache* tcache_create(void * const owner)
+{
+    struct tcache *tc;
+
+    tc = calloc(1, sizeof(*tc));
+    if (tc == NULL) {
+        print_error("calloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    tc->owner = owner;
+    return tc;
+}
+
+void tcache_destroy(struct tcache *tc)
+{
+    free(tc);
+}
+
+void* tcache_pop(struct tcache *tc, const struct pool_class * const class)
+{
+    unsigned i;
+
+    for (i = 0; i < TCACHE_N_MAGS; i ++) {
+        struct tcache_mag * const mag = &tc->mags[i];
+        if (mag->class == class && mag->n > 0)
+            return mag->blocks[-- mag->n];
+    }
+    return NULL;
+}
+
+bool tcache_push(struct tcache *tc, const struct pool_class * const class,
+        void * const block)
+{
+    struct tcache_mag *empty = NULL;
+    unsigned i;
+
+    for (i = 0; i < TCACHE_N_MAGS; i ++) {
+        struct tcache_mag * const mag = &tc->mags[i];
+        if (mag->class == class) {
+            if (mag->n == TCACHE_DEPTH)
+                return false;
+            mag->blocks[mag->n ++] = block;
+            return true;
+        }
+        if (mag->n == 0 && empty == NULL)
+            empty = mag;
+    }
+
+    if (empty == NULL)
+        return false;
+    empty->class = class;
+    empty->blocks[0] = block;
+    empty->n = 1;
+    return true;
+}
+
+void* tcache_drain(struct tcache *tc)
+{
+    unsigned i;
+
+    for (i = 0; i < TCACHE_N_MAGS; i ++)
+        if (tc->mags[i].n > 0)
+            return tc->mags[i].blocks[-- tc->mags[i].n];
+    return NULL;
+}
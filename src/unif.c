@@ -32,3 +32,48 @@ void unif_add_float(const float f, uint32_t **pp)
 {
     unif_set_float((*pp)++, f);
 }
+
+int rpimemmgr_unif_overflow(struct rpimemmgr_unif * const up,
+        const size_t n)
+{
+    print_error("%zu words do not fit in %zu\n", n,
+            (size_t) (up->end - up->cursor));
+    up->is_overflowed = true;
+    return 1;
+}
+
+/*
+ * A float and its bit pattern are the same 32 bits, so the conversion of an
+ * array is a plain copy, which libc does with the widest vector stores.
+ */
+static int add_words(struct rpimemmgr_unif * const up, const void * const src,
+        const size_t n)
+{
+    if ((size_t) (up->end - up->cursor) < n)
+        return rpimemmgr_unif_overflow(up, n);
+    memcpy(up->cursor, src, n * sizeof(uint32_t));
+    up->cursor += n;
+    return 0;
+}
+
+int rpimemmgr_unif_add_uints(struct rpimemmgr_unif * const up,
+        const uint32_t * const us, const size_t n)
+{
+    return add_words(up, us, n);
+}
+
+int rpimemmgr_unif_add_floats(struct rpimemmgr_unif * const up,
+        const float * const fs, const size_t n)
+{
+    return add_words(up, fs, n);
+}
+
+int rpimemmgr_unif_add_busaddr(struct rpimemmgr_unif * const up,
+        const void * const usraddr, struct rpimemmgr *sp)
+{
+    const uint32_t busaddr = rpimemmgr_usraddr_to_busaddr(usraddr, sp);
+
+    if (busaddr == 0)
+        return 1;
+    return rpimemmgr_unif_add_uint(up, busaddr);
+}
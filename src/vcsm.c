@@ -75,3 +75,55 @@ int free_mem_vcsm(const uint32_t handle, void *usraddr)
 
     return err_sum;
 }
+
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+/* Only with the vcsm-cma driver, which is built on dma-bufs. */
+
+int import_mem_vcsm(const int dmabuf_fd, uint32_t *handlep,
+        uint32_t *busaddrp, void **usraddrp)
+{
+    uint32_t handle, busaddr;
+    void *usraddr;
+
+    handle = vcsm_import_dmabuf(dmabuf_fd, "rpimemmgr");
+    if (!handle) {
+        print_error("Failed to import dma-buf to VCSM\n");
+        return 1;
+    }
+
+    usraddr = vcsm_lock(handle);
+    if (!usraddr) {
+        print_error("Failed to lock VCSM memory\n");
+        goto clean_import;
+    }
+
+    busaddr = vcsm_vc_addr_from_hdl(handle);
+    if (!busaddr) {
+        print_error("Failed to get bus addr from VCSM\n");
+        goto clean_lock;
+    }
+
+    *handlep = handle;
+    *busaddrp = busaddr;
+    *usraddrp = usraddr;
+    return 0;
+
+clean_lock:
+    (void) vcsm_unlock_ptr(usraddr);
+clean_import:
+    vcsm_free(handle);
+    return 1;
+}
+
+int export_mem_vcsm(const uint32_t handle, int *dmabuf_fdp)
+{
+    const int fd = vcsm_export_dmabuf(handle);
+
+    if (fd < 0) {
+        print_error("Failed to export VCSM memory\n");
+        return 1;
+    }
+    *dmabuf_fdp = fd;
+    return 0;
+}
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/*
+ * A fixed set of worker threads, each with its own FIFO.  A job goes to the
+ * worker picked by hashing its key, so jobs with the same key run in
+ * submission order while jobs with different keys spread over the workers.
+ */
+
+struct xfer_worker {
+    struct xfer_queue *queue;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* Signalled on submission and on stop. */
+    pthread_cond_t cond_submit;
+    struct rpimemmgr_xfer *head, *tail;
+    bool is_stopping;
+};
+
+struct xfer_queue {
+    xfer_run_fn run;
+    void *arg;
+    int eventfd;
+    pthread_mutex_t done_lock;
+    pthread_cond_t cond_done;
+    unsigned n_workers;
+    struct xfer_worker workers[];
+};
+
+static void notify(struct xfer_queue * const qp)
+{
+    const uint64_t one = 1;
+
+    while (write(qp->eventfd, &one, sizeof(one)) == -1 && errno == EINTR)
+        ;
+}
+
+static void complete(struct xfer_queue * const qp, struct rpimemmgr_xfer *jp,
+        const int err)
+{
+    bool is_detached;
+
+    (void) pthread_mutex_lock(&qp->done_lock);
+    jp->err = err;
+    jp->is_done = true;
+    is_detached = jp->is_detached;
+    (void) pthread_cond_broadcast(&qp->cond_done);
+    (void) pthread_mutex_unlock(&qp->done_lock);
+
+    if (is_detached)
+        free(jp);
+    notify(qp);
+}
+
+static void* worker_main(void *arg)
+{
+    struct xfer_worker * const wp = arg;
+    struct xfer_queue * const qp = wp->queue;
+
+    for (;;) {
+        struct rpimemmgr_xfer *jp;
+
+        (void) pthread_mutex_lock(&wp->lock);
+        while (wp->head == NULL && !wp->is_stopping)
+            (void) pthread_cond_wait(&wp->cond_submit, &wp->lock);
+        jp = wp->head;
+        if (jp != NULL) {
+            wp->head = jp->next;
+            if (wp->head == NULL)
+                wp->tail = NULL;
+        }
+        (void) pthread_mutex_unlock(&wp->lock);
+
+        /* Stop only once the queue is drained. */
+        if (jp == NULL)
+            break;
+        complete(qp, jp, qp->run(jp, qp->arg));
+    }
+    return NULL;
+}
+
+static void stop_workers(struct xfer_queue * const qp, const unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i ++) {
+        struct xfer_worker * const wp = &qp->workers[i];
+        (void) pthread_mutex_lock(&wp->lock);
+        wp->is_stopping = true;
+        (void) pthread_cond_signal(&wp->cond_submit);
+        (void) pthread_mutex_unlock(&wp->lock);
+    }
+    for (i = 0; i < n; i ++) {
+        struct xfer_worker * const wp = &qp->workers[i];
+        (void) pthread_join(wp->thread, NULL);
+        (void) pthread_cond_destroy(&wp->cond_submit);
+        (void) pthread_mutex_destroy(&wp->lock);
+    }
+}
+
+struct xfer_queue* xfer_create(const unsigned n_workers, const xfer_run_fn run,
+        void * const arg)
+{
+    struct xfer_queue *qp;
+    unsigned i;
+    int err;
+
+    qp = malloc(sizeof(*qp) + sizeof(qp->workers[0]) * n_workers);
+    if (qp == NULL) {
+        print_error("malloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    qp->run = run;
+    qp->arg = arg;
+    qp->n_workers = n_workers;
+
+    qp->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (qp->eventfd == -1) {
+        print_error("eventfd: %s\n", strerror(errno));
+        goto clean_qp;
+    }
+    (void) pthread_mutex_init(&qp->done_lock, NULL);
+    (void) pthread_cond_init(&qp->cond_done, NULL);
+
+    for (i = 0; i < n_workers; i ++) {
+        struct xfer_worker * const wp = &qp->workers[i];
+
+        wp->queue = qp;
+        wp->head = wp->tail = NULL;
+        wp->is_stopping = false;
+        (void) pthread_mutex_init(&wp->lock, NULL);
+        (void) pthread_cond_init(&wp->cond_submit, NULL);
+        err = pthread_create(&wp->thread, NULL, worker_main, wp);
+        if (err) {
+            print_error("pthread_create: %s\n", strerror(err));
+            (void) pthread_cond_destroy(&wp->cond_submit);
+            (void) pthread_mutex_destroy(&wp->lock);
+            stop_workers(qp, i);
+            goto clean_done;
+        }
+    }
+    return qp;
+
+clean_done:
+    (void) pthread_cond_destroy(&qp->cond_done);
+    (void) pthread_mutex_destroy(&qp->done_lock);
+    (void) close(qp->eventfd);
+clean_qp:
+    free(qp);
+    return NULL;
+}
+
+void xfer_destroy(struct xfer_queue * const qp)
+{
+    stop_workers(qp, qp->n_workers);
+    (void) pthread_cond_destroy(&qp->cond_done);
+    (void) pthread_mutex_destroy(&qp->done_lock);
+    (void) close(qp->eventfd);
+    free(qp);
+}
+
+void xfer_submit(struct xfer_queue * const qp, const uintptr_t key,
+        struct rpimemmgr_xfer * const jp)
+{
+    /* Fibonacci hashing; the low bits of buffer addresses are all zero. */
+    const uint32_t h = (uint32_t) (key >> 6) * UINT32_C(0x9e3779b9);
+    struct xfer_worker * const wp =
+            &qp->workers[(uint64_t) h * qp->n_workers >> 32];
+
+    jp->next = NULL;
+    jp->is_done = false;
+    (void) pthread_mutex_lock(&wp->lock);
+    if (wp->tail == NULL)
+        wp->head = jp;
+    else
+        wp->tail->next = jp;
+    wp->tail = jp;
+    (void) pthread_cond_signal(&wp->cond_submit);
+    (void) pthread_mutex_unlock(&wp->lock);
+}
+
+int xfer_wait(struct xfer_queue * const qp, struct rpimemmgr_xfer * const jp)
+{
+    int err;
+
+    (void) pthread_mutex_lock(&qp->done_lock);
+    while (!jp->is_done)
+        (void) pthread_cond_wait(&qp->cond_done, &qp->done_lock);
+    err = jp->err;
+    (void) pthread_mutex_unlock(&qp->done_lock);
+
+    free(jp);
+    return err;
+}
+
+bool xfer_is_done(struct xfer_queue * const qp,
+        const struct rpimemmgr_xfer * const jp)
+{
+    bool is_done;
+
+    (void) pthread_mutex_lock(&qp->done_lock);
+    is_done = jp->is_done;
+    (void) pthread_mutex_unlock(&qp->done_lock);
+    return is_done;
+}
+
+int xfer_eventfd(const struct xfer_queue * const qp)
+{
+    return qp->eventfd;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Allocation rate with and without pool mode.  The simulated backend always
+ * runs; the real backends run only on a Raspberry Pi.
+ */
+
+#define N_BUFS 1024
+
+enum backend {
+    BACKEND_SIM,
+    BACKEND_VCSM,
+    BACKEND_MAILBOX,
+    BACKEND_DRM,
+};
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int alloc_one(const enum backend backend, const size_t size,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    switch (backend) {
+        case BACKEND_SIM:
+            return rpimemmgr_alloc_sim(size, 4096, usraddrp, NULL, sp);
+        case BACKEND_VCSM:
+            return rpimemmgr_alloc_vcsm(size, 4096, VCSM_CACHE_TYPE_HOST,
+                    usraddrp, NULL, sp);
+        case BACKEND_MAILBOX:
+            return rpimemmgr_alloc_mailbox(size, 4096, MEM_FLAG_DIRECT,
+                    usraddrp, NULL, sp);
+        case BACKEND_DRM:
+            return rpimemmgr_alloc_drm(size, usraddrp, NULL, sp);
+    }
+    return 1;
+}
+
+static int test_alloc_speed(const enum backend backend, const size_t size,
+        const bool use_pool)
+{
+    static void *usraddrs[N_BUFS];
+    double start, end;
+    unsigned i;
+    int err;
+    struct rpimemmgr st;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    if (use_pool) {
+        err = rpimemmgr_set_pool(1 << 22, 1 << 16, &st);
+        if (err)
+            goto clean_init;
+    }
+
+    start = get_time();
+    for (i = 0; i < N_BUFS; i ++) {
+        err = alloc_one(backend, size, &usraddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_free_by_usraddr(usraddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    end = get_time();
+
+    printf("%6zu B, pool %-3s: %e [alloc+free/s]\n", size,
+            use_pool ? "on" : "off", N_BUFS / (end - start));
+
+clean_init:
+    err |= rpimemmgr_finalize(&st);
+    return err;
+}
+
+static int test_backend(const char *name, const enum backend backend)
+{
+    static const size_t sizes[] = {4096, 16384, 65536};
+    unsigned i;
+    int err;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i ++) {
+        printf("%-30s", name);
+        err = test_alloc_speed(backend, sizes[i], false);
+        if (err)
+            return err;
+        printf("%-30s", name);
+        err = test_alloc_speed(backend, sizes[i], true);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    int processor;
+    int err;
+
+    err = test_backend("sim:", BACKEND_SIM);
+    if (err)
+        return err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    processor = rpimemmgr_get_processor(&st);
+    err = rpimemmgr_finalize(&st);
+    if (err)
+        return err;
+    if (processor < 0) {
+        printf("Not a Raspberry Pi; skipping the real backends\n");
+        return 0;
+    }
+
+    err = test_backend("VCSM (GPU): HOST:", BACKEND_VCSM);
+    if (err)
+        return err;
+    err = test_backend("Mailbox:    DIRECT:", BACKEND_MAILBOX);
+    if (err)
+        return err;
+    if (processor == 3) { /* BCM2711 */
+        err = test_backend("DRM:", BACKEND_DRM);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+
+/*
+ * CPU bandwidth matrix: every backend and flag/cache type that is available
+ * plus malloc, times sizes from 4 KiB to 64 MiB, times access patterns.  Each
+ * cell is run a few times untimed and then timed repeatedly; min, median and
+ * max of the time per pass are reported, with the bandwidth at the median.
+ * At most MAX_REPS samples are taken, too few for a meaningful p99.
+ * Results go to stdout as a table and optionally to CSV and JSON files so
+ * that runs on different boards can be diffed.
+ *
+ *   bandwidth [--csv FILE] [--json FILE] [--min-size N] [--max-size N]
+ *             [--quick]
+ */
+
+#define barrier_data(ptr) __asm__ volatile ("" : : "r" (ptr) : "memory")
+
+#define MIN_SIZE_DEFAULT ((size_t) 1 << 12)
+#define MAX_SIZE_DEFAULT ((size_t) 1 << 26)
+#define N_WARMUP 3
+#define MAX_REPS 51
+/* Passes per timed sample so that a sample takes long enough to time. */
+#define MIN_BYTES_PER_SAMPLE ((size_t) 1 << 20)
+/* Pitch and width of the 2D pattern, as for a sub-image of a frame. */
+#define PITCH_2D 4096
+#define WIDTH_2D 1024
+#define MAX_RANDOM_READS ((size_t) 1 << 20)
+
+enum pattern {
+    PATTERN_READ,
+    PATTERN_WRITE,
+    PATTERN_COPY,
+    PATTERN_2D,
+    PATTERN_RANDOM,
+    N_PATTERNS
+};
+
+static const char * const pattern_names[N_PATTERNS] = {
+    "read", "write", "copy", "2d", "random",
+};
+
+enum backend {
+    BACKEND_MALLOC,
+    BACKEND_VCSM,
+    BACKEND_VCSM_CMA,
+    BACKEND_MAILBOX,
+    BACKEND_DRM,
+};
+
+struct config {
+    enum backend backend;
+    uint32_t flags;
+    const char *name, *flags_name;
+};
+
+struct options {
+    FILE *csv, *json;
+    size_t min_size, max_size;
+    bool quick;
+};
+
+struct result {
+    size_t bytes;
+    unsigned reps;
+    double min, median, max;
+};
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int alloc_buf(const struct config *cp, const size_t size, void **pp,
+        struct rpimemmgr *sp)
+{
+    switch (cp->backend) {
+        case BACKEND_MALLOC:
+            return posix_memalign(pp, 4096, size);
+        case BACKEND_VCSM:
+        case BACKEND_VCSM_CMA:
+            return rpimemmgr_alloc_vcsm(size, 4096, cp->flags, pp, NULL, sp);
+        case BACKEND_MAILBOX:
+            return rpimemmgr_alloc_mailbox(size, 4096, cp->flags, pp, NULL,
+                    sp);
+        case BACKEND_DRM:
+            return rpimemmgr_alloc_drm(size, pp, NULL, sp);
+    }
+    return 1;
+}
+
+static int free_buf(const struct config *cp, void *p, struct rpimemmgr *sp)
+{
+    if (cp->backend == BACKEND_MALLOC) {
+        free(p);
+        return 0;
+    }
+    return rpimemmgr_free_by_usraddr(p, sp);
+}
+
+/* Runs one pass and returns the number of bytes accessed. */
+static size_t run_pattern(const enum pattern pattern, const size_t size,
+        uint8_t *dst, const uint8_t *src, const uint32_t *indices)
+{
+    const uint32_t mask = size / 8 - 1;
+    size_t i, n;
+
+    switch (pattern) {
+        case PATTERN_READ: {
+            const uint64_t *p = (const uint64_t*) src;
+            uint64_t sum = 0;
+            for (i = 0; i < size / 8; i ++)
+                sum += p[i];
+            barrier_data(sum);
+            return size;
+        }
+        case PATTERN_WRITE:
+            memset(dst, (int) size, size);
+            barrier_data(dst);
+            return size;
+        case PATTERN_COPY:
+            memcpy(dst, src, size);
+            barrier_data(dst);
+            return size;
+        case PATTERN_2D:
+            if (size < PITCH_2D) {
+                memcpy(dst, src, size / 4);
+                barrier_data(dst);
+                return size / 4;
+            }
+            for (i = 0; i < size / PITCH_2D; i ++)
+                memcpy(dst + i * PITCH_2D, src + i * PITCH_2D, WIDTH_2D);
+            barrier_data(dst);
+            return size / PITCH_2D * WIDTH_2D;
+        case PATTERN_RANDOM: {
+            const uint64_t *p = (const uint64_t*) src;
+            uint64_t sum = 0;
+            n = size / 8 < MAX_RANDOM_READS ? size / 8 : MAX_RANDOM_READS;
+            for (i = 0; i < n; i ++)
+                sum += p[indices[i] & mask];
+            barrier_data(sum);
+            return n * 8;
+        }
+        default:
+            return 0;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    const double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static void measure(const enum pattern pattern, const size_t size,
+        uint8_t *dst, const uint8_t *src, const uint32_t *indices,
+        const bool quick, struct result *rp)
+{
+    double samples[MAX_REPS];
+    size_t bytes = 0;
+    unsigned i, j, reps, passes;
+
+    passes = size >= MIN_BYTES_PER_SAMPLE ? 1 : MIN_BYTES_PER_SAMPLE / size;
+    reps = ((size_t) 1 << 28) / size;
+    if (reps < 5)
+        reps = 5;
+    if (reps > MAX_REPS)
+        reps = MAX_REPS;
+    if (quick)
+        reps = 5;
+
+    for (i = 0; i < N_WARMUP; i ++)
+        (void) run_pattern(pattern, size, dst, src, indices);
+
+    for (i = 0; i < reps; i ++) {
+        const double start = get_time();
+        for (j = 0; j < passes; j ++)
+            bytes = run_pattern(pattern, size, dst, src, indices);
+        samples[i] = (get_time() - start) / passes;
+    }
+    qsort(samples, reps, sizeof(samples[0]), compare_doubles);
+
+    rp->bytes = bytes;
+    rp->reps = reps;
+    rp->min = samples[0];
+    rp->median = samples[reps / 2];
+    rp->max = samples[reps - 1];
+}
+
+static void report(const struct config *cp, const enum pattern pattern,
+        const size_t size, const struct result *rp,
+        const struct options *op, bool *is_first_jsonp)
+{
+    const double mbps = rp->bytes / rp->median / (1 << 20);
+
+    printf("%-8s %-16s %-6s %9zu %10.1f %10.1f %10.1f %10.1f\n", cp->name,
+            cp->flags_name, pattern_names[pattern], size, rp->min * 1e6,
+            rp->median * 1e6, rp->max * 1e6, mbps);
+
+    if (op->csv != NULL)
+        fprintf(op->csv, "%s,%s,%s,%zu,%zu,%u,%.0f,%.0f,%.0f,%.1f\n",
+                cp->name, cp->flags_name, pattern_names[pattern], size,
+                rp->bytes, rp->reps, rp->min * 1e9, rp->median * 1e9,
+                rp->max * 1e9, mbps);
+
+    if (op->json != NULL) {
+        fprintf(op->json, "%s\n    {\"backend\": \"%s\", \"flags\": \"%s\", "
+                "\"pattern\": \"%s\", \"size\": %zu, \"bytes\": %zu, "
+                "\"reps\": %u, \"min_ns\": %.0f, \"median_ns\": %.0f, "
+                "\"max_ns\": %.0f, \"median_mib_per_s\": %.1f}",
+                *is_first_jsonp ? "" : ",", cp->name, cp->flags_name,
+                pattern_names[pattern], size, rp->bytes, rp->reps,
+                rp->min * 1e9, rp->median * 1e9, rp->max * 1e9, mbps);
+        *is_first_jsonp = false;
+    }
+}
+
+static int run_config(const struct config *cp, const uint32_t *indices,
+        const struct options *op, bool *is_first_jsonp)
+{
+    struct rpimemmgr st;
+    size_t size;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+    st.vcsm_use_cma = cp->backend == BACKEND_VCSM_CMA;
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
+
+    for (size = op->min_size; size <= op->max_size; size *= 2) {
+        void *dst, *src;
+        enum pattern pattern;
+
+        if (alloc_buf(cp, size, &dst, &st)) {
+            fprintf(stderr, "%s %s: cannot allocate %zu bytes; stopping\n",
+                    cp->name, cp->flags_name, size);
+            break;
+        }
+        if (alloc_buf(cp, size, &src, &st)) {
+            fprintf(stderr, "%s %s: cannot allocate %zu bytes; stopping\n",
+                    cp->name, cp->flags_name, size);
+            (void) free_buf(cp, dst, &st);
+            break;
+        }
+        memset(src, 0x55, size);
+        memset(dst, 0xaa, size);
+
+        for (pattern = 0; pattern < N_PATTERNS; pattern ++) {
+            struct result r;
+            measure(pattern, size, dst, src, indices, op->quick, &r);
+            report(cp, pattern, size, &r, op, is_first_jsonp);
+        }
+
+        err = free_buf(cp, src, &st);
+        err |= free_buf(cp, dst, &st);
+        if (err)
+            break;
+    }
+
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+/* Lists what can be run on this board. */
+static unsigned get_configs(struct config *configs,
+        const struct rpimemmgr_caps *caps)
+{
+    static const struct {
+        uint32_t flags;
+        const char *name;
+    } vcsm_types[] = {
+        {VCSM_CACHE_TYPE_NONE, "NONE"},
+        {VCSM_CACHE_TYPE_HOST, "HOST"},
+        {VCSM_CACHE_TYPE_VC, "VC"},
+        {VCSM_CACHE_TYPE_HOST_AND_VC, "HOST_AND_VC"},
+    };
+    static const char * const mailbox_types[] = {
+        "NORMAL", "DIRECT", "COHERENT", "L1_NONALLOCATING",
+    };
+    unsigned i, n = 0;
+
+    configs[n].backend = BACKEND_MALLOC;
+    configs[n].flags = 0;
+    configs[n].name = "malloc";
+    configs[n ++].flags_name = "-";
+
+    if (caps == NULL)
+        return n;
+
+    for (i = 0; i < 4; i ++) {
+        configs[n].backend = BACKEND_VCSM;
+        configs[n].flags = vcsm_types[i].flags;
+        configs[n].name = "vcsm";
+        configs[n ++].flags_name = vcsm_types[i].name;
+    }
+#ifdef RPIMEMMGR_VCSM_HAS_CMA
+    for (i = 0; i < 4; i ++) {
+        configs[n].backend = BACKEND_VCSM_CMA;
+        configs[n].flags = vcsm_types[i].flags;
+        configs[n].name = "vcsm-cma";
+        configs[n ++].flags_name = vcsm_types[i].name;
+    }
+#endif /* RPIMEMMGR_VCSM_HAS_CMA */
+    for (i = 0; i < 4; i ++) {
+        if (!caps->mailbox_mappable[i])
+            continue;
+        configs[n].backend = BACKEND_MAILBOX;
+        configs[n].flags = i << 2;
+        configs[n].name = "mailbox";
+        configs[n ++].flags_name = mailbox_types[i];
+    }
+    if (caps->processor == 3) { /* BCM2711 */
+        configs[n].backend = BACKEND_DRM;
+        configs[n].flags = 0;
+        configs[n].name = "drm";
+        configs[n ++].flags_name = "-";
+    }
+    return n;
+}
+
+static int parse_options(const int argc, char *argv[], struct options *op)
+{
+    static const struct option longopts[] = {
+        {"csv", required_argument, NULL, 'c'},
+        {"json", required_argument, NULL, 'j'},
+        {"min-size", required_argument, NULL, 'm'},
+        {"max-size", required_argument, NULL, 'M'},
+        {"quick", no_argument, NULL, 'q'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+
+    op->csv = op->json = NULL;
+    op->min_size = MIN_SIZE_DEFAULT;
+    op->max_size = MAX_SIZE_DEFAULT;
+    op->quick = false;
+
+    while ((c = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'c':
+            case 'j': {
+                FILE * const fp = fopen(optarg, "w");
+                if (fp == NULL) {
+                    perror(optarg);
+                    return 1;
+                }
+                if (c == 'c')
+                    op->csv = fp;
+                else
+                    op->json = fp;
+                break;
+            }
+            case 'm':
+                op->min_size = strtoull(optarg, NULL, 0);
+                break;
+            case 'M':
+                op->max_size = strtoull(optarg, NULL, 0);
+                break;
+            case 'q':
+                op->quick = true;
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (op->min_size < 64 || op->min_size > op->max_size
+            || op->max_size > (size_t) 1 << 32
+            || (op->min_size & (op->min_size - 1)) != 0) {
+        fprintf(stderr, "Sizes must be powers of two from 64 B to 4 GiB\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct config configs[16];
+    struct rpimemmgr_caps caps;
+    bool has_caps, is_first_json = true;
+    struct options opts;
+    struct rpimemmgr st;
+    uint32_t *indices;
+    unsigned i, n_configs;
+    size_t j;
+    int err;
+
+    err = parse_options(argc, argv, &opts);
+    if (err)
+        return err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    has_caps = !rpimemmgr_get_caps(&caps, &st);
+    err = rpimemmgr_finalize(&st);
+    if (err)
+        return err;
+    n_configs = get_configs(configs, has_caps ? &caps : NULL);
+
+    /* The same random word indices for every run, masked to each size. */
+    indices = malloc(sizeof(*indices) * MAX_RANDOM_READS);
+    if (indices == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    srand(1);
+    for (j = 0; j < MAX_RANDOM_READS; j ++)
+        indices[j] = (uint32_t) rand() << 16 ^ (uint32_t) rand();
+
+    if (opts.csv != NULL)
+        fprintf(opts.csv, "backend,flags,pattern,size,bytes,reps,min_ns,"
+                "median_ns,max_ns,median_mib_per_s\n");
+    if (opts.json != NULL)
+        fprintf(opts.json, "{\n  \"board_revision\": %u,\n"
+                "  \"processor\": %d,\n  \"results\": [",
+                has_caps ? caps.board_revision : 0,
+                has_caps ? caps.processor : -1);
+
+    printf("%-8s %-16s %-6s %9s %10s %10s %10s %10s\n", "backend", "flags",
+            "pattern", "size", "min[us]", "med[us]", "max[us]", "med[MiB/s]");
+    for (i = 0; i < n_configs; i ++) {
+        err = run_config(&configs[i], indices, &opts, &is_first_json);
+        if (err)
+            break;
+    }
+
+    if (opts.json != NULL) {
+        fprintf(opts.json, "\n  ]\n}\n");
+        (void) fclose(opts.json);
+    }
+    if (opts.csv != NULL)
+        (void) fclose(opts.csv);
+    free(indices);
+    return err;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Batch allocation on the simulated backend: results, rollback on failure,
+ * and the rate compared to one call per buffer.  On a Raspberry Pi the rate
+ * is measured with Mailbox as well.
+ */
+
+#define N_BUFS 64
+#define N_ITERS 100
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void fill_descs(struct rpimemmgr_alloc_desc *descs, const size_t n,
+        const uint32_t flags)
+{
+    size_t i;
+
+    for (i = 0; i < n; i ++) {
+        descs[i].size = (i % 4 == 0) ? 1 << 16 : 256 << (i % 4);
+        descs[i].align = 4096;
+        descs[i].flags = flags;
+    }
+}
+
+static int test_batch(void)
+{
+    struct rpimemmgr_alloc_desc descs[N_BUFS];
+    void *usraddrs[N_BUFS];
+    uint32_t busaddrs[N_BUFS];
+    struct rpimemmgr st;
+    size_t i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    /* No pool and no recycling: the first bus addresses are predictable. */
+    fill_descs(descs, 4, 0);
+    descs[3].size = 0;
+    err = rpimemmgr_alloc_batch(RPIMEMMGR_BACKEND_SIM, 4, descs, usraddrs,
+            busaddrs, &st);
+    if (!err) {
+        fprintf(stderr, "A batch with an invalid size succeeded\n");
+        return 1;
+    }
+    if (rpimemmgr_free_by_busaddr(0x40000000, &st) == 0) {
+        fprintf(stderr, "A failed batch was not rolled back\n");
+        return 1;
+    }
+
+    err = rpimemmgr_set_pool(1 << 20, 4096, &st);
+    if (err)
+        return err;
+
+    fill_descs(descs, N_BUFS, 0);
+    err = rpimemmgr_alloc_batch(RPIMEMMGR_BACKEND_SIM, N_BUFS, descs,
+            usraddrs, busaddrs, &st);
+    if (err)
+        return err;
+
+    for (i = 0; i < N_BUFS; i ++) {
+        const uint8_t * const last =
+                (uint8_t*) usraddrs[i] + descs[i].size - 1;
+        memset(usraddrs[i], i, descs[i].size);
+        if (rpimemmgr_usraddr_to_busaddr(usraddrs[i], &st) != busaddrs[i]
+                || rpimemmgr_usraddr_to_busaddr(last, &st)
+                != busaddrs[i] + descs[i].size - 1) {
+            fprintf(stderr, "Wrong translation: usraddr=%p\n", usraddrs[i]);
+            return 1;
+        }
+    }
+    for (i = 0; i < N_BUFS; i ++) {
+        size_t j;
+        for (j = 0; j < descs[i].size; j ++) {
+            if (((uint8_t*) usraddrs[i])[j] != (uint8_t) i) {
+                fprintf(stderr, "Overlapping buffers: usraddr=%p\n",
+                        usraddrs[i]);
+                return 1;
+            }
+        }
+        err = rpimemmgr_free_by_usraddr(usraddrs[i], &st);
+        if (err)
+            return err;
+    }
+
+    return rpimemmgr_finalize(&st);
+}
+
+static int alloc_free_rate(const enum rpimemmgr_backend backend,
+        const uint32_t flags, const bool use_batch)
+{
+    struct rpimemmgr_alloc_desc descs[N_BUFS];
+    void *usraddrs[N_BUFS];
+    double start, end;
+    unsigned i, j;
+    struct rpimemmgr st;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    fill_descs(descs, N_BUFS, flags);
+
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        if (use_batch)
+            err = rpimemmgr_alloc_batch(backend, N_BUFS, descs, usraddrs,
+                    NULL, &st);
+        for (j = 0; !use_batch && !err && j < N_BUFS; j ++) {
+            if (backend == RPIMEMMGR_BACKEND_MAILBOX)
+                err = rpimemmgr_alloc_mailbox(descs[j].size, descs[j].align,
+                        flags, &usraddrs[j], NULL, &st);
+            else
+                err = rpimemmgr_alloc_sim(descs[j].size, descs[j].align,
+                        &usraddrs[j], NULL, &st);
+        }
+        if (err)
+            goto clean_init;
+        for (j = 0; j < N_BUFS; j ++) {
+            err = rpimemmgr_free_by_usraddr(usraddrs[j], &st);
+            if (err)
+                goto clean_init;
+        }
+    }
+    end = get_time();
+
+    printf("%-8s %-10s: %10.0f [buf/s]\n",
+            backend == RPIMEMMGR_BACKEND_MAILBOX ? "Mailbox" : "sim",
+            use_batch ? "batch" : "one by one",
+            (double) N_ITERS * N_BUFS / (end - start));
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    bool on_pi;
+    int err;
+
+    printf("Batch (sim):                  ");
+    err = test_batch();
+    if (err)
+        return err;
+    printf("OK\n");
+
+    err = alloc_free_rate(RPIMEMMGR_BACKEND_SIM, 0, false);
+    err = err ? err : alloc_free_rate(RPIMEMMGR_BACKEND_SIM, 0, true);
+    if (err)
+        return err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    on_pi = rpimemmgr_get_processor(&st) >= 0;
+    err = rpimemmgr_finalize(&st);
+    if (err || !on_pi)
+        return err;
+
+    err = alloc_free_rate(RPIMEMMGR_BACKEND_MAILBOX, MEM_FLAG_DIRECT, false);
+    err = err ? err : alloc_free_rate(RPIMEMMGR_BACKEND_MAILBOX,
+            MEM_FLAG_DIRECT, true);
+    return err;
+}
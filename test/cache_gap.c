@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "local.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * Gap bridging of the cache op buffer that rpimemmgr_sync_array() uses for
+ * VCSM memory, without VCSM: vcsm_clean_invalid2() is replaced by a stand-in
+ * that records the entries it is given.  Cleans of one buffer that are close
+ * are merged over the gap; invalidates must stay apart, since invalidating
+ * the gap would discard writes that nobody asked to sync.
+ */
+
+#define MAX_GAP 1024
+#define MAX_ENTRIES 16
+
+static struct vcsm_user_clean_invalid2_block_s entries[MAX_ENTRIES];
+static unsigned n_entries;
+
+/* Links ahead of libvcsm, so the library calls this one. */
+int vcsm_clean_invalid2(struct vcsm_user_clean_invalid2_s *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->op_count && n_entries < MAX_ENTRIES; i ++)
+        entries[n_entries ++] = s->s[i];
+    return 0;
+}
+
+static int expect(const char *what, const bool cond)
+{
+    if (!cond) {
+        fprintf(stderr, "Failed: %s\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+/* Issues n ranges of one buffer through a cache op buffer. */
+static int run(const size_t n, const struct rpimemmgr_cache_op_desc *descs)
+{
+    static const int owner;
+    struct cache_op_buf buf;
+    size_t i;
+    int err;
+
+    n_entries = 0;
+    cache_op_buf_init(&buf, MAX_GAP);
+    for (i = 0; i < n; i ++) {
+        err = cache_op_buf_add(&buf, &descs[i], &owner);
+        if (err)
+            return err;
+    }
+    return cache_op_buf_flush(&buf);
+}
+
+static int test_gap(const enum rpimemmgr_cache_op op, uint8_t *p)
+{
+    const bool is_clean = (op == RPIMEMMGR_CACHE_OP_CLEAN);
+    const unsigned mode = is_clean ? 2 : 1;
+    struct rpimemmgr_cache_op_desc descs[2];
+    int err, err_sum = 0;
+
+    /* Two ranges 64 bytes apart. */
+    descs[0].op = op;
+    descs[0].usraddr = p;
+    descs[0].block_count = 1;
+    descs[0].block_size = 256;
+    descs[0].stride = 0;
+    descs[1] = descs[0];
+    descs[1].usraddr = p + 256 + 64;
+    err = run(2, descs);
+    if (err)
+        return err;
+    if (is_clean)
+        err_sum |= expect("clean over a gap is one entry",
+                n_entries == 1 && entries[0].start_address == p
+                && entries[0].block_size == 256 + 64 + 256
+                && entries[0].invalidate_mode == mode);
+    else
+        err_sum |= expect("invalidates with a gap stay two entries",
+                n_entries == 2 && entries[0].start_address == p
+                && entries[0].block_size == 256
+                && entries[1].start_address == p + 256 + 64
+                && entries[1].block_size == 256
+                && entries[0].invalidate_mode == mode
+                && entries[1].invalidate_mode == mode);
+
+    /* Touching ranges are merged whatever the op. */
+    descs[1].usraddr = p + 256;
+    err = run(2, descs);
+    if (err)
+        return err;
+    err_sum |= expect("touching ranges are one entry",
+            n_entries == 1 && entries[0].block_size == 512);
+
+    /* 64-byte blocks every 128 bytes. */
+    descs[0].block_count = 4;
+    descs[0].block_size = 64;
+    descs[0].stride = 128;
+    err = run(1, descs);
+    if (err)
+        return err;
+    if (is_clean)
+        err_sum |= expect("close strided clean is folded",
+                n_entries == 1 && entries[0].block_count == 1
+                && entries[0].block_size == 3 * 128 + 64);
+    else
+        err_sum |= expect("strided invalidate is left strided",
+                n_entries == 1 && entries[0].block_count == 4
+                && entries[0].block_size == 64
+                && entries[0].inter_block_stride == 128);
+
+    return err_sum;
+}
+
+int main(void)
+{
+    static uint8_t buf[4096];
+    int err;
+
+    printf("Gap bridging of cleans:       ");
+    err = test_gap(RPIMEMMGR_CACHE_OP_CLEAN, buf);
+    if (err)
+        return err;
+    printf("OK\n");
+
+    printf("No bridging of invalidates:   ");
+    err = test_gap(RPIMEMMGR_CACHE_OP_INVALIDATE, buf);
+    if (err)
+        return err;
+    printf("OK\n");
+    return 0;
+}
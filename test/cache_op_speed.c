@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+/*
+ * Cache maintenance of many small ranges in one rpimemmgr_cache_op_array()
+ * call versus 8 entries per call, which is what the varargs functions used
+ * to do.  Then the crossover of gap bridging in rpimemmgr_sync_array(): 1 KiB
+ * ranges separated by a growing gap, synced as separate entries and as one
+ * range over the gaps.  The gap where the two times cross is what
+ * rpimemmgr_set_sync_gap() should be set to.  Runs only where VCSM is
+ * available.
+ */
+
+#define BUF_SIZE (1 << 22)
+#define MAX_RANGES 1024
+#define N_ITERS 100
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int bench(const size_t n_ranges, const size_t per_call,
+        struct rpimemmgr_cache_op_desc *descs)
+{
+    double start, end;
+    unsigned i;
+    size_t j;
+
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        for (j = 0; j < n_ranges; j += per_call) {
+            const size_t n = n_ranges - j < per_call ? n_ranges - j : per_call;
+            int err = rpimemmgr_cache_op_array(n, &descs[j]);
+            if (err)
+                return err;
+        }
+    }
+    end = get_time();
+
+    printf("%4zu ranges, %3zu per call: %4zu ioctls, %10.2f [us]\n",
+            n_ranges, per_call, (n_ranges + per_call - 1) / per_call
+                    * ((per_call + 254) / 255),
+            (end - start) / N_ITERS * 1e6);
+    return 0;
+}
+
+static int bench_gap(const size_t gap, uint8_t *p, struct rpimemmgr *sp,
+        struct rpimemmgr_cache_op_desc *descs)
+{
+    const size_t n_ranges = MIN(MAX_RANGES, BUF_SIZE / (1024 + gap));
+    double elapsed[2];
+    unsigned i, j;
+    int err;
+
+    for (i = 0; i < n_ranges; i ++) {
+        descs[i].op = RPIMEMMGR_CACHE_OP_CLEAN;
+        descs[i].usraddr = p + i * (1024 + gap);
+        descs[i].block_count = 1;
+        descs[i].block_size = 1024;
+        descs[i].stride = 0;
+    }
+
+    for (j = 0; j < 2; j ++) {
+        double start;
+
+        err = rpimemmgr_set_sync_gap(j == 0 ? 0 : gap, sp);
+        if (err)
+            return err;
+
+        start = get_time();
+        for (i = 0; i < N_ITERS; i ++) {
+            err = rpimemmgr_sync_array(n_ranges, descs, sp);
+            if (err)
+                return err;
+        }
+        elapsed[j] = (get_time() - start) / N_ITERS / n_ranges;
+    }
+
+    printf("gap %6zu: separate %8.3f [us/range], bridged %8.3f [us/range]\n",
+            gap, elapsed[0] * 1e6, elapsed[1] * 1e6);
+    return 0;
+}
+
+int main(void)
+{
+    static const size_t n_rangess[] = {8, 64, 200, 1024};
+    static struct rpimemmgr_cache_op_desc descs[MAX_RANGES];
+    struct rpimemmgr st;
+    uint8_t *p;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    if (rpimemmgr_alloc_vcsm(BUF_SIZE, 4096, VCSM_CACHE_TYPE_HOST,
+                (void**) &p, NULL, &st)) {
+        printf("VCSM is not available; skipping\n");
+        return rpimemmgr_finalize(&st);
+    }
+
+    /* 1 KiB ranges 4 KiB apart, as for scattered writes. */
+    for (i = 0; i < MAX_RANGES; i ++) {
+        descs[i].op = RPIMEMMGR_CACHE_OP_CLEAN;
+        descs[i].usraddr = p + (size_t) i * (BUF_SIZE / MAX_RANGES);
+        descs[i].block_count = 1;
+        descs[i].block_size = 1024;
+        descs[i].stride = 0;
+    }
+
+    for (i = 0; i < sizeof(n_rangess) / sizeof(n_rangess[0]); i ++) {
+        err = bench(n_rangess[i], 8, descs);
+        if (err)
+            break;
+        err = bench(n_rangess[i], n_rangess[i], descs);
+        if (err)
+            break;
+    }
+
+    for (i = 64; !err && i <= 65536; i *= 2)
+        err = bench_gap(i, p, &st, descs);
+
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <mailbox.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Every Mailbox allocation used to query the board revision first.  This
+ * measures that round trip, which is now saved per allocation, against the
+ * cached query and a whole Mailbox alloc/free.  Runs only on a Raspberry Pi.
+ */
+
+#define N_ITERS 1000
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int check_caps(const struct rpimemmgr_caps *caps, struct rpimemmgr *sp)
+{
+    const unsigned direct = (MEM_FLAG_DIRECT & MEM_FLAG_L1_NONALLOCATING) >> 2;
+
+    if (caps->processor != rpimemmgr_get_processor(sp)) {
+        fprintf(stderr, "Inconsistent processor: %d\n", caps->processor);
+        return 1;
+    }
+    if (!caps->mailbox_mappable[direct]) {
+        fprintf(stderr, "DIRECT must be mappable on all SoCs\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int bench_caps(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_caps caps;
+    uint32_t board_revision;
+    double start, end;
+    unsigned i;
+    int fd, err;
+
+    fd = mailbox_open();
+    if (fd == -1)
+        return 1;
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        err = mailbox_get_board_revision(fd, &board_revision);
+        if (err)
+            break;
+    }
+    end = get_time();
+    (void) mailbox_close(fd);
+    if (err)
+        return err;
+    printf("Board revision query:   %8.2f [us]\n",
+            (end - start) / N_ITERS * 1e6);
+
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        err = rpimemmgr_get_caps(&caps, sp);
+        if (err)
+            return err;
+    }
+    end = get_time();
+    printf("rpimemmgr_get_caps:     %8.2f [us]\n",
+            (end - start) / N_ITERS * 1e6);
+
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        uint32_t busaddr;
+        err = rpimemmgr_alloc_mailbox(4096, 4096, MEM_FLAG_DIRECT, NULL,
+                &busaddr, sp);
+        if (err)
+            return err;
+        err = rpimemmgr_free_by_busaddr(busaddr, sp);
+        if (err)
+            return err;
+    }
+    end = get_time();
+    printf("Mailbox alloc and free: %8.2f [us]\n",
+            (end - start) / N_ITERS * 1e6);
+    return 0;
+}
+
+int main(void)
+{
+    struct rpimemmgr_caps caps;
+    struct rpimemmgr st;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    if (rpimemmgr_get_caps(&caps, &st)) {
+        printf("Mailbox is not available; skipping\n");
+        return rpimemmgr_finalize(&st);
+    }
+
+    printf("Board revision 0x%08x, processor %d\n", caps.board_revision,
+            caps.processor);
+    err = check_caps(&caps, &st);
+    if (!err)
+        err = bench_caps(&st);
+
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
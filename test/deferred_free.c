@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "fake_drm.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Deferred free of DRM buffers: the buffer disappears from lookups at once,
+ * is released by the next reap or allocation, and finalization releases what
+ * is left.  With the recycle cache on, a released buffer comes back from the
+ * next allocation of its size, which shows that it was released.  Then the
+ * time spent in the free call itself, immediate against deferred.
+ */
+
+#define N_BUFS 256
+#define BUF_SIZE (64 << 10)
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int test_deferred(struct rpimemmgr *sp)
+{
+    uint32_t busaddr, busaddr2;
+    void *p;
+    int err;
+
+    err = rpimemmgr_set_recycle(16 << 20, 0, sp);
+    err = err ? err : rpimemmgr_alloc_drm(BUF_SIZE, &p, &busaddr, sp);
+    err = err ? err : rpimemmgr_free_deferred_by_usraddr(p, sp);
+    if (err)
+        return err;
+    if (rpimemmgr_free_by_busaddr(busaddr, sp) == 0) {
+        fprintf(stderr, "Deferred buffer is still registered\n");
+        return 1;
+    }
+
+    /* The allocation reaps the idle buffer first and gets it back. */
+    err = rpimemmgr_alloc_drm(BUF_SIZE, &p, &busaddr2, sp);
+    if (err || busaddr2 != busaddr) {
+        fprintf(stderr, "Deferred buffer was not reaped on alloc\n");
+        return 1;
+    }
+
+    err = rpimemmgr_free_deferred_by_busaddr(busaddr2, sp);
+    err = err ? err : rpimemmgr_reap_deferred(false, sp);
+    err = err ? err : rpimemmgr_set_recycle(0, 0, sp);
+    if (err)
+        return err;
+
+    /* Left for rpimemmgr_finalize(). */
+    err = rpimemmgr_alloc_drm(BUF_SIZE, NULL, &busaddr, sp);
+    return err ? err : rpimemmgr_free_deferred_by_busaddr(busaddr, sp);
+}
+
+static int bench(const bool is_deferred)
+{
+    static uint32_t busaddrs[N_BUFS];
+    struct rpimemmgr st;
+    double start, end;
+    unsigned i;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_alloc_drm(BUF_SIZE, NULL, &busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+
+    start = get_time();
+    for (i = 0; i < N_BUFS; i ++) {
+        err = is_deferred
+                ? rpimemmgr_free_deferred_by_busaddr(busaddrs[i], &st)
+                : rpimemmgr_free_by_busaddr(busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    end = get_time();
+
+    printf("DRM free %-8s: %8.2f [us/buf]\n",
+            is_deferred ? "deferred" : "now", (end - start) / N_BUFS * 1e6);
+
+    err = rpimemmgr_reap_deferred(true, &st);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    uint32_t busaddr;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_alloc_sim(4096, 4096, NULL, &busaddr, &st);
+    if (err)
+        return err;
+    if (rpimemmgr_free_deferred_by_busaddr(busaddr, &st) == 0) {
+        fprintf(stderr, "Deferred a non-DRM buffer\n");
+        return 1;
+    }
+
+    if (rpimemmgr_alloc_drm(4096, NULL, &busaddr, &st)) {
+        printf("DRM is not available; skipping\n");
+        return rpimemmgr_finalize(&st);
+    }
+    err = rpimemmgr_free_by_busaddr(busaddr, &st);
+    err = err ? err : test_deferred(&st);
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    if (err)
+        return err;
+    printf("Deferred free (DRM):          OK\n");
+
+    err = bench(false);
+    return err ? err : bench(true);
+}
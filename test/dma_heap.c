@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+/*
+ * dma-heap allocations from the system heap: they are mapped, synced, found
+ * by usraddr only, exported, batched, recycled unless exported, and never
+ * pooled.  Needs /dev/dma_heap/system; skipped otherwise.
+ */
+
+#define BUF_SIZE (1 << 20)
+#define N_BUFS 4
+
+static int test_alloc(struct rpimemmgr *sp)
+{
+    uint8_t *p, *q;
+    int fd, err;
+
+    if (rpimemmgr_alloc_dma_heap(BUF_SIZE, RPIMEMMGR_DMA_HEAP_SYSTEM, NULL,
+                sp) == 0) {
+        fprintf(stderr, "Allocated an unmapped dma-heap buffer\n");
+        return 1;
+    }
+
+    err = rpimemmgr_alloc_dma_heap(BUF_SIZE, RPIMEMMGR_DMA_HEAP_SYSTEM,
+            (void**) &p, sp);
+    if (err)
+        return err;
+    memset(p, 0x5a, BUF_SIZE);
+    err = rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, p, BUF_SIZE, sp);
+    if (err)
+        return err;
+    if (rpimemmgr_usraddr_to_busaddr(p + 100, sp) != 0) {
+        fprintf(stderr, "dma-heap buffer has a bus address\n");
+        return 1;
+    }
+
+    err = rpimemmgr_export_dmabuf_by_usraddr(p, &fd, sp);
+    if (err)
+        return err;
+    q = mmap(NULL, BUF_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (q == MAP_FAILED || q[BUF_SIZE - 1] != 0x5a) {
+        fprintf(stderr, "Exported fd does not map the buffer\n");
+        return 1;
+    }
+    (void) munmap(q, BUF_SIZE);
+
+    return rpimemmgr_free_by_usraddr(p, sp);
+}
+
+static int test_batch(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_alloc_desc descs[N_BUFS];
+    void *ps[N_BUFS];
+    unsigned i;
+    int err;
+
+    for (i = 0; i < N_BUFS; i ++) {
+        descs[i].size = 4096 << i;
+        descs[i].align = 4096;
+        descs[i].flags = RPIMEMMGR_DMA_HEAP_SYSTEM;
+    }
+    err = rpimemmgr_alloc_batch(RPIMEMMGR_BACKEND_DMABUF, N_BUFS, descs, ps,
+            NULL, sp);
+    if (err)
+        return err;
+    for (i = 0; i < N_BUFS; i ++) {
+        memset(ps[i], i, descs[i].size);
+        err = rpimemmgr_free_by_usraddr(ps[i], sp);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+static uint64_t get_dmabuf_frees(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_stats stats;
+
+    if (rpimemmgr_get_stats(&stats, sp))
+        return 0;
+    return stats.backends[RPIMEMMGR_BACKEND_DMABUF].n_frees;
+}
+
+/*
+ * Freed buffers come back from the recycle cache, except exported ones, which
+ * go back to the heap; the pool is bypassed.
+ */
+static int test_recycle(struct rpimemmgr *sp)
+{
+    uint64_t n_frees;
+    void *p, *q, *r;
+    int fd, err;
+
+    err = rpimemmgr_set_pool(1 << 20, 64 << 10, sp);
+    err = err ? err : rpimemmgr_set_recycle(16 << 20, 0, sp);
+    err = err ? err : rpimemmgr_alloc_dma_heap(4096,
+            RPIMEMMGR_DMA_HEAP_SYSTEM, &p, sp);
+    err = err ? err : rpimemmgr_alloc_dma_heap(4096,
+            RPIMEMMGR_DMA_HEAP_SYSTEM, &q, sp);
+    if (err)
+        return err;
+    /* Pooled blocks cannot be exported. */
+    err = rpimemmgr_export_dmabuf_by_usraddr(p, &fd, sp);
+    if (err) {
+        fprintf(stderr, "dma-heap buffer was pooled\n");
+        return err;
+    }
+    (void) close(fd);
+    err = rpimemmgr_free_by_usraddr(q, sp);
+    err = err ? err : rpimemmgr_alloc_dma_heap(4096,
+            RPIMEMMGR_DMA_HEAP_SYSTEM, &r, sp);
+    if (err)
+        return err;
+    if (r != q) {
+        fprintf(stderr, "dma-heap buffer was not recycled\n");
+        return 1;
+    }
+    n_frees = get_dmabuf_frees(sp);
+    err = rpimemmgr_free_by_usraddr(p, sp);
+    if (err)
+        return err;
+    if (get_dmabuf_frees(sp) != n_frees + 1) {
+        fprintf(stderr, "Exported dma-heap buffer was recycled\n");
+        return 1;
+    }
+    err = rpimemmgr_free_by_usraddr(r, sp);
+    err = err ? err : rpimemmgr_set_recycle(0, 0, sp);
+    return err ? err : rpimemmgr_set_pool(0, 0, sp);
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    void *p;
+    int err;
+
+    if (access("/dev/dma_heap/system", R_OK | W_OK)) {
+        printf("dma-heap is not available; skipping\n");
+        return 0;
+    }
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    printf("dma-heap (system): ");
+    err = test_alloc(&st);
+    err = err ? err : test_batch(&st);
+    err = err ? err : test_recycle(&st);
+    if (err)
+        goto clean_init;
+    printf("OK\n");
+
+    /* Left for rpimemmgr_finalize(). */
+    err = rpimemmgr_alloc_dma_heap(BUF_SIZE, RPIMEMMGR_DMA_HEAP_SYSTEM, &p,
+            &st);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#define _GNU_SOURCE
+#include "rpimemmgr.h"
+#include "fake_drm.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+/* From <linux/udmabuf.h>, which kernel headers before 4.20 do not have. */
+struct udmabuf_create {
+    __u32 memfd;
+    __u32 flags;
+    __u64 offset;
+    __u64 size;
+};
+#define UDMABUF_FLAGS_CLOEXEC 0x01
+#define UDMABUF_CREATE _IOW('u', 0x42, struct udmabuf_create)
+
+/*
+ * dma-buf import and export.  A memfd is wrapped into a dma-buf with udmabuf;
+ * the import is skipped without /dev/udmabuf.  The imported buffer must share
+ * pages with the memfd, export to an fd that maps the same pages, and be found
+ * by usraddr only.  Imports left at finalization must be closed.  A DRM buffer
+ * is exported and imported back if real DRM is available; importing it into
+ * DRM again must be refused without closing it, and it must not be recycled.
+ */
+
+#define BUF_SIZE (1 << 20)
+
+static int count_fds(void)
+{
+    DIR *dp;
+    int n = 0;
+
+    dp = opendir("/proc/self/fd");
+    if (dp == NULL)
+        return -1;
+    while (readdir(dp) != NULL)
+        n ++;
+    (void) closedir(dp);
+    return n;
+}
+
+/* Returns a dma-buf over memfd, or -1. */
+static int create_udmabuf(const int memfd)
+{
+    struct udmabuf_create create = {
+        .memfd = memfd,
+        .flags = UDMABUF_FLAGS_CLOEXEC,
+        .offset = 0,
+        .size = BUF_SIZE,
+    };
+    int fd, dmabuf_fd;
+
+    fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    dmabuf_fd = ioctl(fd, UDMABUF_CREATE, &create);
+    (void) close(fd);
+    return dmabuf_fd;
+}
+
+static int test_import(const int memfd, const int dmabuf_fd,
+        struct rpimemmgr *sp)
+{
+    uint8_t *p, *q, byte;
+    uint32_t busaddr;
+    size_t size;
+    int fd, err;
+
+    err = rpimemmgr_import_dmabuf(RPIMEMMGR_BACKEND_DMABUF, dmabuf_fd, &size,
+            (void**) &p, &busaddr, sp);
+    if (err)
+        return err;
+    if (size != BUF_SIZE || busaddr != 0
+            || rpimemmgr_usraddr_to_busaddr(p + 100, sp) != 0) {
+        fprintf(stderr, "Wrong size or bus address\n");
+        return 1;
+    }
+
+    memset(p, 0xa5, BUF_SIZE);
+    err = rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, p, BUF_SIZE, sp);
+    if (err || pread(memfd, &byte, 1, BUF_SIZE - 1) != 1 || byte != 0xa5) {
+        fprintf(stderr, "Imported buffer does not share the pages\n");
+        return 1;
+    }
+
+    err = rpimemmgr_export_dmabuf_by_usraddr(p, &fd, sp);
+    if (err)
+        return err;
+    q = mmap(NULL, BUF_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (q == MAP_FAILED || q[0] != 0xa5) {
+        fprintf(stderr, "Exported fd does not map the buffer\n");
+        return 1;
+    }
+    (void) munmap(q, BUF_SIZE);
+
+    return rpimemmgr_free_by_usraddr(p, sp);
+}
+
+static uint64_t get_drm_frees(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_stats stats;
+
+    if (rpimemmgr_get_stats(&stats, sp))
+        return 0;
+    return stats.backends[RPIMEMMGR_BACKEND_DRM].n_frees;
+}
+
+/* DRM buffer -> dma-buf -> CPU-only import, both views of the same pages. */
+static int test_drm(struct rpimemmgr *sp)
+{
+    uint32_t busaddr;
+    uint64_t n_frees;
+    uint8_t *p, *q;
+    int fd, err;
+
+    if (rpimemmgr_alloc_drm(BUF_SIZE, (void**) &p, &busaddr, sp))
+        return 0;
+    if (rpimemmgr_export_dmabuf_by_busaddr(busaddr, &fd, sp)) {
+        printf("(DRM export not available) ");
+        return rpimemmgr_free_by_busaddr(busaddr, sp);
+    }
+
+    /* Our own BO: the import would take over its GEM handle. */
+    if (rpimemmgr_import_dmabuf(RPIMEMMGR_BACKEND_DRM, fd, NULL, NULL, NULL,
+                sp) == 0) {
+        fprintf(stderr, "Imported a registered DRM buffer\n");
+        (void) close(fd);
+        return 1;
+    }
+    err = rpimemmgr_import_dmabuf(RPIMEMMGR_BACKEND_DMABUF, fd, NULL,
+            (void**) &q, NULL, sp);
+    (void) close(fd);
+    if (err)
+        return err;
+    memset(p, 0x3c, BUF_SIZE);
+    err = rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, p, BUF_SIZE, sp);
+    err = err ? err : rpimemmgr_sync(RPIMEMMGR_CACHE_OP_INVALIDATE, q,
+            BUF_SIZE, sp);
+    if (err || q[BUF_SIZE - 1] != 0x3c) {
+        fprintf(stderr, "DRM buffer and its import differ\n");
+        return 1;
+    }
+
+    /* The exporter may still use it, so it must not be handed out again. */
+    n_frees = get_drm_frees(sp);
+    err = rpimemmgr_free_by_usraddr(q, sp);
+    err = err ? err : rpimemmgr_set_recycle(4 * BUF_SIZE, 0, sp);
+    err = err ? err : rpimemmgr_free_by_busaddr(busaddr, sp);
+    err = err ? err : rpimemmgr_set_recycle(0, 0, sp);
+    if (err)
+        return err;
+    if (get_drm_frees(sp) != n_frees + 1) {
+        fprintf(stderr, "Exported DRM buffer was recycled\n");
+        return 1;
+    }
+    printf("(with DRM) ");
+    return 0;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    uint32_t busaddr;
+    void *p;
+    int memfd, dmabuf_fd, n_fds, fd, err;
+
+    memfd = memfd_create("rpimemmgr-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd == -1 || ftruncate(memfd, BUF_SIZE)
+            || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK)) {
+        perror("memfd");
+        return 1;
+    }
+    dmabuf_fd = create_udmabuf(memfd);
+    if (dmabuf_fd == -1)
+        printf("udmabuf is not available; skipping the import\n");
+
+    n_fds = count_fds();
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_alloc_sim(4096, 4096, &p, &busaddr, &st);
+    if (err)
+        goto clean_init;
+    if (rpimemmgr_export_dmabuf_by_usraddr(p, &fd, &st) == 0
+            || rpimemmgr_import_dmabuf(RPIMEMMGR_BACKEND_SIM, memfd, NULL,
+                    &p, NULL, &st) == 0) {
+        fprintf(stderr, "Exported or imported simulated memory\n");
+        err = 1;
+        goto clean_init;
+    }
+
+    printf("dma-buf import and export: ");
+    if (dmabuf_fd != -1)
+        err = test_import(memfd, dmabuf_fd, &st);
+    err = err ? err : test_drm(&st);
+    if (err)
+        goto clean_init;
+    printf("OK\n");
+
+    /* Left for rpimemmgr_finalize(). */
+    if (dmabuf_fd != -1)
+        err = rpimemmgr_import_dmabuf(RPIMEMMGR_BACKEND_DMABUF, dmabuf_fd,
+                NULL, &p, NULL, &st);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    if (!err && count_fds() != n_fds) {
+        fprintf(stderr, "Leaked fds of imported buffers\n");
+        err = 1;
+    }
+    return err;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "fake_drm.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * DRM buffer objects through the recycle cache: a freed BO is handed out
+ * again with its mapping, BOs of another size bucket are not, and expired BOs
+ * are released, as the DRM free counter tells.  Then the time of an
+ * allocate/free cycle with and without the cache.  Runs against the stand-in
+ * device of fake_drm.c with RPIMEMMGR_FAKE_DRM=1.
+ */
+
+#define N_ITERS 4096
+#define BUF_SIZE (64 << 10)
+#define MAX_AGE_MS 20
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t get_drm_frees(struct rpimemmgr *sp)
+{
+    struct rpimemmgr_stats stats;
+
+    if (rpimemmgr_get_stats(&stats, sp))
+        return 0;
+    return stats.backends[RPIMEMMGR_BACKEND_DRM].n_frees;
+}
+
+static int test_reuse(struct rpimemmgr *sp)
+{
+    const struct timespec wait = {.tv_nsec = MAX_AGE_MS * 2 * 1000000};
+    uint32_t busaddr, busaddr2;
+    uint64_t n_frees;
+    uint8_t *p, *q;
+    int err;
+
+    err = rpimemmgr_set_recycle(16 << 20, MAX_AGE_MS, sp);
+    if (err)
+        return err;
+
+    err = rpimemmgr_alloc_drm(BUF_SIZE, (void**) &p, &busaddr, sp);
+    if (err)
+        return err;
+    memset(p, 0x5a, BUF_SIZE);
+    err = rpimemmgr_free_by_busaddr(busaddr, sp);
+    /* Same page-rounded size. */
+    err = err ? err : rpimemmgr_alloc_drm(BUF_SIZE - 100, (void**) &q,
+            &busaddr2, sp);
+    if (err || busaddr2 != busaddr || q != p || q[BUF_SIZE - 1] != 0x5a) {
+        fprintf(stderr, "BO was not reused\n");
+        return 1;
+    }
+
+    err = rpimemmgr_alloc_drm(BUF_SIZE * 2, NULL, &busaddr, sp);
+    if (err || busaddr == busaddr2) {
+        fprintf(stderr, "BO reused for another size\n");
+        return 1;
+    }
+    n_frees = get_drm_frees(sp);
+    err = rpimemmgr_free_by_busaddr(busaddr, sp);
+    err = err ? err : rpimemmgr_free_by_busaddr(busaddr2, sp);
+    if (err)
+        return err;
+    if (get_drm_frees(sp) != n_frees) {
+        fprintf(stderr, "Freed BOs were not cached\n");
+        return 1;
+    }
+
+    /* Both are cached; once expired, a trim releases them. */
+    (void) nanosleep(&wait, NULL);
+    err = rpimemmgr_trim_recycle(SIZE_MAX, sp);
+    if (err || get_drm_frees(sp) != n_frees + 2) {
+        fprintf(stderr, "Expired BO was not released\n");
+        return 1;
+    }
+
+    return rpimemmgr_set_recycle(0, 0, sp);
+}
+
+static int bench(const bool use_cache)
+{
+    struct rpimemmgr st;
+    double start, end;
+    unsigned i;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+    if (use_cache) {
+        err = rpimemmgr_set_recycle(16 << 20, 1000, &st);
+        if (err)
+            goto clean_init;
+    }
+
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        uint32_t busaddr;
+        void *p;
+        err = rpimemmgr_alloc_drm(BUF_SIZE, &p, &busaddr, &st);
+        err = err ? err : rpimemmgr_free_by_busaddr(busaddr, &st);
+        if (err)
+            goto clean_init;
+    }
+    end = get_time();
+
+    printf("DRM alloc/free %-8s: %8.2f [us/cycle]\n",
+            use_cache ? "cached" : "uncached", (end - start) / N_ITERS * 1e6);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    uint32_t busaddr;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+
+    if (rpimemmgr_alloc_drm(4096, NULL, &busaddr, &st)) {
+        printf("DRM is not available; skipping\n");
+        return rpimemmgr_finalize(&st);
+    }
+    err = rpimemmgr_free_by_busaddr(busaddr, &st);
+    err = err ? err : test_reuse(&st);
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    if (err)
+        return err;
+    printf("DRM BO reuse and eviction:    OK\n");
+
+    err = bench(false);
+    return err ? err : bench(true);
+}
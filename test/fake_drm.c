@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/* For memfd_create() and fallocate(). */
+#define _GNU_SOURCE
+
+#include "fake_drm.h"
+#include "v3d_drm.h"
+#include <drm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Stand-in DRM device for testing without V3D.  It is a memfd: a BO is a
+ * page-aligned range of it, the handle is its page number plus one, and the
+ * mmap offset is its offset, so the library's mmap path works unchanged.  Bus
+ * addresses are synthetic and lie above the simulated backend's range; they
+ * are never reused.  GEM_CLOSE punches the pages of a BO out of the memfd.
+ * There is no GPU to wait for, and PRIME is not supported, so BOs can neither
+ * be exported nor synced.
+ */
+
+#define FAKE_BUSADDR_BASE 0xc0000000u
+#define FAKE_BUSADDR_SIZE 0x40000000u
+#define FAKE_PAGE_SIZE 4096
+
+struct fake_drm {
+    int fd;
+    uint32_t next_page;
+    /* Page count of each BO, indexed by handle. */
+    uint32_t *n_pages;
+    size_t n_handles;
+    struct fake_drm *next;
+};
+
+/* The library hands only the fd to the ioctl, so devices are found by it. */
+static struct fake_drm *fake_drms = NULL;
+static pthread_mutex_t fake_drms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Call with fake_drms_lock held. */
+static struct fake_drm* find_fake_drm(const int fd)
+{
+    struct fake_drm *fp;
+
+    for (fp = fake_drms; fp != NULL; fp = fp->next)
+        if (fp->fd == fd)
+            return fp;
+    return NULL;
+}
+
+static int create_bo(struct fake_drm * const fp,
+        struct drm_v3d_create_bo * const cp)
+{
+    const uint32_t n_pages = (cp->size + FAKE_PAGE_SIZE - 1) / FAKE_PAGE_SIZE;
+    const uint32_t handle = fp->next_page + 1;
+
+    if (n_pages == 0 || (uint64_t) fp->next_page + n_pages
+            > FAKE_BUSADDR_SIZE / FAKE_PAGE_SIZE) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (handle >= fp->n_handles) {
+        const size_t n = handle * 2;
+        uint32_t * const p = realloc(fp->n_pages, n * sizeof(*p));
+        if (p == NULL)
+            return -1;
+        (void) memset(p + fp->n_handles, 0,
+                (n - fp->n_handles) * sizeof(*p));
+        fp->n_pages = p;
+        fp->n_handles = n;
+    }
+    if (ftruncate(fp->fd, (off_t) (fp->next_page + n_pages) * FAKE_PAGE_SIZE))
+        return -1;
+
+    fp->n_pages[handle] = n_pages;
+    fp->next_page += n_pages;
+    cp->handle = handle;
+    cp->offset = FAKE_BUSADDR_BASE + (handle - 1) * FAKE_PAGE_SIZE;
+    return 0;
+}
+
+/* Gives the pages of a BO back; its range is never reused. */
+static int close_bo(struct fake_drm * const fp, const uint32_t handle)
+{
+    if (handle == 0 || handle >= fp->n_handles || fp->n_pages[handle] == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (fallocate(fp->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                (off_t) (handle - 1) * FAKE_PAGE_SIZE,
+                (off_t) fp->n_pages[handle] * FAKE_PAGE_SIZE))
+        return -1;
+    fp->n_pages[handle] = 0;
+    return 0;
+}
+
+static int fake_ioctl(int fd, unsigned long request, void *arg)
+{
+    struct fake_drm *fp;
+    int res = 0;
+
+    (void) pthread_mutex_lock(&fake_drms_lock);
+    fp = find_fake_drm(fd);
+    if (fp == NULL) {
+        errno = EBADF;
+        res = -1;
+        goto out;
+    }
+
+    switch (request) {
+        case DRM_IOCTL_V3D_CREATE_BO:
+            res = create_bo(fp, arg);
+            break;
+        case DRM_IOCTL_V3D_MMAP_BO: {
+            struct drm_v3d_mmap_bo * const mp = arg;
+            mp->offset = (uint64_t) (mp->handle - 1) * FAKE_PAGE_SIZE;
+            break;
+        }
+        case DRM_IOCTL_V3D_WAIT_BO:
+            break;
+        case DRM_IOCTL_GEM_CLOSE:
+            res = close_bo(fp, ((struct drm_gem_close*) arg)->handle);
+            break;
+        default:
+            errno = ENOTTY;
+            res = -1;
+            break;
+    }
+
+out:
+    (void) pthread_mutex_unlock(&fake_drms_lock);
+    return res;
+}
+
+/*
+ * Registers a new stand-in device.  The entry of an earlier device that had
+ * the same fd is dropped; that fd has been closed by its rpimemmgr.
+ */
+static int open_fake_drm(void)
+{
+    struct fake_drm *fp, **fpp;
+
+    fp = malloc(sizeof(*fp));
+    if (fp == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    fp->fd = memfd_create("rpimemmgr-fake-drm", MFD_CLOEXEC);
+    if (fp->fd == -1) {
+        perror("memfd_create");
+        free(fp);
+        return -1;
+    }
+    fp->next_page = 0;
+    fp->n_pages = NULL;
+    fp->n_handles = 0;
+
+    (void) pthread_mutex_lock(&fake_drms_lock);
+    for (fpp = &fake_drms; *fpp != NULL; fpp = &(*fpp)->next) {
+        if ((*fpp)->fd == fp->fd) {
+            struct fake_drm * const stale = *fpp;
+            *fpp = stale->next;
+            free(stale->n_pages);
+            free(stale);
+            break;
+        }
+    }
+    fp->next = fake_drms;
+    fake_drms = fp;
+    (void) pthread_mutex_unlock(&fake_drms_lock);
+    return fp->fd;
+}
+
+int fake_drm_init(struct rpimemmgr *sp)
+{
+    const char * const s = getenv("RPIMEMMGR_FAKE_DRM");
+    int fd, err;
+
+    err = rpimemmgr_init(sp);
+    if (err || s == NULL || strtol(s, NULL, 0) == 0)
+        return err;
+
+    fd = open_fake_drm();
+    if (fd == -1) {
+        err = 1;
+        goto clean_init;
+    }
+    err = rpimemmgr_set_drm_device(fd, fake_ioctl, sp);
+    if (err) {
+        (void) close(fd);
+        goto clean_init;
+    }
+    return 0;
+
+clean_init:
+    (void) rpimemmgr_finalize(sp);
+    return err;
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef FAKE_DRM_H
+#define FAKE_DRM_H
+
+#include "rpimemmgr.h"
+
+/*
+ * rpimemmgr_init(), followed by rpimemmgr_set_drm_device() with the stand-in
+ * device if RPIMEMMGR_FAKE_DRM is set to a non-zero value.  See fake_drm.c.
+ */
+int fake_drm_init(struct rpimemmgr *sp);
+
+#endif /* FAKE_DRM_H */
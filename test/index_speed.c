@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Registry insert/remove and usraddr-to-busaddr lookup speed at various
+ * numbers of live allocations.  Pool mode with the simulated backend keeps
+ * the backend out of the measurement.
+ */
+
+#define N_ITER 1000000
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int test_index_speed(const unsigned n_live)
+{
+    void **usraddrs;
+    double start, end;
+    uint32_t sum = 0;
+    unsigned i;
+    int err;
+    struct rpimemmgr st;
+
+    usraddrs = malloc(sizeof(*usraddrs) * n_live);
+    if (usraddrs == NULL)
+        return 1;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        goto clean_usraddrs;
+
+    err = rpimemmgr_set_pool(1 << 22, 64, &st);
+    if (err)
+        goto clean_init;
+
+    for (i = 0; i < n_live; i ++) {
+        err = rpimemmgr_alloc_sim(64, 64, &usraddrs[i], NULL, &st);
+        if (err)
+            goto clean_init;
+    }
+
+    srand(0);
+    start = get_time();
+    for (i = 0; i < N_ITER; i ++) {
+        const uint8_t * const p = usraddrs[rand() % n_live];
+        sum += rpimemmgr_usraddr_to_busaddr(p + i % 64, &st);
+    }
+    end = get_time();
+    printf("%6u live: lookup:        %e [s/call] (%08x)\n", n_live,
+            (end - start) / N_ITER, sum);
+
+    start = get_time();
+    for (i = 0; i < N_ITER; i ++) {
+        const unsigned j = rand() % n_live;
+        err = rpimemmgr_free_by_usraddr(usraddrs[j], &st);
+        if (err)
+            goto clean_init;
+        err = rpimemmgr_alloc_sim(64, 64, &usraddrs[j], NULL, &st);
+        if (err)
+            goto clean_init;
+    }
+    end = get_time();
+    printf("%6u live: remove+insert: %e [s/call]\n", n_live,
+            (end - start) / N_ITER);
+
+clean_init:
+    err |= rpimemmgr_finalize(&st);
+clean_usraddrs:
+    free(usraddrs);
+    return err;
+}
+
+int main(void)
+{
+    static const unsigned n_lives[] = {10, 1000, 100000};
+    unsigned i;
+    int err;
+
+    for (i = 0; i < sizeof(n_lives) / sizeof(n_lives[0]); i ++) {
+        err = test_index_speed(n_lives[i]);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Per-call latency of the allocator itself: alloc, free and the two address
+ * translations, with a growing number of live allocations around them.  Each
+ * call is timed on its own and the results are reported as p50/p99/max and a
+ * log2 histogram in nanoseconds.  The simulated backend always runs, so
+ * regressions in the registry and the bookkeeping show up anywhere; the real
+ * backends run only on a Raspberry Pi, with fewer live allocations.
+ */
+
+#define N_SAMPLES 2000
+#define N_BUCKETS 24
+/* Samples below 2^MIN_SHIFT ns go to the first bucket. */
+#define MIN_SHIFT 5
+
+enum backend {
+    BACKEND_SIM,
+    BACKEND_VCSM,
+    BACKEND_MAILBOX,
+    BACKEND_DRM,
+};
+
+enum op {
+    OP_ALLOC,
+    OP_FREE,
+    OP_TO_BUSADDR,
+    OP_TO_HANDLE,
+    N_OPS
+};
+
+static const char * const op_names[N_OPS] = {
+    "alloc", "free", "to_busaddr", "to_handle",
+};
+
+struct histogram {
+    unsigned n;
+    uint64_t samples[N_SAMPLES];
+};
+
+static inline
+uint64_t get_time_ns(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int alloc_one(const enum backend backend, const size_t size,
+        void **usraddrp, struct rpimemmgr *sp)
+{
+    switch (backend) {
+        case BACKEND_SIM:
+            return rpimemmgr_alloc_sim(size, 4096, usraddrp, NULL, sp);
+        case BACKEND_VCSM:
+            return rpimemmgr_alloc_vcsm(size, 4096, VCSM_CACHE_TYPE_HOST,
+                    usraddrp, NULL, sp);
+        case BACKEND_MAILBOX:
+            return rpimemmgr_alloc_mailbox(size, 4096, MEM_FLAG_DIRECT,
+                    usraddrp, NULL, sp);
+        case BACKEND_DRM:
+            return rpimemmgr_alloc_drm(size, usraddrp, NULL, sp);
+    }
+    return 1;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void print_histogram(const char *prefix, const enum op op,
+        struct histogram *hp)
+{
+    unsigned buckets[N_BUCKETS] = {0};
+    unsigned i;
+
+    if (hp->n == 0)
+        return;
+    qsort(hp->samples, hp->n, sizeof(hp->samples[0]), compare_u64);
+    for (i = 0; i < hp->n; i ++) {
+        unsigned b = 0;
+        while (b < N_BUCKETS - 1 && hp->samples[i] >> (MIN_SHIFT + b) != 0)
+            b ++;
+        buckets[b] ++;
+    }
+
+    printf("%s %-10s: p50 %7llu p99 %7llu max %8llu [ns] |", prefix,
+            op_names[op], (unsigned long long) hp->samples[hp->n / 2],
+            (unsigned long long) hp->samples[(hp->n * 99 + 99) / 100 - 1],
+            (unsigned long long) hp->samples[hp->n - 1]);
+    /* Each bucket is labelled with its exclusive upper bound. */
+    for (i = 0; i < N_BUCKETS; i ++)
+        if (buckets[i] != 0)
+            printf(" <%lu:%u", 1ul << (MIN_SHIFT + i), buckets[i]);
+    printf("\n");
+}
+
+static int bench(const char *name, const enum backend backend,
+        const size_t size, const size_t n_live)
+{
+    static struct histogram hists[N_OPS];
+    void **live;
+    char prefix[64];
+    struct rpimemmgr st;
+    unsigned i;
+    size_t j;
+    int err;
+
+    live = malloc(sizeof(*live) * (n_live + 1));
+    if (live == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (i = 0; i < N_OPS; i ++)
+        hists[i].n = 0;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        goto clean_live;
+
+    for (j = 0; j < n_live; j ++) {
+        err = alloc_one(backend, size, &live[j], &st);
+        if (err)
+            goto clean_init;
+    }
+
+    srand(1);
+    for (i = 0; i < N_SAMPLES; i ++) {
+        const void *usraddr;
+        void *p;
+        uint64_t start;
+
+        start = get_time_ns();
+        err = alloc_one(backend, size, &p, &st);
+        hists[OP_ALLOC].samples[hists[OP_ALLOC].n ++] = get_time_ns() - start;
+        if (err)
+            goto clean_init;
+
+        /* Translate somewhere inside a random live block or the new one. */
+        j = (size_t) rand() % (n_live + 1);
+        usraddr = (const uint8_t*) (j == n_live ? p : live[j])
+                + (size_t) rand() % size;
+
+        start = get_time_ns();
+        if (rpimemmgr_usraddr_to_busaddr(usraddr, &st) == 0)
+            err = 1;
+        hists[OP_TO_BUSADDR].samples[hists[OP_TO_BUSADDR].n ++] =
+                get_time_ns() - start;
+
+        start = get_time_ns();
+        if (rpimemmgr_usraddr_to_handle(usraddr, &st) == 0)
+            err = 1;
+        hists[OP_TO_HANDLE].samples[hists[OP_TO_HANDLE].n ++] =
+                get_time_ns() - start;
+        if (err) {
+            fprintf(stderr, "Failed to translate %p\n", usraddr);
+            goto clean_init;
+        }
+
+        start = get_time_ns();
+        err = rpimemmgr_free_by_usraddr(p, &st);
+        hists[OP_FREE].samples[hists[OP_FREE].n ++] = get_time_ns() - start;
+        if (err)
+            goto clean_init;
+    }
+
+    (void) snprintf(prefix, sizeof(prefix), "%-8s %6zu B live %5zu", name,
+            size, n_live);
+    for (i = 0; i < N_OPS; i ++)
+        print_histogram(prefix, i, &hists[i]);
+
+clean_init:
+    /* Live blocks are released by finalize. */
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+clean_live:
+    free(live);
+    return err;
+}
+
+static int bench_backend(const char *name, const enum backend backend,
+        const size_t max_live)
+{
+    static const size_t sizes[] = {4096, 65536};
+    static const size_t n_lives[] = {0, 16, 256, 4096};
+    unsigned i, j;
+    int err;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i ++) {
+        for (j = 0; j < sizeof(n_lives) / sizeof(n_lives[0]); j ++) {
+            if (n_lives[j] > max_live)
+                break;
+            err = bench(name, backend, sizes[i], n_lives[j]);
+            if (err)
+                return err;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    int processor;
+    int err;
+
+    err = bench_backend("sim", BACKEND_SIM, 4096);
+    if (err)
+        return err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    processor = rpimemmgr_get_processor(&st);
+    err = rpimemmgr_finalize(&st);
+    if (err)
+        return err;
+    if (processor < 0) {
+        printf("Not a Raspberry Pi; skipping the real backends\n");
+        return 0;
+    }
+
+    /* Each live block costs a VideoCore handle or CMA memory here. */
+    err = bench_backend("VCSM", BACKEND_VCSM, 256);
+    if (err)
+        return err;
+    err = bench_backend("Mailbox", BACKEND_MAILBOX, 256);
+    if (err)
+        return err;
+    if (processor == 3) { /* BCM2711 */
+        err = bench_backend("DRM", BACKEND_DRM, 256);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
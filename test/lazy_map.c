@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "fake_drm.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/*
+ * Lazy mapping of DRM buffers: map on request, unmap and map again with the
+ * contents kept, and the time to allocate and free buffers mapped eagerly
+ * against unmapped.  Unmapped buffers must not take address space.  Needs
+ * DRM; other backends must be refused.
+ */
+
+#define N_BUFS 256
+#define BUF_SIZE (1 << 20)
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Address space of the process in bytes, or 0. */
+static size_t get_vm_size(void)
+{
+    unsigned long n_pages;
+    FILE *fp;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%lu", &n_pages) != 1)
+        n_pages = 0;
+    (void) fclose(fp);
+    return n_pages * sysconf(_SC_PAGESIZE);
+}
+
+static int test_lazy_map(struct rpimemmgr *sp)
+{
+    uint32_t busaddr;
+    uint8_t *p, *q;
+    int err;
+
+    err = rpimemmgr_alloc_drm(BUF_SIZE, NULL, &busaddr, sp);
+    if (err)
+        return err;
+
+    err = rpimemmgr_map_by_busaddr(busaddr, (void**) &p, sp);
+    err = err ? err : rpimemmgr_map_by_busaddr(busaddr, (void**) &q, sp);
+    if (err || p != q || rpimemmgr_usraddr_to_busaddr(p + 100, sp)
+            != busaddr + 100) {
+        fprintf(stderr, "Failed to map lazily\n");
+        return 1;
+    }
+    memset(p, 0x3c, BUF_SIZE);
+
+    err = rpimemmgr_unmap_by_busaddr(busaddr, sp);
+    err = err ? err : rpimemmgr_unmap_by_busaddr(busaddr, sp);
+    err = err ? err : rpimemmgr_map_by_busaddr(busaddr, (void**) &p, sp);
+    if (err || p[0] != 0x3c || p[BUF_SIZE - 1] != 0x3c) {
+        fprintf(stderr, "Contents lost across unmap\n");
+        return 1;
+    }
+
+    return rpimemmgr_free_by_busaddr(busaddr, sp);
+}
+
+static int bench(const bool do_mapping)
+{
+    static uint32_t busaddrs[N_BUFS];
+    struct rpimemmgr st;
+    double start, end;
+    size_t vm_size;
+    unsigned i;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+
+    vm_size = get_vm_size();
+    start = get_time();
+    for (i = 0; i < N_BUFS; i ++) {
+        void *p;
+        err = rpimemmgr_alloc_drm(BUF_SIZE, do_mapping ? &p : NULL,
+                &busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    /* Mapped buffers take all of their size; unmapped ones nothing. */
+    vm_size = get_vm_size() - vm_size;
+    if (do_mapping ? vm_size < (size_t) N_BUFS * BUF_SIZE
+            : vm_size >= (size_t) N_BUFS * BUF_SIZE / 2) {
+        fprintf(stderr, "DRM %s buffers took %zu bytes of address space\n",
+                do_mapping ? "mapped" : "lazy", vm_size);
+        err = 1;
+        goto clean_init;
+    }
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_free_by_busaddr(busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    end = get_time();
+
+    printf("DRM %-8s: %8.2f [us/buf]\n", do_mapping ? "mapped" : "lazy",
+            (end - start) / N_BUFS * 1e6);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    uint32_t busaddr;
+    void *p;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_alloc_sim(4096, 4096, NULL, &busaddr, &st);
+    if (err)
+        return err;
+    if (rpimemmgr_map_by_busaddr(busaddr, &p, &st) == 0
+            || rpimemmgr_unmap_by_busaddr(busaddr, &st) == 0) {
+        fprintf(stderr, "Mapped a non-DRM buffer lazily\n");
+        return 1;
+    }
+
+    if (rpimemmgr_alloc_drm(4096, NULL, &busaddr, &st)) {
+        printf("DRM is not available; skipping\n");
+        return rpimemmgr_finalize(&st);
+    }
+    err = rpimemmgr_free_by_busaddr(busaddr, &st);
+    err = err ? err : test_lazy_map(&st);
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    if (err)
+        return err;
+    printf("Lazy mapping (DRM):           OK\n");
+
+    err = bench(true);
+    return err ? err : bench(false);
+}
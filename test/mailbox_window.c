@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Mapped Mailbox allocations carved out of WINDOW_SIZE-byte windows
+ * (rpimemmgr_set_mailbox_window()) and with one mapping per buffer: the time
+ * per allocation and free, and the number of VMAs that N_BUFS live buffers
+ * add.
+ * Also checks that the buffers are usable and distinct.  Needs Mailbox and
+ * /dev/mem, i.e. root on a Pi.
+ */
+
+#define N_BUFS 256
+#define BUF_SIZE (64 << 10)
+#define WINDOW_SIZE (2 << 20)
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int count_vmas(void)
+{
+    FILE *fp;
+    int c, n = 0;
+
+    fp = fopen("/proc/self/maps", "r");
+    if (fp == NULL)
+        return -1;
+    while ((c = fgetc(fp)) != EOF)
+        if (c == '\n')
+            n ++;
+    (void) fclose(fp);
+    return n;
+}
+
+static int bench(const uint32_t flags, const bool use_window)
+{
+    static uint8_t *ps[N_BUFS];
+    static uint32_t busaddrs[N_BUFS];
+    struct rpimemmgr st;
+    double t_alloc, t_free;
+    int n_vmas, err;
+    unsigned i;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    /* Open the devices outside of the timing. */
+    err = use_window ? rpimemmgr_set_mailbox_window(WINDOW_SIZE, &st) : 0;
+    err = err ? err : rpimemmgr_alloc_mailbox(4096, 4096, flags,
+            (void**) &ps[0], &busaddrs[0], &st);
+    err = err ? err : rpimemmgr_free_by_busaddr(busaddrs[0], &st);
+    if (err)
+        goto clean_init;
+
+    n_vmas = count_vmas();
+    t_alloc = get_time();
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_alloc_mailbox(BUF_SIZE, 4096, flags, (void**) &ps[i],
+                &busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    t_alloc = get_time() - t_alloc;
+    n_vmas = count_vmas() - n_vmas;
+
+    for (i = 0; i < N_BUFS; i ++)
+        memset(ps[i], i, BUF_SIZE);
+    for (i = 0; i < N_BUFS; i ++) {
+        if (ps[i][0] != (uint8_t) i || ps[i][BUF_SIZE - 1] != (uint8_t) i
+                || rpimemmgr_usraddr_to_busaddr(ps[i] + 100, &st)
+                        != busaddrs[i] + 100) {
+            fprintf(stderr, "Buffer %u is broken\n", i);
+            err = 1;
+            goto clean_init;
+        }
+    }
+
+    t_free = get_time();
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_free_by_busaddr(busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    t_free = get_time() - t_free;
+
+    printf("Mailbox 0x%02x %-10s: alloc %8.2f [us/buf], free %8.2f [us/buf], "
+            "%4d VMAs for %d buffers\n", flags,
+            use_window ? "window" : "per-buffer",
+            t_alloc / N_BUFS * 1e6, t_free / N_BUFS * 1e6, n_vmas,
+            N_BUFS);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    struct rpimemmgr_caps caps;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    err = rpimemmgr_get_caps(&caps, &st);
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    if (err) {
+        printf("Mailbox is not available; skipping\n");
+        return 0;
+    }
+
+    for (i = 0; i < 4; i ++) {
+        if (!caps.mailbox_mappable[i])
+            continue;
+        err = bench(i << 2, false);
+        err = err ? err : bench(i << 2, true);
+        if (err)
+            return err;
+    }
+    return 0;
+}
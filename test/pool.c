@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <inttypes.h>
+
+#define N_BUFS 1024
+
+static const size_t sizes[] = {
+    1, 64, 100, 4096, 5000, 16384, 65536,
+};
+
+static int check_buf(void *usraddr, const uint32_t busaddr, const size_t size,
+        const size_t align, struct rpimemmgr *sp)
+{
+    const uint8_t * const p = usraddr;
+
+    if ((uintptr_t) usraddr % align != 0 || busaddr % align != 0) {
+        fprintf(stderr, "Misaligned: usraddr=%p busaddr=0x%08" PRIx32
+                " align=%zu\n", usraddr, busaddr, align);
+        return 1;
+    }
+    if (rpimemmgr_usraddr_to_busaddr(p, sp) != busaddr
+            || rpimemmgr_usraddr_to_busaddr(p + size - 1, sp)
+                    != busaddr + size - 1) {
+        fprintf(stderr, "Wrong translation: usraddr=%p\n", usraddr);
+        return 1;
+    }
+    if (rpimemmgr_usraddr_to_handle(p + size / 2, sp) == 0) {
+        fprintf(stderr, "No handle: usraddr=%p\n", usraddr);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_pool(void)
+{
+    static void *usraddrs[N_BUFS];
+    static uint32_t busaddrs[N_BUFS];
+    struct rpimemmgr st;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_set_pool(1 << 20, 1 << 16, &st);
+    if (err)
+        return err;
+
+    for (i = 0; i < N_BUFS; i ++) {
+        const size_t size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        const size_t align = (size_t) 1 << (i % 13);
+
+        err = rpimemmgr_alloc_sim(size, align, &usraddrs[i], &busaddrs[i],
+                &st);
+        if (err)
+            return err;
+        err = check_buf(usraddrs[i], busaddrs[i], size, align, &st);
+        if (err)
+            return err;
+        memset(usraddrs[i], i, size);
+    }
+
+    for (i = 0; i < N_BUFS; i ++) {
+        const size_t size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        const uint8_t * const p = usraddrs[i];
+        size_t j;
+
+        for (j = 0; j < size; j ++) {
+            if (p[j] != (uint8_t) i) {
+                fprintf(stderr, "Overlapping buffers: %u\n", i);
+                return 1;
+            }
+        }
+    }
+
+    /* Free half by busaddr and half by usraddr, then reuse the blocks. */
+    for (i = 0; i < N_BUFS; i += 2) {
+        err = rpimemmgr_free_by_busaddr(busaddrs[i], &st);
+        if (err)
+            return err;
+        err = rpimemmgr_free_by_usraddr(usraddrs[i + 1], &st);
+        if (err)
+            return err;
+    }
+
+    for (i = 0; i < N_BUFS / 2; i ++) {
+        err = rpimemmgr_alloc_sim(4096, 4096, &usraddrs[i], &busaddrs[i],
+                &st);
+        if (err)
+            return err;
+        err = check_buf(usraddrs[i], busaddrs[i], 4096, 4096, &st);
+        if (err)
+            return err;
+    }
+
+    /* Leave them to rpimemmgr_finalize(). */
+    return rpimemmgr_finalize(&st);
+}
+
+/*
+ * More than the 2 GiB of simulated bus addresses, allocated and freed while
+ * one buffer lives on: its address must not be handed out again.
+ */
+static int test_sim_wrap(void)
+{
+    struct rpimemmgr st;
+    uint32_t busaddr, busaddr2;
+    void *p;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_alloc_sim(4096, 4096, NULL, &busaddr, &st);
+    for (i = 0; !err && i < 3 * 64; i ++) {
+        err = rpimemmgr_alloc_sim(16 << 20, 4096, &p, &busaddr2, &st);
+        if (err)
+            break;
+        if (busaddr2 <= busaddr && busaddr < busaddr2 + (16 << 20)) {
+            fprintf(stderr, "Live busaddr 0x%08" PRIx32 " reused\n",
+                    busaddr);
+            err = 1;
+            break;
+        }
+        err = rpimemmgr_free_by_usraddr(p, &st);
+    }
+    err = err ? err : rpimemmgr_free_by_busaddr(busaddr, &st);
+
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+/* A freed block written to must not come back for a zeroed allocation. */
+static int test_zero(void)
+{
+    struct rpimemmgr st;
+    uint8_t *p;
+    size_t i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_set_pool(1 << 20, 1 << 16, &st);
+    err = err ? err : rpimemmgr_alloc_mailbox(4096, 4096,
+            MEM_FLAG_DIRECT | MEM_FLAG_ZERO, (void**) &p, NULL, &st);
+    if (err) {
+        printf("Mailbox is not available; skipping\n");
+        err = 0;
+        goto clean_init;
+    }
+    memset(p, 0xa5, 4096);
+    err = rpimemmgr_free_by_usraddr(p, &st);
+    err = err ? err : rpimemmgr_alloc_mailbox(4096, 4096,
+            MEM_FLAG_DIRECT | MEM_FLAG_ZERO, (void**) &p, NULL, &st);
+    if (err)
+        goto clean_init;
+    for (i = 0; i < 4096; i ++) {
+        if (p[i] != 0) {
+            fprintf(stderr, "Zeroed buffer is not zero at %zu\n", i);
+            err = 1;
+            goto clean_init;
+        }
+    }
+    printf("OK\n");
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    int err;
+
+    printf("Pool (sim):                   ");
+    err = test_pool();
+    if (err)
+        return err;
+    printf("OK\n");
+
+    printf("Bus address wrap (sim):       ");
+    err = test_sim_wrap();
+    if (err)
+        return err;
+    printf("OK\n");
+
+    printf("Pool, zeroed (Mailbox):       ");
+    return test_zero();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <inttypes.h>
+
+/* The simulated backend never reuses a bus address, so reuse is observable. */
+
+static int alloc_free(const size_t size, uint32_t *busaddrp,
+        struct rpimemmgr *sp)
+{
+    void *usraddr;
+    int err;
+
+    err = rpimemmgr_alloc_sim(size, 4096, &usraddr, busaddrp, sp);
+    if (err)
+        return err;
+    if (rpimemmgr_usraddr_to_busaddr(usraddr, sp) != *busaddrp) {
+        fprintf(stderr, "Wrong translation: usraddr=%p\n", usraddr);
+        return 1;
+    }
+    return rpimemmgr_free_by_usraddr(usraddr, sp);
+}
+
+static int expect(const char *what, const bool cond)
+{
+    if (!cond) {
+        fprintf(stderr, "Failed: %s\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_recycle(void)
+{
+    const struct timespec ts = {.tv_sec = 0, .tv_nsec = 20000000};
+    uint32_t a, b;
+    struct rpimemmgr st;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_set_recycle(1 << 20, 10, &st);
+    if (err)
+        return err;
+
+    err = alloc_free(5000, &a, &st);
+    err |= alloc_free(6000, &b, &st);
+    if (err || expect("reuse within a bucket", a == b))
+        return 1;
+
+    err = alloc_free(40000, &b, &st);
+    if (err || expect("no reuse across buckets", a != b))
+        return 1;
+
+    err = alloc_free(1 << 21, &a, &st);
+    err |= alloc_free(1 << 21, &b, &st);
+    if (err || expect("no caching above max_bytes", a != b))
+        return 1;
+
+    err = alloc_free(4096, &a, &st);
+    (void) nanosleep(&ts, NULL);
+    err |= rpimemmgr_trim_recycle(1 << 20, &st);
+    err |= alloc_free(4096, &b, &st);
+    if (err || expect("expiry by age", a != b))
+        return 1;
+
+    err = alloc_free(4096, &a, &st);
+    err |= rpimemmgr_trim_recycle(0, &st);
+    err |= alloc_free(4096, &b, &st);
+    if (err || expect("explicit trim", a != b))
+        return 1;
+
+    return rpimemmgr_finalize(&st);
+}
+
+int main(void)
+{
+    int err;
+
+    printf("Recycle (sim):                ");
+    err = test_recycle();
+    if (err)
+        return err;
+    printf("OK\n");
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include "fake_drm.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/*
+ * The release thread on the simulated backend: frees return with the buffer
+ * gone from lookups, a flush waits for the releases, the eventfd counts up,
+ * and a deferred DRM free is reaped by the thread if DRM is available.
+ * Finalization releases what is still queued.  Then the time spent in the
+ * free call itself, with and without the thread.
+ */
+
+#define N_BUFS 256
+#define BUF_SIZE (1 << 20)
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Waits up to a second for a batch of releases. */
+static int wait_eventfd(const int fd)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    uint64_t count;
+
+    if (poll(&pfd, 1, 1000) != 1 || read(fd, &count, sizeof(count))
+            != sizeof(count) || count == 0) {
+        fprintf(stderr, "No completion on the eventfd\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_release(struct rpimemmgr *sp)
+{
+    uint32_t busaddr, busaddr2;
+    uint8_t *p;
+    int fd, err;
+
+    fd = rpimemmgr_get_release_eventfd(sp);
+    if (fd == -1)
+        return 1;
+
+    err = rpimemmgr_set_recycle(16 << 20, 0, sp);
+    err = err ? err : rpimemmgr_alloc_sim(BUF_SIZE, 4096, (void**) &p,
+            &busaddr, sp);
+    err = err ? err : rpimemmgr_free_by_usraddr(p, sp);
+    if (err)
+        return err;
+    if (rpimemmgr_usraddr_to_busaddr(p, sp) != 0) {
+        fprintf(stderr, "Freed buffer is still registered\n");
+        return 1;
+    }
+
+    /* Once released, the buffer sits in the recycle cache. */
+    err = rpimemmgr_flush_releases(sp);
+    err = err ? err : wait_eventfd(fd);
+    err = err ? err : rpimemmgr_alloc_sim(BUF_SIZE, 4096, NULL, &busaddr2,
+            sp);
+    if (err || busaddr2 != busaddr) {
+        fprintf(stderr, "Buffer was not released by the thread\n");
+        return 1;
+    }
+    err = rpimemmgr_free_by_busaddr(busaddr2, sp);
+    err = err ? err : rpimemmgr_flush_releases(sp);
+    err = err ? err : rpimemmgr_set_recycle(0, 0, sp);
+    if (err)
+        return err;
+
+    if (rpimemmgr_alloc_drm(4096, NULL, &busaddr, sp) == 0) {
+        uint64_t count;
+
+        /* Clear the count; the eventfd is non-blocking. */
+        (void) read(fd, &count, sizeof(count));
+        err = rpimemmgr_free_deferred_by_busaddr(busaddr, sp);
+        err = err ? err : wait_eventfd(fd);
+        if (err)
+            return err;
+        printf("(with DRM) ");
+    }
+
+    /* Left queued for rpimemmgr_finalize(). */
+    err = rpimemmgr_alloc_sim(BUF_SIZE, 4096, NULL, &busaddr, sp);
+    return err ? err : rpimemmgr_free_by_busaddr(busaddr, sp);
+}
+
+static int bench(const bool use_thread)
+{
+    static uint32_t busaddrs[N_BUFS];
+    struct rpimemmgr st;
+    double start, end;
+    unsigned i;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+    err = rpimemmgr_enable_thread_safety(&st);
+    if (!err && use_thread)
+        err = rpimemmgr_start_release_thread(&st);
+    if (err)
+        goto clean_init;
+
+    for (i = 0; i < N_BUFS; i ++) {
+        void *p;
+        err = rpimemmgr_alloc_sim(BUF_SIZE, 4096, &p, &busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+        memset(p, 0, BUF_SIZE);
+    }
+
+    start = get_time();
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_free_by_busaddr(busaddrs[i], &st);
+        if (err)
+            goto clean_init;
+    }
+    end = get_time();
+
+    printf("free %-10s: %8.2f [us/buf]\n",
+            use_thread ? "queued" : "in place", (end - start) / N_BUFS * 1e6);
+
+    err = rpimemmgr_flush_releases(&st);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    int err;
+
+    err = fake_drm_init(&st);
+    if (err)
+        return err;
+
+    if (rpimemmgr_start_release_thread(&st) == 0) {
+        fprintf(stderr, "Started the release thread without thread safety\n");
+        return 1;
+    }
+    err = rpimemmgr_enable_thread_safety(&st);
+    err = err ? err : rpimemmgr_start_release_thread(&st);
+    if (err)
+        goto clean_init;
+
+    printf("Release thread (sim): ");
+    err = test_release(&st);
+    if (err)
+        goto clean_init;
+    printf("OK\n");
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    if (err)
+        return err;
+
+    err = bench(false);
+    return err ? err : bench(true);
+}
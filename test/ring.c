@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Ring allocator on the simulated backend with a software fence that lags
+ * a few submissions behind, as the GPU would: regions are checked against
+ * the bus address index, against straddling the end and, by their contents,
+ * against being handed out again before their fence retires.  Then the rate
+ * of uniform streams from the ring against alloc/free per stream.
+ */
+
+#define RING_SIZE (1 << 16)
+#define N_ROUNDS 20000
+#define LAG 8
+#define MAX_LIVE 4096
+#define N_ITERS 100000
+
+struct sw_fence {
+    uint64_t submitted, completed;
+};
+
+struct region {
+    uint8_t *p;
+    size_t size;
+    uint64_t seqno;
+};
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t poll_sw_fence(void *arg)
+{
+    struct sw_fence * const fp = arg;
+
+    /* Let the "GPU" catch up on everything submitted. */
+    fp->completed = fp->submitted;
+    return fp->completed;
+}
+
+static int check_region(const struct region *rp)
+{
+    size_t i;
+
+    for (i = 0; i < rp->size; i ++) {
+        if (rp->p[i] != (uint8_t) rp->seqno) {
+            fprintf(stderr, "Region %p of seqno %llu was overwritten\n",
+                    (void*) rp->p, (unsigned long long) rp->seqno);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_ring(void)
+{
+    static struct region live[MAX_LIVE];
+    struct rpimemmgr_ring *ring;
+    struct sw_fence fence = {0, 0};
+    struct rpimemmgr st;
+    size_t first = 0, n = 0;
+    uint8_t *base;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    err = rpimemmgr_ring_create(RPIMEMMGR_BACKEND_SIM, RING_SIZE, 0, NULL,
+            NULL, &ring, &st);
+    if (err)
+        return err;
+
+    srand(1);
+    base = NULL;
+    for (i = 0; i < N_ROUNDS; i ++) {
+        const size_t size = 16 + (size_t) rand() % 3000;
+        const size_t align = (size_t) 16 << (rand() % 5);
+        struct region *rp;
+        uint32_t busaddr;
+
+        for (;;) {
+            /* Retired regions must have been left intact until now. */
+            while (n > 0 && live[first].seqno <= fence.completed) {
+                err = check_region(&live[first]);
+                if (err)
+                    return err;
+                first = (first + 1) % MAX_LIVE;
+                n --;
+            }
+            rp = &live[(first + n) % MAX_LIVE];
+
+            if (rpimemmgr_ring_alloc(ring, size, align, (void**) &rp->p,
+                        &busaddr) == 0)
+                break;
+            if (fence.completed == fence.submitted) {
+                fprintf(stderr, "Ring alloc failed at round %u\n", i);
+                return 1;
+            }
+            /* Full: wait for the "GPU" to finish everything submitted. */
+            fence.completed = fence.submitted;
+            rpimemmgr_ring_retire(ring, fence.completed);
+        }
+        if (base == NULL)
+            base = rp->p;
+        if ((uintptr_t) rp->p % align != 0 || rp->p < base
+                || rp->p + size > base + RING_SIZE
+                || rpimemmgr_usraddr_to_busaddr(rp->p, &st) != busaddr) {
+            fprintf(stderr, "Bad region: %p %zu\n", (void*) rp->p, size);
+            return 1;
+        }
+
+        rp->size = size;
+        rp->seqno = fence.submitted + 1;
+        memset(rp->p, (uint8_t) rp->seqno, size);
+        n ++;
+
+        /* Submit every few regions; the fence retires LAG behind. */
+        if (rand() % 4 == 0) {
+            fence.submitted ++;
+            err = rpimemmgr_ring_fence(ring, fence.submitted);
+            if (err)
+                return err;
+            if (fence.submitted > LAG) {
+                fence.completed = fence.submitted - LAG;
+                rpimemmgr_ring_retire(ring, fence.completed);
+            }
+        }
+    }
+
+    /*
+     * Nothing retires without a fence, so the ring fills up.  Once the work
+     * is submitted, allocation polls the fence and goes on.
+     */
+    err = rpimemmgr_ring_destroy(ring);
+    fence.submitted = fence.completed = 0;
+    err = err ? err : rpimemmgr_ring_create(RPIMEMMGR_BACKEND_SIM, RING_SIZE,
+            0, poll_sw_fence, &fence, &ring, &st);
+    if (err)
+        return err;
+    for (i = 0; i < RING_SIZE / 4096; i ++) {
+        err = rpimemmgr_ring_alloc(ring, 4096, 4096, NULL, NULL);
+        if (err)
+            return err;
+    }
+    if (rpimemmgr_ring_alloc(ring, 16, 16, NULL, NULL) == 0) {
+        fprintf(stderr, "Allocated from a full ring\n");
+        return 1;
+    }
+    fence.submitted = 1;
+    err = rpimemmgr_ring_fence(ring, 1);
+    if (err)
+        return err;
+    err = rpimemmgr_ring_alloc(ring, RING_SIZE, 4096, NULL, NULL);
+    if (err)
+        return err;
+
+    err = rpimemmgr_ring_destroy(ring);
+    if (err)
+        return err;
+    return rpimemmgr_finalize(&st);
+}
+
+static int bench(void)
+{
+    struct rpimemmgr_ring *ring;
+    struct sw_fence fence = {0, 0};
+    struct rpimemmgr st;
+    double start, end;
+    uint32_t *p;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        uint32_t *q;
+        err = rpimemmgr_alloc_sim(256, 16, (void**) &p, NULL, &st);
+        if (err)
+            return err;
+        q = p;
+        unif_add_uint(i, &q);
+        unif_add_float(1.0f, &q);
+        err = rpimemmgr_free_by_usraddr(p, &st);
+        if (err)
+            return err;
+    }
+    end = get_time();
+    printf("alloc/free per stream: %e [stream/s]\n", N_ITERS / (end - start));
+
+    err = rpimemmgr_ring_create(RPIMEMMGR_BACKEND_SIM, 1 << 20, 0,
+            poll_sw_fence, &fence, &ring, &st);
+    if (err)
+        return err;
+
+    start = get_time();
+    for (i = 0; i < N_ITERS; i ++) {
+        uint32_t *q;
+        err = rpimemmgr_ring_alloc(ring, 256, 16, (void**) &p, NULL);
+        if (err)
+            return err;
+        q = p;
+        unif_add_uint(i, &q);
+        unif_add_float(1.0f, &q);
+        fence.submitted ++;
+        err = rpimemmgr_ring_fence(ring, fence.submitted);
+        if (err)
+            return err;
+    }
+    end = get_time();
+    printf("ring:                  %e [stream/s]\n", N_ITERS / (end - start));
+
+    err = rpimemmgr_ring_destroy(ring);
+    if (err)
+        return err;
+    return rpimemmgr_finalize(&st);
+}
+
+int main(void)
+{
+    int err;
+
+    printf("Ring (sim):                   ");
+    err = test_ring();
+    if (err)
+        return err;
+    printf("OK\n");
+
+    return bench();
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+/*
+ * Statistics published to shared memory: the object appears under the
+ * documented name with its header, snapshots follow allocations, pools and
+ * the recycle cache within a few intervals, successive reads never go back
+ * in time, and the object is removed by rpimemmgr_finalize().
+ */
+
+#define INTERVAL_MS 2
+#define BIG_SIZE (1 << 20)
+#define SMALL_SIZE 4096
+#define N_SMALL 4
+#define CHUNK_SIZE (1 << 20)
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static const struct rpimemmgr_shm_stats* map_object(const char * const name)
+{
+    const struct rpimemmgr_shm_stats *shm;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        fprintf(stderr, "shm_open: %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return shm;
+}
+
+/* Reads snapshots until one is taken after since_ns. */
+static int read_after(const struct rpimemmgr_shm_stats * const shm,
+        const uint64_t since_ns, struct rpimemmgr_shm_snapshot * const dst)
+{
+    const uint64_t deadline = now_ns() + 1000000000;
+    uint64_t last = 0;
+
+    do {
+        if (rpimemmgr_read_shm_stats(dst, shm))
+            return 1;
+        if (dst->time_ns < last) {
+            fprintf(stderr, "Snapshot went back in time\n");
+            return 1;
+        }
+        last = dst->time_ns;
+        if (dst->time_ns > since_ns)
+            return 0;
+    } while (now_ns() < deadline);
+    fprintf(stderr, "No snapshot was published\n");
+    return 1;
+}
+
+static int test_object(const struct rpimemmgr_shm_stats * const shm,
+        struct rpimemmgr *sp)
+{
+    const struct rpimemmgr_backend_stats *bp;
+    struct rpimemmgr_shm_snapshot snap;
+    void *small[N_SMALL], *big, *recycled;
+    unsigned i;
+    int err = 0;
+
+    if (shm->magic != RPIMEMMGR_SHM_MAGIC || shm->pid != getpid()
+            || shm->interval_ms != INTERVAL_MS
+            || strcmp(shm->label, "shm-test") != 0) {
+        fprintf(stderr, "Wrong header\n");
+        return 1;
+    }
+
+    err = rpimemmgr_set_pool(CHUNK_SIZE, 64 << 10, sp);
+    err = err ? err : rpimemmgr_set_recycle(16 << 20, 0, sp);
+    for (i = 0; i < N_SMALL && !err; i ++)
+        err = rpimemmgr_alloc_sim(SMALL_SIZE, 4096, &small[i], NULL, sp);
+    err = err ? err : rpimemmgr_alloc_sim(BIG_SIZE, 4096, &big, NULL, sp);
+    err = err ? err : rpimemmgr_alloc_sim(BIG_SIZE, 4096, &recycled, NULL,
+            sp);
+    err = err ? err : rpimemmgr_free_by_usraddr(recycled, sp);
+    err = err ? err : rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, big, BIG_SIZE,
+            sp);
+    err = err ? err : read_after(shm, now_ns(), &snap);
+    if (err)
+        return err;
+
+    bp = &snap.stats.backends[RPIMEMMGR_BACKEND_SIM];
+    if (snap.pool_bytes != CHUNK_SIZE
+            || snap.pool_used_bytes != N_SMALL * SMALL_SIZE
+            || snap.recycle_bytes != BIG_SIZE
+            || bp->live_bytes != CHUNK_SIZE + 2 * BIG_SIZE
+            || bp->live_uncached_bytes != bp->live_bytes
+            || snap.stats.n_allocs != N_SMALL + 2
+            || snap.stats.bytes_cleaned != BIG_SIZE) {
+        fprintf(stderr, "Wrong snapshot\n");
+        return 1;
+    }
+
+    for (i = 0; i < N_SMALL && !err; i ++)
+        err = rpimemmgr_free_by_usraddr(small[i], sp);
+    err = err ? err : rpimemmgr_free_by_usraddr(big, sp);
+    err = err ? err : rpimemmgr_set_recycle(0, 0, sp);
+    err = err ? err : read_after(shm, now_ns(), &snap);
+    if (err)
+        return err;
+    /*
+     * The last chunk of a class is kept, and the freed blocks stay in the
+     * cache of this thread.
+     */
+    if (snap.pool_used_bytes != N_SMALL * SMALL_SIZE || snap.recycle_bytes != 0
+            || snap.stats.backends[RPIMEMMGR_BACKEND_SIM].live_bytes
+                    != CHUNK_SIZE) {
+        fprintf(stderr, "Wrong snapshot after free\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    struct rpimemmgr_shm_stats zero;
+    const struct rpimemmgr_shm_stats *shm;
+    char name[64];
+    int err;
+
+    memset(&zero, 0, sizeof(zero));
+    if (rpimemmgr_read_shm_stats(&zero.snapshot, &zero) == 0) {
+        fprintf(stderr, "Read a snapshot out of nothing\n");
+        return 1;
+    }
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    if (rpimemmgr_publish_stats("shm-test", INTERVAL_MS, &st) == 0) {
+        fprintf(stderr, "Published without thread safety\n");
+        err = 1;
+        goto clean_init;
+    }
+    err = rpimemmgr_enable_thread_safety(&st);
+    err = err ? err : rpimemmgr_publish_stats("shm-test", INTERVAL_MS, &st);
+    if (err)
+        goto clean_init;
+
+    printf("Shared memory statistics: ");
+    (void) snprintf(name, sizeof(name), RPIMEMMGR_SHM_PREFIX "%d.0",
+            (int) getpid());
+    shm = map_object(name);
+    if (shm == NULL) {
+        err = 1;
+        goto clean_init;
+    }
+    err = test_object(shm, &st);
+    (void) munmap((void*) shm, sizeof(*shm));
+    if (err)
+        goto clean_init;
+
+    err = rpimemmgr_finalize(&st);
+    if (err)
+        return err;
+    if (shm_open(name, O_RDONLY, 0) != -1 || errno != ENOENT) {
+        fprintf(stderr, "Object was not removed\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
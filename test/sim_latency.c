@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * The simulated backend with a latency per alloc and free, standing in for
+ * the kernel time of a real backend: the time per alloc/free cycle straight
+ * to the backend, through the recycle cache, and through a pool.  The first
+ * must take at least the latency and the other two must hide most of it.
+ */
+
+#define N_CYCLES 256
+#define BUF_SIZE (64 << 10)
+#define ALLOC_US 50
+#define FREE_US 20
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+enum mode {
+    MODE_DIRECT,
+    MODE_RECYCLE,
+    MODE_POOL,
+};
+
+static int bench(const enum mode mode, double *us_per_cyclep)
+{
+    struct rpimemmgr st;
+    double start;
+    uint32_t busaddr;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_set_sim_latency(ALLOC_US, FREE_US, &st);
+    if (!err && mode == MODE_RECYCLE)
+        err = rpimemmgr_set_recycle(16 << 20, 0, &st);
+    if (!err && mode == MODE_POOL)
+        err = rpimemmgr_set_pool(1 << 20, BUF_SIZE, &st);
+    if (err)
+        goto clean_init;
+
+    start = get_time();
+    for (i = 0; i < N_CYCLES; i ++) {
+        void *p;
+        err = rpimemmgr_alloc_sim(BUF_SIZE, 4096, &p, &busaddr, &st);
+        err = err ? err : rpimemmgr_free_by_busaddr(busaddr, &st);
+        if (err)
+            goto clean_init;
+    }
+    *us_per_cyclep = (get_time() - start) / N_CYCLES * 1e6;
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    static const char * const names[] = {"direct", "recycle", "pool"};
+    double us[3];
+    unsigned i;
+    int err;
+
+    for (i = 0; i < 3; i ++) {
+        err = bench(i, &us[i]);
+        if (err)
+            return err;
+        printf("sim %3d+%2d us %-8s: %8.2f [us/cycle]\n", ALLOC_US, FREE_US,
+                names[i], us[i]);
+    }
+
+    if (us[MODE_DIRECT] < ALLOC_US + FREE_US) {
+        fprintf(stderr, "Latency was not applied\n");
+        return 1;
+    }
+    if (us[MODE_RECYCLE] > us[MODE_DIRECT] / 2
+            || us[MODE_POOL] > us[MODE_DIRECT] / 2) {
+        fprintf(stderr, "Recycle cache or pool did not hide the latency\n");
+        return 1;
+    }
+    return 0;
+}
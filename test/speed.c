@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/types.h>
 
 
@@ -28,9 +29,11 @@ double get_time(void)
     return (double) t.tv_sec + t.tv_nsec * 1e-9;
 }
 
-static void test_speed_copy(const size_t size, void *dst, void *src)
+/* Copies with rpimemmgr_memcpy_to() if sp is not NULL, or with memcpy(). */
+static double time_copy(const size_t size, void *dst, void *src,
+        struct rpimemmgr *sp)
 {
-    double start, end, elapsed;
+    double start, end;
     unsigned i;
     const unsigned n_warmup = 16, n_measure = 32;
     /* const unsigned n_cooldown = ...; */
@@ -41,7 +44,10 @@ static void test_speed_copy(const size_t size, void *dst, void *src)
     barrier_data(dst);
 
     for (i = 0; i < n_warmup; i ++) {
-        (void) memcpy(dst, src, size);
+        if (sp != NULL)
+            (void) rpimemmgr_memcpy_to(dst, src, size, sp);
+        else
+            (void) memcpy(dst, src, size);
         barrier_data(src);
         barrier_data(dst);
     }
@@ -50,7 +56,10 @@ static void test_speed_copy(const size_t size, void *dst, void *src)
     start = get_time();
     barrier();
     for (i = 0; i < n_measure; i ++) {
-        (void) memcpy(dst, src, size);
+        if (sp != NULL)
+            (void) rpimemmgr_memcpy_to(dst, src, size, sp);
+        else
+            (void) memcpy(dst, src, size);
         barrier_data(src);
         barrier_data(dst);
     }
@@ -58,8 +67,21 @@ static void test_speed_copy(const size_t size, void *dst, void *src)
     end = get_time();
     barrier();
 
-    elapsed = (end - start) / n_measure;
-    printf("%e [s], %e [B/s]\n", elapsed, size / elapsed);
+    return (end - start) / n_measure;
+}
+
+static void test_speed_copy(const size_t size, void *dst, void *src,
+        struct rpimemmgr *sp)
+{
+    double elapsed;
+
+    elapsed = time_copy(size, dst, src, NULL);
+    printf("%e [s], %e [B/s]", elapsed, size / elapsed);
+    if (sp != NULL) {
+        elapsed = time_copy(size, dst, src, sp);
+        printf(", memcpy_to: %e [B/s]", size / elapsed);
+    }
+    printf("\n");
 }
 
 static int test_malloc(const size_t size)
@@ -79,7 +101,7 @@ static int test_malloc(const size_t size)
         goto clean_dst;
     }
 
-    test_speed_copy(size, dst, src);
+    test_speed_copy(size, dst, src, NULL);
 
     free(src);
 clean_dst:
@@ -106,7 +128,7 @@ static int test_vcsm(const size_t size, const VCSM_CACHE_TYPE_T cache_type)
     if (err)
         goto clean_dst;
 
-    test_speed_copy(size, dst, src);
+    test_speed_copy(size, dst, src, &st);
 
     err |= rpimemmgr_free_by_usraddr(src, &st);
 clean_dst:
@@ -139,7 +161,7 @@ static int test_vcsm_cma(const size_t size, const VCSM_CACHE_TYPE_T cache_type)
     if (err)
         goto clean_dst;
 
-    test_speed_copy(size, dst, src);
+    test_speed_copy(size, dst, src, &st);
 
     err |= rpimemmgr_free_by_usraddr(src, &st);
 clean_dst:
@@ -170,7 +192,7 @@ static int test_mailbox(const size_t size, const uint32_t flags)
     if (err)
         goto clean_dst;
 
-    test_speed_copy(size, dst, src);
+    test_speed_copy(size, dst, src, &st);
 
     err |= rpimemmgr_free_by_usraddr(src, &st);
 clean_dst:
@@ -199,7 +221,36 @@ static int test_drm(const size_t size)
     if (err)
         goto clean_dst;
 
-    test_speed_copy(size, dst, src);
+    test_speed_copy(size, dst, src, &st);
+
+    err |= rpimemmgr_free_by_usraddr(src, &st);
+clean_dst:
+    err |= rpimemmgr_free_by_usraddr(dst, &st);
+clean_init:
+    err |= rpimemmgr_finalize(&st);
+clean_none:
+    return err;
+}
+
+static int test_dma_heap(const size_t size, const enum rpimemmgr_dma_heap heap)
+{
+    void *dst, *src;
+    int err = 0;
+    struct rpimemmgr st;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        goto clean_none;
+
+    err = rpimemmgr_alloc_dma_heap(size, heap, &dst, &st);
+    if (err)
+        goto clean_init;
+
+    err = rpimemmgr_alloc_dma_heap(size, heap, &src, &st);
+    if (err)
+        goto clean_dst;
+
+    test_speed_copy(size, dst, src, &st);
 
     err |= rpimemmgr_free_by_usraddr(src, &st);
 clean_dst:
@@ -217,6 +268,27 @@ int main(void)
     int processor;
     int err;
 
+    printf("malloc:                       ");
+    err = test_malloc(size);
+    if (err)
+        return err;
+
+    /* These run on any Linux with dma-heaps, so they come before the probe. */
+    printf("dma-heap:   system:           ");
+    if (access("/dev/dma_heap/system", R_OK | W_OK) == 0) {
+        err = test_dma_heap(size, RPIMEMMGR_DMA_HEAP_SYSTEM);
+        if (err)
+            return err;
+    } else
+        printf("not available\n");
+    printf("dma-heap:   linux,cma:        ");
+    if (access("/dev/dma_heap/linux,cma", R_OK | W_OK) == 0) {
+        err = test_dma_heap(size, RPIMEMMGR_DMA_HEAP_CMA);
+        if (err)
+            return err;
+    } else
+        printf("not available\n");
+
     err = rpimemmgr_init(&st);
     if (err)
         return err;
@@ -229,11 +301,6 @@ int main(void)
     if (err)
         return err;
 
-    printf("malloc:                       ");
-    err = test_malloc(size);
-    if (err)
-        return err;
-
     printf("VCSM (GPU): NONE:             ");
     err = test_vcsm(size, VCSM_CACHE_TYPE_NONE);
     if (err)
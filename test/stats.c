@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Statistics on the simulated backend: live and peak figures, the recycle
+ * cache holding memory, batches, lookups and synced bytes.  Then the totals
+ * after threads allocate concurrently, and the time of a counted lookup.
+ */
+
+#define N_BUFS 16
+#define BUF_SIZE (64 << 10)
+#define N_THREADS 4
+#define N_CYCLES 10000
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t sum(const uint64_t *hist)
+{
+    uint64_t n = 0;
+    unsigned i;
+
+    for (i = 0; i < RPIMEMMGR_N_LATENCY_BUCKETS; i ++)
+        n += hist[i];
+    return n;
+}
+
+static int test_counts(struct rpimemmgr *sp)
+{
+    const struct rpimemmgr_backend_stats *bp;
+    struct rpimemmgr_alloc_desc descs[N_BUFS];
+    struct rpimemmgr_stats st;
+    uint32_t busaddrs[N_BUFS];
+    void *ps[N_BUFS];
+    unsigned i;
+    int err = 0;
+
+    for (i = 0; i < N_BUFS && !err; i ++)
+        err = rpimemmgr_alloc_sim(BUF_SIZE, 4096, &ps[i], &busaddrs[i], sp);
+    for (i = 0; i < N_BUFS && !err; i ++)
+        err = rpimemmgr_usraddr_to_busaddr(ps[i], sp) == busaddrs[i] ? 0 : 1;
+    /* The sync looks its range up too. */
+    err = err ? err : rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, ps[0],
+            BUF_SIZE, sp);
+    err = err ? err : rpimemmgr_get_stats(&st, sp);
+    if (err)
+        return err;
+    bp = &st.backends[RPIMEMMGR_BACKEND_SIM];
+    if (bp->live_bytes != N_BUFS * BUF_SIZE || bp->live_count != N_BUFS
+            || bp->n_allocs != N_BUFS || sum(bp->alloc_latency) != N_BUFS
+            || st.n_allocs != N_BUFS || st.n_lookups != N_BUFS + 1
+            || st.n_syncs != 1 || st.bytes_cleaned != BUF_SIZE) {
+        fprintf(stderr, "Wrong counts after allocation\n");
+        return 1;
+    }
+
+    for (i = 0; i < N_BUFS && !err; i ++)
+        err = rpimemmgr_free_by_usraddr(ps[i], sp);
+    err = err ? err : rpimemmgr_get_stats(&st, sp);
+    if (err)
+        return err;
+    if (bp->live_bytes != 0 || bp->live_count != 0
+            || bp->peak_bytes != N_BUFS * BUF_SIZE
+            || bp->peak_count != N_BUFS || bp->n_frees != N_BUFS
+            || st.n_frees != N_BUFS) {
+        fprintf(stderr, "Wrong counts after free\n");
+        return 1;
+    }
+
+    /* Memory in the recycle cache is still held from the backend. */
+    for (i = 0; i < N_BUFS; i ++) {
+        descs[i].size = BUF_SIZE;
+        descs[i].align = 4096;
+        descs[i].flags = 0;
+    }
+    err = rpimemmgr_set_recycle(N_BUFS * BUF_SIZE, 0, sp);
+    err = err ? err : rpimemmgr_alloc_sim(BUF_SIZE, 4096, &ps[0], NULL, sp);
+    err = err ? err : rpimemmgr_free_by_usraddr(ps[0], sp);
+    err = err ? err : rpimemmgr_get_stats(&st, sp);
+    if (err)
+        return err;
+    if (bp->live_count != 1 || bp->n_frees != N_BUFS) {
+        fprintf(stderr, "Recycled memory is not counted as live\n");
+        return 1;
+    }
+    err = rpimemmgr_set_recycle(0, 0, sp);
+    err = err ? err : rpimemmgr_alloc_batch(RPIMEMMGR_BACKEND_SIM, N_BUFS,
+            descs, ps, NULL, sp);
+    err = err ? err : rpimemmgr_get_stats(&st, sp);
+    if (err)
+        return err;
+    /* Without a batch call in the backend, a batch is one call per buffer. */
+    if (bp->live_count != N_BUFS || bp->n_frees != N_BUFS + 1
+            || sum(bp->alloc_latency) != 2 * N_BUFS + 1) {
+        fprintf(stderr, "Wrong counts after a batch\n");
+        return 1;
+    }
+    for (i = 0; i < N_BUFS && !err; i ++)
+        err = rpimemmgr_free_by_usraddr(ps[i], sp);
+    return err;
+}
+
+static void* thread_main(void *arg)
+{
+    struct rpimemmgr * const sp = arg;
+    unsigned i;
+
+    for (i = 0; i < N_CYCLES / 10; i ++) {
+        uint32_t busaddr;
+        if (rpimemmgr_alloc_sim(4096, 4096, NULL, &busaddr, sp)
+                || rpimemmgr_free_by_busaddr(busaddr, sp))
+            return (void*) 1;
+    }
+    return NULL;
+}
+
+static int test_threads(void)
+{
+    struct rpimemmgr st;
+    struct rpimemmgr_stats stats;
+    pthread_t threads[N_THREADS];
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    err = rpimemmgr_enable_thread_safety(&st);
+    if (err)
+        goto clean_init;
+
+    for (i = 0; i < N_THREADS; i ++)
+        (void) pthread_create(&threads[i], NULL, thread_main, &st);
+    for (i = 0; i < N_THREADS; i ++) {
+        void *ret;
+        (void) pthread_join(threads[i], &ret);
+        if (ret != NULL)
+            err = 1;
+    }
+    err = err ? err : rpimemmgr_get_stats(&stats, &st);
+    if (!err && (stats.n_allocs != N_THREADS * (N_CYCLES / 10)
+                || stats.backends[RPIMEMMGR_BACKEND_SIM].live_count != 0)) {
+        fprintf(stderr, "Lost counts across threads\n");
+        err = 1;
+    }
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+static int bench_lookup(void)
+{
+    struct rpimemmgr st;
+    double start;
+    void *p;
+    unsigned i;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    err = rpimemmgr_enable_thread_safety(&st);
+    err = err ? err : rpimemmgr_alloc_sim(BUF_SIZE, 4096, &p, NULL, &st);
+    if (err)
+        goto clean_init;
+
+    start = get_time();
+    for (i = 0; i < N_CYCLES; i ++)
+        (void) rpimemmgr_usraddr_to_busaddr((uint8_t*) p + i, &st);
+    printf("usraddr_to_busaddr (thread-safe, counted): %6.1f [ns/call]\n",
+            (get_time() - start) / N_CYCLES * 1e9);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    printf("Statistics (sim): ");
+    err = test_counts(&st);
+    err = err ? err : test_threads();
+    if (!err)
+        printf("OK\n");
+
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err ? err : bench_lookup();
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Backend-aware sync: range checks on the simulated backend, which needs no
+ * cache maintenance, and a round trip on every real backend that is present.
+ */
+
+static int expect(const char *what, const bool cond)
+{
+    if (!cond) {
+        fprintf(stderr, "Failed: %s\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_sync_sim(void)
+{
+    struct rpimemmgr_cache_op_desc descs[3];
+    struct rpimemmgr st;
+    uint8_t *p, *q;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    err = rpimemmgr_set_pool(1 << 20, 4096, &st);
+    err = err ? err : rpimemmgr_alloc_sim(1 << 16, 4096, (void**) &p, NULL,
+            &st);
+    err = err ? err : rpimemmgr_alloc_sim(256, 64, (void**) &q, NULL, &st);
+    if (err)
+        return err;
+
+    descs[0].op = RPIMEMMGR_CACHE_OP_CLEAN;
+    descs[0].usraddr = p + 4096;
+    descs[0].block_count = 4;
+    descs[0].block_size = 1024;
+    descs[0].stride = 8192;
+    descs[1].op = RPIMEMMGR_CACHE_OP_INVALIDATE;
+    descs[1].usraddr = q;
+    descs[1].block_count = 1;
+    descs[1].block_size = 256;
+    descs[1].stride = 0;
+    descs[2] = descs[0];
+    descs[2].block_count = 0;
+
+    if (expect("sync of valid ranges",
+                rpimemmgr_sync_array(3, descs, &st) == 0)
+            || expect("sync of a whole buffer", rpimemmgr_sync(
+                    RPIMEMMGR_CACHE_OP_CLEAN, p, 1 << 16, &st) == 0)
+            || expect("sync past the end of a buffer", rpimemmgr_sync(
+                    RPIMEMMGR_CACHE_OP_CLEAN, p + 4096, 1 << 16, &st) != 0)
+            || expect("sync of unknown memory", rpimemmgr_sync(
+                    RPIMEMMGR_CACHE_OP_CLEAN, &st, sizeof(st), &st) != 0))
+        return 1;
+
+    descs[0].stride = 1 << 15;
+    if (expect("strided sync past the end of a buffer",
+                rpimemmgr_sync_array(1, descs, &st) != 0))
+        return 1;
+
+    err = rpimemmgr_free_by_usraddr(q, &st);
+    if (err || expect("sync of a freed block", rpimemmgr_sync(
+                    RPIMEMMGR_CACHE_OP_CLEAN, q, 256, &st) != 0))
+        return 1;
+
+    return rpimemmgr_finalize(&st);
+}
+
+static int test_sync_backends(void)
+{
+    struct rpimemmgr st;
+    void *p;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    if (rpimemmgr_get_processor(&st) < 0) {
+        printf("Not on a Raspberry Pi; skipping real backends\n");
+        return rpimemmgr_finalize(&st);
+    }
+
+    if (!rpimemmgr_alloc_vcsm(1 << 16, 4096, VCSM_CACHE_TYPE_HOST, &p, NULL,
+                &st)) {
+        err = rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, p, 1 << 16, &st);
+        if (err)
+            goto clean_init;
+        printf("VCSM:                         OK\n");
+    }
+
+    if (!rpimemmgr_alloc_mailbox(1 << 16, 4096, MEM_FLAG_DIRECT, &p, NULL,
+                &st)) {
+        err = rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, p, 1 << 16, &st);
+        if (err)
+            goto clean_init;
+        printf("Mailbox:                      OK\n");
+    }
+
+    if (!rpimemmgr_alloc_drm(1 << 16, &p, NULL, &st)) {
+        err = rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN, p, 1 << 16, &st);
+        err = err ? err : rpimemmgr_sync(RPIMEMMGR_CACHE_OP_INVALIDATE, p,
+                1 << 16, &st);
+        if (err)
+            goto clean_init;
+        printf("DRM:                          OK\n");
+    }
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    int err;
+
+    printf("Sync (sim):                   ");
+    err = test_sync_sim();
+    if (err)
+        return err;
+    printf("OK\n");
+
+    return test_sync_backends();
+}
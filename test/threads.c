@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Multi-threaded stress test on the simulated backend: every thread keeps a
+ * set of live pooled buffers, replaces a random one at each step, stamps the
+ * new one and checks the stamp and the translations of the old one before
+ * freeing it.  The same load is run with thread-safe mode and with a single
+ * global mutex around a non-thread-safe manager for comparison.
+ */
+
+#define N_LIVE  64
+#define N_STEPS 100000
+
+enum mode {
+    MODE_GLOBAL_LOCK,
+    MODE_THREAD_SAFE,
+};
+
+struct buf {
+    uint8_t *usraddr;
+    uint32_t busaddr;
+    size_t size;
+    uint8_t stamp;
+};
+
+struct shared {
+    struct rpimemmgr st;
+    enum mode mode;
+    pthread_mutex_t global_lock;
+};
+
+struct worker {
+    pthread_t thread;
+    struct shared *shared;
+    unsigned seed;
+    int err;
+};
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void lock(struct shared *shared)
+{
+    if (shared->mode == MODE_GLOBAL_LOCK)
+        (void) pthread_mutex_lock(&shared->global_lock);
+}
+
+static void unlock(struct shared *shared)
+{
+    if (shared->mode == MODE_GLOBAL_LOCK)
+        (void) pthread_mutex_unlock(&shared->global_lock);
+}
+
+static int alloc_buf(struct buf *bp, unsigned *seedp, struct shared *shared)
+{
+    int err;
+
+    bp->size = 64 + rand_r(seedp) % 4033;
+    bp->stamp = rand_r(seedp);
+
+    lock(shared);
+    err = rpimemmgr_alloc_sim(bp->size, 64, (void**) &bp->usraddr,
+            &bp->busaddr, &shared->st);
+    unlock(shared);
+    if (err)
+        return err;
+
+    memset(bp->usraddr, bp->stamp, bp->size);
+    return 0;
+}
+
+static int check_and_free_buf(struct buf *bp, struct shared *shared)
+{
+    uint32_t busaddr, busaddr_last;
+    size_t i;
+    int err;
+
+    for (i = 0; i < bp->size; i ++) {
+        if (bp->usraddr[i] != bp->stamp) {
+            fprintf(stderr, "Corrupted buffer: usraddr=%p offset=%zu\n",
+                    bp->usraddr, i);
+            return 1;
+        }
+    }
+
+    lock(shared);
+    busaddr = rpimemmgr_usraddr_to_busaddr(bp->usraddr, &shared->st);
+    busaddr_last = rpimemmgr_usraddr_to_busaddr(bp->usraddr + bp->size - 1,
+            &shared->st);
+    unlock(shared);
+    if (busaddr != bp->busaddr || busaddr_last != bp->busaddr + bp->size - 1) {
+        fprintf(stderr, "Wrong translation: usraddr=%p\n", bp->usraddr);
+        return 1;
+    }
+
+    lock(shared);
+    err = rpimemmgr_free_by_usraddr(bp->usraddr, &shared->st);
+    unlock(shared);
+    return err;
+}
+
+static void* run_worker(void *arg)
+{
+    struct worker * const wp = arg;
+    struct buf bufs[N_LIVE];
+    unsigned i;
+
+    wp->err = 0;
+    for (i = 0; i < N_LIVE; i ++) {
+        wp->err = alloc_buf(&bufs[i], &wp->seed, wp->shared);
+        if (wp->err)
+            return NULL;
+    }
+
+    for (i = 0; i < N_STEPS; i ++) {
+        struct buf * const bp = &bufs[rand_r(&wp->seed) % N_LIVE];
+        wp->err = check_and_free_buf(bp, wp->shared);
+        if (wp->err)
+            return NULL;
+        wp->err = alloc_buf(bp, &wp->seed, wp->shared);
+        if (wp->err)
+            return NULL;
+    }
+
+    for (i = 0; i < N_LIVE; i ++) {
+        wp->err = check_and_free_buf(&bufs[i], wp->shared);
+        if (wp->err)
+            return NULL;
+    }
+    return NULL;
+}
+
+static int test_threads(const enum mode mode, const unsigned n_threads)
+{
+    static struct shared shared;
+    struct worker workers[8];
+    double start, end;
+    unsigned i;
+    int err, err_sum = 0;
+
+    shared.mode = mode;
+    err = pthread_mutex_init(&shared.global_lock, NULL);
+    if (err) {
+        fprintf(stderr, "pthread_mutex_init: %s\n", strerror(err));
+        return 1;
+    }
+
+    err_sum = rpimemmgr_init(&shared.st);
+    if (err_sum)
+        goto clean_mutex;
+
+    err_sum = rpimemmgr_set_pool(1 << 20, 4096, &shared.st);
+    if (err_sum)
+        goto clean_init;
+
+    if (mode == MODE_THREAD_SAFE) {
+        err_sum = rpimemmgr_enable_thread_safety(&shared.st);
+        if (err_sum)
+            goto clean_init;
+    }
+
+    start = get_time();
+    for (i = 0; i < n_threads; i ++) {
+        workers[i].shared = &shared;
+        workers[i].seed = i + 1;
+        err = pthread_create(&workers[i].thread, NULL, run_worker,
+                &workers[i]);
+        if (err) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            err_sum = 1;
+            break;
+        }
+    }
+    while (i -- > 0) {
+        (void) pthread_join(workers[i].thread, NULL);
+        if (workers[i].err)
+            err_sum = workers[i].err;
+    }
+    end = get_time();
+
+    if (!err_sum)
+        printf("%-12s %u thread(s): %12.0f [op/s]\n",
+                mode == MODE_THREAD_SAFE ? "thread-safe" : "global lock",
+                n_threads, n_threads * (N_STEPS + N_LIVE) * 2 / (end - start));
+
+clean_init:
+    err = rpimemmgr_finalize(&shared.st);
+    if (err)
+        err_sum = err;
+clean_mutex:
+    (void) pthread_mutex_destroy(&shared.global_lock);
+    return err_sum;
+}
+
+int main(void)
+{
+    static const unsigned n_threads[] = {1, 2, 4, 8};
+    unsigned i;
+    int err;
+
+    for (i = 0; i < sizeof(n_threads) / sizeof(n_threads[0]); i ++) {
+        err = test_threads(MODE_GLOBAL_LOCK, n_threads[i]);
+        if (err)
+            return err;
+        err = test_threads(MODE_THREAD_SAFE, n_threads[i]);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
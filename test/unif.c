@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * The uniform stream writer on the simulated backend: contents, bus address
+ * entries and overflow.  Then the time to write a stream of 4096 floats with
+ * unif_add_float(), with inline single appends and with one bulk append.
+ */
+
+#define N_UNIFS 4096
+#define N_ITERS 1000
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int test_unif(struct rpimemmgr *sp)
+{
+    static const uint32_t us[3] = {1, 2, 3};
+    static const float fs[2] = {0.5f, -2.0f};
+    struct rpimemmgr_unif unif;
+    uint32_t *p, busaddr, expected[8];
+    int err;
+
+    err = rpimemmgr_alloc_sim(4096, 4096, (void**) &p, &busaddr, sp);
+    if (err)
+        return err;
+
+    /* Room for 8 words only. */
+    rpimemmgr_unif_init(&unif, p, 8 * sizeof(uint32_t));
+    err = rpimemmgr_unif_add_uint(&unif, 42);
+    err |= rpimemmgr_unif_add_float(&unif, 1.0f);
+    err |= rpimemmgr_unif_add_uints(&unif, us, 3);
+    err |= rpimemmgr_unif_add_floats(&unif, fs, 2);
+    err |= rpimemmgr_unif_add_busaddr(&unif, p + 16, sp);
+    if (err || unif.is_overflowed || rpimemmgr_unif_count(&unif) != 8) {
+        fprintf(stderr, "Failed to fill the stream\n");
+        return 1;
+    }
+
+    expected[0] = 42;
+    memcpy(&expected[1], &(float) {1.0f}, 4);
+    memcpy(&expected[2], us, sizeof(us));
+    memcpy(&expected[5], fs, sizeof(fs));
+    expected[7] = busaddr + 64;
+    if (memcmp(p, expected, sizeof(expected)) != 0) {
+        fprintf(stderr, "Wrong stream contents\n");
+        return 1;
+    }
+
+    if (rpimemmgr_unif_add_uint(&unif, 0) == 0 || !unif.is_overflowed) {
+        fprintf(stderr, "Appended past the end\n");
+        return 1;
+    }
+    rpimemmgr_unif_init(&unif, p, 8 * sizeof(uint32_t));
+    if (rpimemmgr_unif_add_floats(&unif, (const float*) p, 9) == 0
+            || rpimemmgr_unif_count(&unif) != 0
+            || rpimemmgr_unif_add_busaddr(&unif, &unif, sp) == 0) {
+        fprintf(stderr, "Accepted a bad bulk or busaddr append\n");
+        return 1;
+    }
+
+    return rpimemmgr_free_by_usraddr(p, sp);
+}
+
+static int bench(struct rpimemmgr *sp)
+{
+    static float fs[N_UNIFS];
+    struct rpimemmgr_unif unif;
+    uint32_t *p;
+    double start, end;
+    unsigned i, j;
+    int err;
+
+    err = rpimemmgr_alloc_sim(N_UNIFS * sizeof(uint32_t), 4096, (void**) &p,
+            NULL, sp);
+    if (err)
+        return err;
+    for (i = 0; i < N_UNIFS; i ++)
+        fs[i] = i * 0.25f;
+
+    start = get_time();
+    for (j = 0; j < N_ITERS; j ++) {
+        uint32_t *q = p;
+        for (i = 0; i < N_UNIFS; i ++)
+            unif_add_float(fs[i], &q);
+        __asm__ volatile ("" : : "r" (p) : "memory");
+    }
+    end = get_time();
+    printf("unif_add_float:           %8.2f [us/stream]\n",
+            (end - start) / N_ITERS * 1e6);
+
+    start = get_time();
+    for (j = 0; j < N_ITERS; j ++) {
+        rpimemmgr_unif_init(&unif, p, N_UNIFS * sizeof(uint32_t));
+        for (i = 0; i < N_UNIFS; i ++)
+            (void) rpimemmgr_unif_add_float(&unif, fs[i]);
+        __asm__ volatile ("" : : "r" (p) : "memory");
+    }
+    end = get_time();
+    if (unif.is_overflowed)
+        return 1;
+    printf("rpimemmgr_unif_add_float: %8.2f [us/stream]\n",
+            (end - start) / N_ITERS * 1e6);
+
+    start = get_time();
+    for (j = 0; j < N_ITERS; j ++) {
+        rpimemmgr_unif_init(&unif, p, N_UNIFS * sizeof(uint32_t));
+        err = rpimemmgr_unif_add_floats(&unif, fs, N_UNIFS);
+        if (err)
+            return err;
+        __asm__ volatile ("" : : "r" (p) : "memory");
+    }
+    end = get_time();
+    printf("rpimemmgr_unif_add_floats:%8.2f [us/stream]\n",
+            (end - start) / N_ITERS * 1e6);
+
+    return rpimemmgr_free_by_usraddr(p, sp);
+}
+
+int main(void)
+{
+    struct rpimemmgr st;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+
+    printf("Uniform writer (sim):         ");
+    err = test_unif(&st);
+    if (err)
+        goto clean_init;
+    printf("OK\n");
+
+    err = bench(&st);
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
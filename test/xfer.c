@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/*
+ * Asynchronous transfers on the simulated backend: per-buffer ordering of
+ * interleaved uploads and downloads, completion through the eventfd, and the
+ * throughput of uploads to many buffers against rpimemmgr_memcpy_to() plus
+ * rpimemmgr_sync() on the calling thread.  On a Raspberry Pi the throughput
+ * is measured with VCSM as well.
+ */
+
+#define N_BUFS 16
+#define N_ROUNDS 64
+#define BUF_SIZE (1 << 16)
+#define BENCH_SIZE (1 << 20)
+#define N_ITERS 16
+
+static inline
+double get_time(void)
+{
+    struct timespec t;
+    (void) clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (double) t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int test_order(void)
+{
+    static uint8_t srcs[N_ROUNDS][BUF_SIZE], outs[N_BUFS][N_ROUNDS][64];
+    struct rpimemmgr_xfer *xfers[N_BUFS];
+    uint8_t *bufs[N_BUFS];
+    struct rpimemmgr st;
+    struct pollfd pfd;
+    uint64_t n_done = 0;
+    unsigned i, j;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    err = rpimemmgr_enable_thread_safety(&st);
+    err = err ? err : rpimemmgr_start_xfer_workers(4, &st);
+    if (err)
+        return err;
+
+    for (i = 0; i < N_ROUNDS; i ++)
+        memset(srcs[i], i, BUF_SIZE);
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_alloc_sim(BUF_SIZE, 4096, (void**) &bufs[i], NULL,
+                &st);
+        if (err)
+            return err;
+    }
+
+    /* Each download must see exactly the upload submitted before it. */
+    for (j = 0; j < N_ROUNDS; j ++) {
+        for (i = 0; i < N_BUFS; i ++) {
+            err = rpimemmgr_upload_async(bufs[i], srcs[(i + j) % N_ROUNDS],
+                    BUF_SIZE, NULL, &st);
+            err = err ? err : rpimemmgr_download_async(outs[i][j],
+                    bufs[i] + BUF_SIZE - 64, 64,
+                    j == N_ROUNDS - 1 ? &xfers[i] : NULL, &st);
+            if (err)
+                return err;
+        }
+    }
+    for (i = 0; i < N_BUFS; i ++) {
+        err = rpimemmgr_xfer_wait(xfers[i], &st);
+        if (err)
+            return err;
+    }
+    for (i = 0; i < N_BUFS; i ++) {
+        for (j = 0; j < N_ROUNDS; j ++) {
+            if (outs[i][j][0] != (i + j) % N_ROUNDS
+                    || outs[i][j][63] != (i + j) % N_ROUNDS) {
+                fprintf(stderr, "Out of order: buffer %u, round %u\n", i, j);
+                return 1;
+            }
+        }
+    }
+
+    /* Every job counts up the eventfd once. */
+    pfd.fd = rpimemmgr_get_xfer_eventfd(&st);
+    pfd.events = POLLIN;
+    while (n_done < 2 * N_BUFS * N_ROUNDS) {
+        uint64_t n;
+        if (poll(&pfd, 1, 1000) != 1) {
+            fprintf(stderr, "Completions missing: %llu\n",
+                    (unsigned long long) n_done);
+            return 1;
+        }
+        if (read(pfd.fd, &n, sizeof(n)) == sizeof(n))
+            n_done += n;
+    }
+
+    if (rpimemmgr_upload_async(srcs[0], srcs[1], 64, NULL, &st) == 0) {
+        fprintf(stderr, "Accepted an upload outside of a buffer\n");
+        return 1;
+    }
+    if (!rpimemmgr_xfer_is_done(NULL, &st)) {
+        fprintf(stderr, "NULL handle is pending\n");
+        return 1;
+    }
+
+    return rpimemmgr_finalize(&st);
+}
+
+static int bench(const char *name, const bool is_vcsm, const unsigned n_workers)
+{
+    static uint8_t src[BENCH_SIZE];
+    struct rpimemmgr_xfer *xfers[N_BUFS];
+    void *bufs[N_BUFS];
+    struct rpimemmgr st;
+    double start, end;
+    unsigned i, j;
+    int err;
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    err = rpimemmgr_enable_thread_safety(&st);
+    if (!err && n_workers != 0)
+        err = rpimemmgr_start_xfer_workers(n_workers, &st);
+    if (err)
+        goto clean_init;
+
+    for (i = 0; i < N_BUFS; i ++) {
+        if (is_vcsm)
+            err = rpimemmgr_alloc_vcsm(BENCH_SIZE, 4096,
+                    VCSM_CACHE_TYPE_HOST, &bufs[i], NULL, &st);
+        else
+            err = rpimemmgr_alloc_sim(BENCH_SIZE, 4096, &bufs[i], NULL, &st);
+        if (err)
+            goto clean_init;
+    }
+
+    start = get_time();
+    for (j = 0; j < N_ITERS; j ++) {
+        for (i = 0; i < N_BUFS; i ++) {
+            if (n_workers == 0) {
+                err = rpimemmgr_memcpy_to(bufs[i], src, BENCH_SIZE, &st);
+                err = err ? err : rpimemmgr_sync(RPIMEMMGR_CACHE_OP_CLEAN,
+                        bufs[i], BENCH_SIZE, &st);
+            } else
+                err = rpimemmgr_upload_async(bufs[i], src, BENCH_SIZE,
+                        &xfers[i], &st);
+            if (err)
+                goto clean_init;
+        }
+        for (i = 0; n_workers != 0 && i < N_BUFS; i ++) {
+            err = rpimemmgr_xfer_wait(xfers[i], &st);
+            if (err)
+                goto clean_init;
+        }
+    }
+    end = get_time();
+
+    if (n_workers == 0)
+        printf("%-5s synchronous: ", name);
+    else
+        printf("%-5s %u workers:   ", name, n_workers);
+    printf("%e [B/s]\n", (double) N_ITERS * N_BUFS * BENCH_SIZE
+            / (end - start));
+
+clean_init:
+    if (rpimemmgr_finalize(&st))
+        err = 1;
+    return err;
+}
+
+int main(void)
+{
+    static const unsigned n_workerss[] = {0, 1, 2, 4};
+    struct rpimemmgr st;
+    bool has_vcsm;
+    unsigned i;
+    int err;
+
+    printf("Transfer order (sim):         ");
+    err = test_order();
+    if (err)
+        return err;
+    printf("OK\n");
+
+    for (i = 0; i < sizeof(n_workerss) / sizeof(n_workerss[0]); i ++) {
+        err = bench("sim", false, n_workerss[i]);
+        if (err)
+            return err;
+    }
+
+    err = rpimemmgr_init(&st);
+    if (err)
+        return err;
+    has_vcsm = rpimemmgr_get_processor(&st) >= 0;
+    err = rpimemmgr_finalize(&st);
+    if (err || !has_vcsm)
+        return err;
+
+    for (i = 0; i < sizeof(n_workerss) / sizeof(n_workerss[0]); i ++) {
+        err = bench("VCSM", true, n_workerss[i]);
+        if (err)
+            return err;
+    }
+    return 0;
+}
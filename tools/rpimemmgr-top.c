@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2026 Idein Inc. ( http://idein.jp/ )
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include "rpimemmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Lists the processes that publish their statistics with
+ * rpimemmgr_publish_stats(), largest live memory first, and refreshes like
+ * top(1).  Rates are taken between two refreshes, so they are blank at first.
+ */
+
+#define SHM_DIR "/dev/shm"
+#define NAME_MAX_LEN 64
+
+static const char * const backend_names[RPIMEMMGR_N_BACKENDS] = {
+    [RPIMEMMGR_BACKEND_VCSM] = "VCSM",
+    [RPIMEMMGR_BACKEND_MAILBOX] = "Mailbox",
+    [RPIMEMMGR_BACKEND_DRM] = "DRM",
+    [RPIMEMMGR_BACKEND_SIM] = "Simulated",
+    [RPIMEMMGR_BACKEND_DMABUF] = "dma-buf",
+};
+
+static double to_mib(const uint64_t bytes)
+{
+    return (double) bytes / (1 << 20);
+}
+
+struct proc {
+    char name[NAME_MAX_LEN];
+    char label[RPIMEMMGR_SHM_LABEL_MAX];
+    int pid;
+    struct rpimemmgr_shm_snapshot cur, prev;
+    bool has_prev;
+};
+
+static void usage(const char * const progname)
+{
+    fprintf(stderr, "Usage: %s [-b] [-d seconds] [-n iterations]\n"
+            "  -b  Batch mode: do not clear the screen\n"
+            "  -d  Delay between refreshes (default: 1)\n"
+            "  -n  Number of refreshes (default: 0, forever)\n", progname);
+}
+
+static uint64_t live_bytes(const struct rpimemmgr_stats * const statsp,
+        uint64_t * const uncachedp)
+{
+    uint64_t bytes = 0;
+    unsigned i;
+
+    *uncachedp = 0;
+    for (i = 0; i < RPIMEMMGR_N_BACKENDS; i ++) {
+        bytes += statsp->backends[i].live_bytes;
+        *uncachedp += statsp->backends[i].live_uncached_bytes;
+    }
+    return bytes;
+}
+
+/* Reads one object; returns 1 if it is not ready, not ours or stale. */
+static int read_proc(const char * const name, struct proc * const pp)
+{
+    const struct rpimemmgr_shm_stats *shm;
+    struct stat st;
+    int fd, err = 1;
+
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+        return 1;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(*shm))
+        goto clean_fd;
+    shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        goto clean_fd;
+
+    /* Still being set up by its process. */
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != RPIMEMMGR_SHM_MAGIC)
+        goto clean_shm;
+    /* Left behind by a process that died. */
+    if (kill(shm->pid, 0) == -1 && errno == ESRCH)
+        goto clean_shm;
+    err = rpimemmgr_read_shm_stats(&pp->cur, shm);
+    if (err)
+        goto clean_shm;
+
+    (void) snprintf(pp->name, sizeof(pp->name), "%s", name);
+    (void) memcpy(pp->label, shm->label, sizeof(pp->label));
+    pp->label[sizeof(pp->label) - 1] = '\0';
+    pp->pid = shm->pid;
+
+clean_shm:
+    (void) munmap((void*) shm, sizeof(*shm));
+clean_fd:
+    (void) close(fd);
+    return err;
+}
+
+/* The label if there is one, the command name otherwise. */
+static void get_label(const struct proc * const pp, char *buf,
+        const size_t size)
+{
+    char path[64];
+    FILE *fp;
+
+    (void) snprintf(buf, size, "%s", pp->label);
+    if (buf[0] != '\0')
+        return;
+    (void) snprintf(path, sizeof(path), "/proc/%d/comm", pp->pid);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return;
+    if (fgets(buf, size, fp) != NULL)
+        buf[strcspn(buf, "\n")] = '\0';
+    (void) fclose(fp);
+}
+
+/* Replaces *procsp with the objects in SHM_DIR, keeping previous samples. */
+static int scan(struct proc ** const procsp, size_t * const np)
+{
+    struct proc *procs = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *ep;
+    DIR *dp;
+
+    dp = opendir(SHM_DIR);
+    if (dp == NULL) {
+        fprintf(stderr, "opendir: %s: %s\n", SHM_DIR, strerror(errno));
+        return 1;
+    }
+    while ((ep = readdir(dp)) != NULL) {
+        char name[NAME_MAX_LEN];
+        size_t i;
+
+        /* The prefix without its leading slash. */
+        if (strncmp(ep->d_name, RPIMEMMGR_SHM_PREFIX + 1,
+                    strlen(RPIMEMMGR_SHM_PREFIX) - 1) != 0
+                || strlen(ep->d_name) + 1 >= sizeof(name))
+            continue;
+        if (n == cap) {
+            struct proc * const p = realloc(procs,
+                    (cap = cap ? cap * 2 : 16) * sizeof(*procs));
+            if (p == NULL) {
+                fprintf(stderr, "realloc: %s\n", strerror(errno));
+                free(procs);
+                (void) closedir(dp);
+                return 1;
+            }
+            procs = p;
+        }
+        name[0] = '/';
+        (void) strcpy(name + 1, ep->d_name);
+        if (read_proc(name, &procs[n]))
+            continue;
+
+        procs[n].has_prev = false;
+        for (i = 0; i < *np; i ++) {
+            if (strcmp((*procsp)[i].name, name) == 0) {
+                procs[n].prev = (*procsp)[i].cur;
+                procs[n].has_prev = true;
+                break;
+            }
+        }
+        n ++;
+    }
+    (void) closedir(dp);
+
+    free(*procsp);
+    *procsp = procs;
+    *np = n;
+    return 0;
+}
+
+static int compare_live(const void *a, const void *b)
+{
+    const struct proc * const p = a, * const q = b;
+    uint64_t uncached;
+    const uint64_t x = live_bytes(&p->cur.stats, &uncached);
+    const uint64_t y = live_bytes(&q->cur.stats, &uncached);
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Per second between the two samples, or -1 without a previous one. */
+static double rate(const struct proc * const pp, const uint64_t cur,
+        const uint64_t prev)
+{
+    const uint64_t dt = pp->cur.time_ns - pp->prev.time_ns;
+
+    if (!pp->has_prev || dt == 0)
+        return -1;
+    return (double) (cur - prev) * 1e9 / dt;
+}
+
+static void print_rate(const double r, const double scale)
+{
+    if (r < 0)
+        printf(" %9s", "-");
+    else
+        printf(" %9.1f", r / scale);
+}
+
+#define RATE(pp, field) \
+        rate((pp), (pp)->cur.stats.field, (pp)->prev.stats.field)
+
+static void print_proc(const struct proc * const pp)
+{
+    const struct rpimemmgr_stats * const s = &pp->cur.stats;
+    char label[RPIMEMMGR_SHM_LABEL_MAX];
+    uint64_t live, uncached;
+    unsigned i;
+
+    get_label(pp, label, sizeof(label));
+    live = live_bytes(s, &uncached);
+    printf("%7d %-16.16s %9.1f %9.1f %9.1f %9.1f %9.1f", pp->pid, label,
+            to_mib(live), to_mib(uncached),
+            to_mib(pp->cur.pool_used_bytes), to_mib(pp->cur.pool_bytes),
+            to_mib(pp->cur.recycle_bytes));
+    print_rate(RATE(pp, n_allocs), 1);
+    print_rate(RATE(pp, n_frees), 1);
+    print_rate(RATE(pp, bytes_cleaned), 1 << 20);
+    print_rate(RATE(pp, bytes_invalidated), 1 << 20);
+    print_rate(RATE(pp, n_mailbox_msgs), 1);
+    printf("\n");
+
+    for (i = 0; i < RPIMEMMGR_N_BACKENDS; i ++) {
+        const struct rpimemmgr_backend_stats * const bp = &s->backends[i];
+        if (bp->n_allocs == 0)
+            continue;
+        printf("%7s   %-14s %9.1f %9.1f %9s %9s %9s", "", backend_names[i],
+                to_mib(bp->live_bytes), to_mib(bp->live_uncached_bytes), "",
+                "", "");
+        print_rate(RATE(pp, backends[i].n_allocs), 1);
+        print_rate(RATE(pp, backends[i].n_frees), 1);
+        printf("  %" PRIu64 " live\n", bp->live_count);
+    }
+}
+
+static void print_all(struct proc * const procs, const size_t n,
+        const bool is_batch, const double delay)
+{
+    uint64_t total = 0, total_uncached = 0;
+    size_t i;
+
+    for (i = 0; i < n; i ++) {
+        uint64_t uncached;
+        total += live_bytes(&procs[i].cur.stats, &uncached);
+        total_uncached += uncached;
+    }
+    qsort(procs, n, sizeof(*procs), compare_live);
+
+    if (!is_batch)
+        printf("\033[H\033[2J");
+    printf("rpimemmgr-top - %zu processes, %.1f MiB live (%.1f MiB uncached),"
+            " every %.1f s\n\n", n, to_mib(total), to_mib(total_uncached),
+            delay);
+    printf("%7s %-16s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "PID",
+            "LABEL", "LIVE MiB", "UNCACHED", "POOL USE", "POOL MiB",
+            "RECYCLE", "ALLOC/s", "FREE/s", "CLEAN MB", "INVAL MB",
+            "MBOX/s");
+    for (i = 0; i < n; i ++)
+        print_proc(&procs[i]);
+    if (is_batch)
+        printf("\n");
+    (void) fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    struct proc *procs = NULL;
+    size_t n = 0;
+    double delay = 1;
+    unsigned long n_iters = 0, i;
+    bool is_batch = !isatty(STDOUT_FILENO);
+    int opt, err = 0;
+
+    while ((opt = getopt(argc, argv, "bd:n:")) != -1) {
+        switch (opt) {
+            case 'b':
+                is_batch = true;
+                break;
+            case 'd':
+                delay = atof(optarg);
+                if (delay <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n':
+                n_iters = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    for (i = 0; n_iters == 0 || i < n_iters; i ++) {
+        struct timespec t;
+
+        if (i != 0) {
+            t.tv_sec = (time_t) delay;
+            t.tv_nsec = (long) ((delay - t.tv_sec) * 1e9);
+            while (nanosleep(&t, &t) == -1 && errno == EINTR)
+                ;
+        }
+        err = scan(&procs, &n);
+        if (err)
+            break;
+        print_all(procs, n, is_batch, delay);
+    }
+
+    free(procs);
+    return err;
+}